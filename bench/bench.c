@@ -0,0 +1,651 @@
+/************************************************************************************
+ * @file bench.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 4 Dec 2017
+ * @brief Benchmarks of the steps of the encoding and the decoding
+ *
+ * This program generates synthetic images (binary P6 and ASCII P3) and texts,
+ * then times separately each step of the encoding and the decoding: the loading
+ * and the writing of the images, the writing of the header, the threads
+ * encoding and decoding the text and the assembly of the decoded text into the
+ * output file. The steps using threads are timed for each number of threads.
+ * As in the encode program, the encoding threads get parts of whole cache lines
+ * of components (see split_lines); the -P option pins the threads on the
+ * processors, to measure the scaling on many cores (-t 1,2,4,8,16,32,64).
+ *
+ * Each measure is the best of several runs, repeated during at least 0.2 s so
+ * that the short steps are not only noise. Binary images being mapped, their
+ * loading includes a read of every page. The results are written in a file,
+ * a measure per line:
+ *   step type megapixels payload_bytes threads seconds mb_per_s
+ * Given a baseline (a results file of a previous run), the program fails if the
+ * throughput of a measure dropped more than the tolerance.
+ ***********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../encode/encode_lib.h"
+#include "../decode/decode_lib.h"
+#include "../libs/alloc.h"
+
+#define MAX_LIST 32
+#define MAX_RESULTS 4096
+#define MAX_THREADS 128
+#define PIXELS_PER_MP 1000000
+#define IMG_WIDTH 2000
+#define HEADER_REPS 100000
+#define PIECE_SIZE 65536
+#define STEP_SIZE 16
+#define MIN_TIME_S 0.2
+#define PAGE_SIZE 4096
+
+/***********************************************************
+ * A measure
+ * @param step the step measured (load, write, header,
+ *             encode, decode or assemble)
+ * @param type type of the image (P6, P3 or - if the step
+ *             does not depend on it)
+ * @param mp size of the image in megapixels
+ * @param payload size of the text in bytes (0 if the step
+ *                does not depend on it)
+ * @param threads number of threads (0 if the step does not
+ *                depend on it)
+ * @param seconds best time of the runs
+ * @param mb_s throughput in MB/s
+ ***********************************************************/
+typedef struct result_st{
+	char step[STEP_SIZE];
+	char type[4];
+	int mp;
+	size_t payload;
+	int threads;
+	double seconds;
+	double mb_s;
+} result_t;
+
+/***********************************************************
+ * Options of the benchmarks
+ * @param sizes sizes of the images in megapixels
+ * @param payloads sizes of the texts in bytes (0 for the
+ *                 capacity of the image)
+ * @param threads numbers of threads
+ * @param reps number of runs of each measure
+ * @param dir directory of the temporary images
+ * @param fmt layout of the payload (see format.h)
+ * @param pin true to pin the threads on the processors
+ ***********************************************************/
+typedef struct options_st{
+	int sizes[MAX_LIST], nb_sizes;
+	size_t payloads[MAX_LIST];
+	int nb_payloads;
+	int threads[MAX_LIST], nb_threads;
+	int reps;
+	char *dir;
+	format_t fmt;
+	bool pin;
+} options_t;
+
+/***********************************************************
+ * Part of the text done by a thread
+ * @param comp pointer to the component of the first bit
+ * @param text pointer to the char holding the first bit
+ * @param first_bit position of the first bit in text[0]
+ * @param nb_bits number of bits of the part
+ * @param nb_char number of chars of the part
+ * @param fd the output file (assembly step)
+ * @param offset position of the part in the output file
+ * @param fmt layout of the payload (see format.h)
+ * @param pin true to pin the thread on a processor
+ * @param index index of the part
+ ***********************************************************/
+typedef struct part_st{
+	uint8_t *comp;
+	char *text;
+	size_t first_bit;
+	size_t nb_bits;
+	size_t nb_char;
+	int fd;
+	off_t offset;
+	format_t fmt;
+	bool pin;
+	int index;
+} part_t;
+
+static result_t results[MAX_RESULTS];
+static int nb_results = 0;
+
+/***********************************************************
+ * Current time of the monotonic clock
+ * @return the time in seconds
+ ***********************************************************/
+static double now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/***********************************************************
+ * To know if a measure needs more runs
+ * @param opt the options
+ * @param run number of runs done
+ * @param start time of the first run
+ * @return true while the number of runs or the minimum
+ *         time is not reached
+ ***********************************************************/
+static bool more_runs(options_t *opt, int run, double start){
+	return run < opt->reps || now() - start < MIN_TIME_S;
+}
+
+/***********************************************************
+ * Read a byte of each page of an image, so that a mapped
+ * image is actually read
+ * @param img the image
+ * @return the sum of the bytes read
+ ***********************************************************/
+static unsigned touch_pages(img_t *img){
+	const uint8_t *p = &img->raw[0].r;
+	size_t size = (size_t)img->width * img->height * sizeof(pixel_t);
+	unsigned sum = 0;
+	for (size_t i = 0; i < size; i += PAGE_SIZE)
+		sum += p[i];
+	return sum;
+}
+
+/***********************************************************
+ * Fill a buffer with pseudo-random bytes (xorshift)
+ * @param buffer the buffer
+ * @param size size in bytes of the buffer
+ * @param mask mask applied to each byte
+ ***********************************************************/
+static void fill_random(void *buffer, size_t size, uint8_t mask){
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	uint8_t *p = buffer;
+	for (size_t i = 0; i < size; i++){
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		p[i] = (uint8_t)(x >> 24) & mask;
+	}
+}
+
+/***********************************************************
+ * Record a measure and display it
+ * @param step the step measured
+ * @param type type of the image
+ * @param mp size of the image in megapixels
+ * @param payload size of the text in bytes
+ * @param threads number of threads
+ * @param seconds best time of the runs
+ * @param bytes number of bytes processed by a run
+ ***********************************************************/
+static void add_result(const char *step, const char *type, int mp, size_t payload, int threads,
+                       double seconds, double bytes){
+	if(nb_results == MAX_RESULTS)
+		return;
+	result_t *r = &results[nb_results++];
+	snprintf(r->step, sizeof(r->step), "%s", step);
+	snprintf(r->type, sizeof(r->type), "%s", type);
+	r->mp = mp;
+	r->payload = payload;
+	r->threads = threads;
+	r->seconds = seconds;
+	r->mb_s = seconds > 0 ? bytes / seconds / 1e6 : 0;
+	printf("%-9s %-2s %5d MP %12zu B %3d threads %12.6f s %10.2f MB/s\n",
+	       r->step, r->type, r->mp, r->payload, r->threads, r->seconds, r->mb_s);
+	fflush(stdout);
+}
+
+/***********************************************************
+ * Threads encoding a part of the text
+ * @param param see the struct part_t
+ * @return NULL
+ ***********************************************************/
+static void *encode_part(void *param){
+	part_t *p = (part_t *)param;
+	if(p->pin)
+		pin_thread(p->index);
+	encode_bits(p->comp, p->text, p->first_bit, p->nb_bits, p->fmt);
+	return NULL;
+}
+
+/***********************************************************
+ * Threads decoding a part of the text
+ * @param param see the struct part_t
+ * @return NULL
+ ***********************************************************/
+static void *decode_part(void *param){
+	part_t *p = (part_t *)param;
+	if(p->pin)
+		pin_thread(p->index);
+	decode_bits(p->comp, p->text, 0, p->nb_char * p->fmt.sym_bits, p->fmt);
+	return NULL;
+}
+
+/***********************************************************
+ * Threads decoding a part of the text piece by piece, each
+ * piece written at its place in the output file (as the
+ * decode program does)
+ * @param param see the struct part_t
+ * @return NULL
+ ***********************************************************/
+static void *assemble_part(void *param){
+	part_t *p = (part_t *)param;
+	char buffer[PIECE_SIZE];
+	size_t piece = PIECE_SIZE - PIECE_SIZE % group_symbols(p->fmt);
+
+	if(p->pin)
+		pin_thread(p->index);
+
+	for (size_t done = 0; done < p->nb_char; done += piece){
+		size_t nb = p->nb_char - done < piece ? p->nb_char - done : piece;
+		decode_bits(p->comp + done * p->fmt.sym_bits / p->fmt.nb_lsb, buffer, 0, nb * p->fmt.sym_bits, p->fmt);
+		if(pwrite(p->fd, buffer, nb, p->offset + done) != (ssize_t)nb)
+			return p;
+	}
+	return NULL;
+}
+
+/***********************************************************
+ * Cut the text in parts of whole groups of chars (see
+ * group_symbols), as the decode program does
+ * @param img the image
+ * @param text the text
+ * @param nb_char number of chars of the text
+ * @param nb_threads number of threads wanted
+ * @param fd the output file (assembly step)
+ * @param opt the options (layout and pinning)
+ * @param parts receives the parts
+ * @return the number of parts
+ ***********************************************************/
+static int split(img_t *img, char *text, size_t nb_char, int nb_threads, int fd, options_t *opt, part_t *parts){
+	format_t fmt = opt->fmt;
+	size_t group = group_symbols(fmt);
+	size_t nb_groups = (nb_char + group - 1) / group;
+	if((size_t)nb_threads > nb_groups)
+		nb_threads = nb_groups;
+
+	for (int i = 0; i < nb_threads; i++){
+		size_t min = nb_groups * i / nb_threads * group;
+		size_t max = nb_groups * (i + 1) / nb_threads * group;
+		parts[i].comp = &img->raw[0].r + payload_offset(fmt) + min * fmt.sym_bits / fmt.nb_lsb;
+		parts[i].text = text + min;
+		parts[i].nb_char = (max < nb_char ? max : nb_char) - min;
+		parts[i].fd = fd;
+		parts[i].offset = min;
+		parts[i].fmt = fmt;
+		parts[i].first_bit = 0;
+		parts[i].nb_bits = parts[i].nb_char * fmt.sym_bits;
+		parts[i].pin = opt->pin;
+		parts[i].index = i;
+	}
+	return nb_threads;
+}
+
+/***********************************************************
+ * Cut the text in parts of whole cache lines of components
+ * (see split_lines), as the encode program does
+ * @param img the image
+ * @param text the text
+ * @param nb_char number of chars of the text
+ * @param nb_threads number of threads wanted
+ * @param opt the options (layout and pinning)
+ * @param parts receives the parts
+ * @return the number of parts
+ ***********************************************************/
+static int split_encode(img_t *img, char *text, size_t nb_char, int nb_threads, options_t *opt, part_t *parts){
+	format_t fmt = opt->fmt;
+	uint8_t *payload = &img->raw[0].r + payload_offset(fmt);
+	line_part_t lines[MAX_THREADS];
+
+	nb_threads = split_lines(payload, nb_char * fmt.sym_bits, fmt.nb_lsb, nb_threads, lines);
+	for (int i = 0; i < nb_threads; i++){
+		parts[i] = (part_t){ .comp = payload + lines[i].first_comp,
+		                     .text = text + lines[i].first_bit / fmt.sym_bits,
+		                     .first_bit = lines[i].first_bit % fmt.sym_bits,
+		                     .nb_bits = lines[i].nb_bits, .fd = -1, .fmt = fmt,
+		                     .pin = opt->pin, .index = i };
+	}
+	return nb_threads;
+}
+
+/***********************************************************
+ * Run the threads of a step, a thread per part
+ * @param routine the threads routine
+ * @param parts the parts
+ * @param nb_parts number of parts
+ * @return false if a thread failed
+ ***********************************************************/
+static bool run_parts(void *(*routine)(void *), part_t *parts, int nb_parts){
+	pthread_t threads[MAX_THREADS];
+	bool ok = true;
+
+	for (int i = 0; i < nb_parts; i++){
+		if (pthread_create(&threads[i], NULL, routine, &parts[i]) != 0){
+			fprintf(stderr, "pthread_create failed!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < nb_parts; i++){
+		void *ret;
+		pthread_join(threads[i], &ret);
+		ok &= ret == NULL;
+	}
+	return ok;
+}
+
+/***********************************************************
+ * Size of a file
+ * @param filename the path of the file
+ * @return the size in bytes
+ ***********************************************************/
+static double file_size(char *filename){
+	struct stat st;
+	return stat(filename, &st) == 0 ? st.st_size : 0;
+}
+
+/***********************************************************
+ * Time the writing and the loading of an image
+ * @param opt the options
+ * @param img the image
+ * @param mp size of the image in megapixels
+ * @param type type of the image (PPM_BINARY or PPM_ASCII)
+ ***********************************************************/
+static void bench_io(options_t *opt, img_t *img, int mp, enum PPM_TYPE type){
+	char path[PATH_MAX];
+	const char *name = type == PPM_BINARY ? "P6" : "P3";
+	double best_write = 0, best_load = 0, first = now();
+
+	snprintf(path, sizeof(path), "%s/bench_%d_%d.ppm", opt->dir, (int)getpid(), mp);
+	for (int r = 0; more_runs(opt, r, first); r++){
+		double start = now();
+		if(!write_ppm(path, img, type)){
+			fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\nExiting now...\n", path);
+			exit(EXIT_FAILURE);
+		}
+		double t = now() - start;
+		best_write = r == 0 || t < best_write ? t : best_write;
+
+		start = now();
+		img_t *loaded = load_ppm(path);
+		volatile unsigned sum = loaded ? touch_pages(loaded) : 0;
+		(void)sum;
+		t = now() - start;
+		if(!loaded){
+			fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", path);
+			exit(EXIT_FAILURE);
+		}
+		free_img(loaded);
+		best_load = r == 0 || t < best_load ? t : best_load;
+	}
+
+	double size = file_size(path);
+	unlink(path);
+	add_result("write", name, mp, 0, 0, best_write, size);
+	add_result("load", name, mp, 0, 0, best_load, size);
+}
+
+/***********************************************************
+ * Time the writing of the header
+ * @param opt the options
+ * @param img the image
+ * @param mp size of the image in megapixels
+ ***********************************************************/
+static void bench_header(options_t *opt, img_t *img, int mp){
+	double best = 0, first = now();
+	for (int r = 0; more_runs(opt, r, first); r++){
+		double start = now();
+		for (int i = 0; i < HEADER_REPS; i++)
+			write_header(&img->raw[0].r, 0, header_size(opt->fmt), i, opt->fmt);
+		double t = now() - start;
+		best = r == 0 || t < best ? t : best;
+	}
+	add_result("header", "-", mp, 0, 0, best, (double)HEADER_REPS * header_size(opt->fmt));
+}
+
+/***********************************************************
+ * Time the threads encoding and decoding a text, and the
+ * assembly of the decoded text, for each number of threads
+ * @param opt the options
+ * @param img the image
+ * @param mp size of the image in megapixels
+ * @param nb_char number of chars of the text
+ ***********************************************************/
+static void bench_text(options_t *opt, img_t *img, int mp, size_t nb_char){
+	static const char *steps[] = {"encode", "decode", "assemble"};
+	void *(*routines[])(void *) = {encode_part, decode_part, assemble_part};
+	char path[PATH_MAX];
+	part_t parts[MAX_THREADS];
+
+	char *text = my_malloc(nb_char);
+	char *decoded = my_malloc(nb_char);
+	fill_random(text, nb_char, opt->fmt.sym_bits == 8 ? 0xFF : 0x7F);
+	snprintf(path, sizeof(path), "%s/bench_%d.txt", opt->dir, (int)getpid());
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\nExiting now...\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	for (int t = 0; t < opt->nb_threads; t++){
+		int nb_threads = opt->threads[t] < MAX_THREADS ? opt->threads[t] : MAX_THREADS;
+		for (int s = 0; s < 3; s++){
+			int nb_parts = s == 0 ? split_encode(img, text, nb_char, nb_threads, opt, parts) :
+			               split(img, s == 1 ? decoded : text, nb_char, nb_threads, fd, opt, parts);
+			double best = 0, first = now();
+			for (int r = 0; more_runs(opt, r, first); r++){
+				double start = now();
+				if(!run_parts(routines[s], parts, nb_parts)){
+					fprintf(stderr, "ERROR WRITING THE OUTPUT FILE %s\nExiting now...\n", path);
+					exit(EXIT_FAILURE);
+				}
+				double time = now() - start;
+				best = r == 0 || time < best ? time : best;
+			}
+			add_result(steps[s], "-", mp, nb_char, nb_parts, best, nb_char);
+		}
+
+		// The steps are only worth timing if the text comes back
+		if(memcmp(text, decoded, nb_char) != 0){
+			fprintf(stderr, "DECODED TEXT DIFFERS FROM THE ENCODED ONE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	close(fd);
+	unlink(path);
+	free(text);
+	free(decoded);
+}
+
+/***********************************************************
+ * Write the results in a file
+ * @param filename the path of the file
+ ***********************************************************/
+static void write_results(char *filename){
+	FILE *f = fopen(filename, "w");
+	if(!f){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\nExiting now...\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(f, "# step type megapixels payload_bytes threads seconds mb_per_s\n");
+	for (int i = 0; i < nb_results; i++){
+		result_t *r = &results[i];
+		fprintf(f, "%s %s %d %zu %d %.6f %.2f\n", r->step, r->type, r->mp, r->payload,
+		        r->threads, r->seconds, r->mb_s);
+	}
+	if(fclose(f) != 0){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\nExiting now...\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/***********************************************************
+ * Compare the results with the ones of a baseline
+ * @param filename the path of the baseline
+ * @param tolerance drop of throughput allowed, in percent
+ * @return the number of measures whose throughput dropped
+ *         more than the tolerance
+ ***********************************************************/
+static int compare_baseline(char *filename, double tolerance){
+	FILE *f = fopen(filename, "r");
+	if(!f){
+		fprintf(stderr, "FILE %s NOT FOUND OR CANNOT BE OPENED\nExiting now...\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[256];
+	int nb_compared = 0, nb_regressions = 0;
+	while(fgets(line, sizeof(line), f)){
+		result_t b;
+		if(line[0] == '#' || sscanf(line, "%15s %3s %d %zu %d %lf %lf", b.step, b.type, &b.mp,
+		                            &b.payload, &b.threads, &b.seconds, &b.mb_s) != 7)
+			continue;
+		for (int i = 0; i < nb_results; i++){
+			result_t *r = &results[i];
+			if(strcmp(r->step, b.step) != 0 || strcmp(r->type, b.type) != 0 || r->mp != b.mp ||
+			   r->payload != b.payload || r->threads != b.threads)
+				continue;
+			nb_compared++;
+			if(r->mb_s < b.mb_s * (1 - tolerance / 100)){
+				nb_regressions++;
+				printf("REGRESSION %s %s %d MP %zu B %d threads: %.2f MB/s instead of %.2f MB/s\n",
+				       r->step, r->type, r->mp, r->payload, r->threads, r->mb_s, b.mb_s);
+			}
+		}
+	}
+	fclose(f);
+	printf("%d measures compared with %s, %d regressions (tolerance %.0f%%)\n",
+	       nb_compared, filename, nb_regressions, tolerance);
+	return nb_regressions;
+}
+
+/***********************************************************
+ * Display the program's syntaxe.
+ * @param argv program's command line arguments
+ ***********************************************************/
+void usage(char **argv){
+	fprintf(stderr, "\nInvalid arguments\n\n"\
+        "usage: %s [-s sizes] [-p payloads] [-t threads] [-n runs] [-d dir]\n"\
+		"       [-k bits] [-8] [-P] [-o results] [-c baseline] [-r tolerance]\n"\
+		"       -s sizes of the images in megapixels (default 1,4,16)\n"\
+		"       -p sizes of the texts, with K, M or G, or max for the capacity\n"\
+		"          of the image (default 1K,1M,max)\n"\
+		"       -t numbers of threads (default 1,2,4,8)\n"\
+		"       -n number of runs of each measure, the best one is kept (default 3)\n"\
+		"       -d directory of the temporary files (default /tmp)\n"\
+		"       -k bits per component (1 to %d) and -8 symbols of 8 bits\n"\
+		"       -P pins each thread on a processor\n"\
+		"       -o file receiving the results (default bench_results.txt)\n"\
+		"       -c results of a previous run: fails if a throughput dropped\n"\
+		"          more than the tolerance (-r, default 20 percent).\n",
+		basename(argv[0]), MAX_LSB);
+	exit(EXIT_FAILURE);
+}
+
+/***********************************************************
+ * Parse a list of values separated by commas
+ * @param str the list
+ * @param values receives the values
+ * @param is_size true for sizes in bytes (see parse_size),
+ *                max giving 0
+ * @param argv program's command line arguments
+ * @return the number of values
+ ***********************************************************/
+static int parse_list(char *str, void *values, bool is_size, char **argv){
+	int nb = 0;
+	for (char *tok = strtok(str, ","); tok; tok = strtok(NULL, ",")){
+		if(nb == MAX_LIST)
+			usage(argv);
+		if(is_size){
+			size_t size = strcmp(tok, "max") == 0 ? 0 : parse_size(tok);
+			if(size == 0 && strcmp(tok, "max") != 0)
+				usage(argv);
+			((size_t *)values)[nb++] = size;
+		}else{
+			int value = atoi(tok);
+			if(value <= 0)
+				usage(argv);
+			((int *)values)[nb++] = value;
+		}
+	}
+	if(nb == 0)
+		usage(argv);
+	return nb;
+}
+
+/****************************************************
+ * Program entry point.
+ * @param argc command line argument count
+ * @param argv program's command line arguments
+ ****************************************************/
+int main(int argc, char **argv){
+	char default_sizes[] = "1,4,16", default_payloads[] = "1K,1M,max", default_threads[] = "1,2,4,8";
+	options_t opt = { .reps = 3, .dir = "/tmp", .fmt = DEFAULT_FORMAT };
+	char *results_file = "bench_results.txt", *baseline = NULL;
+	double tolerance = 20;
+
+	opt.nb_sizes = parse_list(default_sizes, opt.sizes, false, argv);
+	opt.nb_payloads = parse_list(default_payloads, opt.payloads, true, argv);
+	opt.nb_threads = parse_list(default_threads, opt.threads, false, argv);
+
+	// Parse command line
+	int c;
+	while((c = getopt(argc, argv, "s:p:t:n:d:k:8Po:c:r:")) != -1){
+		switch(c){
+			case 's': opt.nb_sizes = parse_list(optarg, opt.sizes, false, argv); break;
+			case 'p': opt.nb_payloads = parse_list(optarg, opt.payloads, true, argv); break;
+			case 't': opt.nb_threads = parse_list(optarg, opt.threads, false, argv); break;
+			case 'n': opt.reps = atoi(optarg); break;
+			case 'd': opt.dir = optarg; break;
+			case 'k': opt.fmt.nb_lsb = atoi(optarg); break;
+			case '8': opt.fmt.sym_bits = 8; break;
+			case 'P': opt.pin = true; break;
+			case 'o': results_file = optarg; break;
+			case 'c': baseline = optarg; break;
+			case 'r': tolerance = atof(optarg); break;
+			default: usage(argv);
+		}
+	}
+	if(optind != argc || opt.reps <= 0 || tolerance < 0 || !is_valid_format(opt.fmt))
+		usage(argv);
+
+	for (int s = 0; s < opt.nb_sizes; s++){
+		int mp = opt.sizes[s];
+		img_t *img = alloc_img(IMG_WIDTH, (size_t)mp * PIXELS_PER_MP / IMG_WIDTH);
+		if(!img){
+			fprintf(stderr, "IMAGE OF %d MEGAPIXELS TOO LARGE FOR THE MEMORY\nExiting now...\n", mp);
+			exit(EXIT_FAILURE);
+		}
+		fill_random(img->raw, (size_t)img->width * img->height * sizeof(pixel_t), 0xFF);
+
+		bench_io(&opt, img, mp, PPM_BINARY);
+		bench_io(&opt, img, mp, PPM_ASCII);
+		bench_header(&opt, img, mp);
+		size_t capacity = max_char_encode(img, opt.fmt), done[MAX_LIST];
+		for (int p = 0; p < opt.nb_payloads; p++){
+			// The texts larger than the image are cut to its capacity, once
+			done[p] = opt.payloads[p] && opt.payloads[p] < capacity ? opt.payloads[p] : capacity;
+			bool measured = false;
+			for (int q = 0; q < p; q++)
+				measured |= done[q] == done[p];
+			if(!measured)
+				bench_text(&opt, img, mp, done[p]);
+		}
+		free_img(img);
+	}
+
+	write_results(results_file);
+	printf("Results written in %s\n", results_file);
+	if(baseline && compare_baseline(baseline, tolerance) > 0)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
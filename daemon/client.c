@@ -0,0 +1,117 @@
+/************************************************************************************
+ * @file client.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 28 Nov 2017
+ * @brief Send a job to the steg daemon
+ *
+ * This program sends an encode, decode or stats request to the daemon listening
+ * on a Unix socket (argument 1) and displays its response. The relative paths
+ * are given to the daemon as absolute paths, as it may run in another directory.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.h"
+#include "../libs/alloc.h"
+
+/***********************************************************
+ * Append a path to the arguments of a request
+ * @param args the arguments of the request
+ * @param length pointer to the size of the arguments
+ * @param path the path, made absolute if it is relative
+ ***********************************************************/
+void add_path(char *args, uint32_t *length, const char *path){
+	char cwd[PATH_MAX] = "";
+
+	if(path[0] != '/' && path[0] != '\0' && !getcwd(cwd, sizeof(cwd))){
+		fprintf(stderr, "CANNOT GET THE CURRENT DIRECTORY\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	int nb = snprintf(args + *length, MAX_REQUEST_SIZE - *length, "%s%s%s",
+	                  cwd, cwd[0] ? "/" : "", path);
+	if(nb < 0 || *length + nb + 1 > MAX_REQUEST_SIZE){
+		fprintf(stderr, "PATH %s TOO LONG\nExiting now...\n", path);
+		exit(EXIT_FAILURE);
+	}
+	*length += nb + 1;
+}
+
+/***********************************************************
+ * Display the program's syntaxe.
+ * @param argv program's command line arguments
+ ***********************************************************/
+void usage(char **argv){
+	fprintf(stderr, "\nNumber of arguments is invalid\n\n"\
+        "usage: %s socket_path encode text_file input_image output_image\n"\
+        "       %s socket_path decode image [output_file]\n"\
+        "       %s socket_path stats\n"\
+		"       where socket_path is the Unix socket of the daemon.\n",
+		basename(argv[0]), basename(argv[0]), basename(argv[0]));
+	exit(EXIT_FAILURE);
+}
+
+/****************************************************
+ * Program entry point.
+ * @param argc command line argument count
+ * @param argv program's command line arguments
+ ****************************************************/
+int main(int argc, char **argv){
+	// Parse command line and build the request
+	char args[MAX_REQUEST_SIZE];
+	request_t request = { .magic = STEG_MAGIC, .length = 0 };
+
+	if(argc == 6 && strcmp(argv[2], "encode") == 0){
+		request.op = OP_ENCODE;
+		for (int i = 3; i < 6; i++)
+			add_path(args, &request.length, argv[i]);
+	}else if((argc == 4 || argc == 5) && strcmp(argv[2], "decode") == 0){
+		request.op = OP_DECODE;
+		add_path(args, &request.length, argv[3]);
+		add_path(args, &request.length, argc == 5 ? argv[4] : "");
+	}else if(argc == 3 && strcmp(argv[2], "stats") == 0){
+		request.op = OP_STATS;
+	}else{
+		usage(argv);
+	}
+
+    // Connect to the daemon and send the request
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+		fprintf(stderr, "CANNOT CONNECT TO THE DAEMON ON %s\nExiting now...\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	response_t response;
+	if(!send_all(fd, &request, sizeof(request)) || !send_all(fd, args, request.length) ||
+	   !recv_all(fd, &response, sizeof(response)) || response.magic != STEG_MAGIC){
+		fprintf(stderr, "NO RESPONSE FROM THE DAEMON\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+
+    // Display the response (decoded text, statistics or error)
+	char *data = my_malloc(response.length + 1);
+	if(!recv_all(fd, data, response.length)){
+		fprintf(stderr, "NO RESPONSE FROM THE DAEMON\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	if(response.status != 0){
+		data[response.length] = '\0';
+		fprintf(stderr, "%s\nExiting now...\n", data);
+		exit(EXIT_FAILURE);
+	}
+	fwrite(data, 1, response.length, stdout);
+	if(request.op != OP_STATS)
+		fprintf(stderr, "Job done in %llu us (%llu us in the queue)\n",
+		        (unsigned long long)response.service_us, (unsigned long long)response.queued_us);
+
+	free(data);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+/************************************************************************************
+ * @file daemon.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 28 Nov 2017
+ * @brief Long-running daemon doing encode and decode jobs
+ *
+ * This program listens on a Unix socket (argument 1) and receives encode and
+ * decode jobs (see protocol.h). The jobs are done by a pool of workers
+ * (argument 2) created once at startup, so a job costs neither a process nor
+ * threads creation. Statistics (queue depth, jobs latency) are sent back to
+ * the clients asking for them. The requests are read by reader threads (at most
+ * MAX_READERS at a time), so a client slow to send its request does not hold up
+ * the others. The daemon stops on SIGINT or SIGTERM.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon_lib.h"
+#include "../libs/alloc.h"
+
+#define NB_ARG 2
+#define DEFAULT_QUEUE_SIZE 64
+#define RECV_TIMEOUT_S 5
+#define MAX_READERS 32
+
+static volatile sig_atomic_t stop = 0;
+
+/***********************************************************
+ * The reader threads receiving the requests
+ * @param lock protects nb_readers
+ * @param done signaled when a reader ends
+ * @param nb_readers number of readers running
+ ***********************************************************/
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int nb_readers;
+} readers = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+
+/***********************************************************
+ * A client accepted, given to a reader thread
+ * @param pool the pool of workers
+ * @param fd the socket of the client
+ ***********************************************************/
+typedef struct {
+	pool_t *pool;
+	int fd;
+} client_t;
+
+/***********************************************************
+ * Handler of SIGINT and SIGTERM, stopping the daemon
+ * @param sig the signal received
+ ***********************************************************/
+static void on_signal(int sig){
+	(void)sig;
+	stop = 1;
+}
+
+/***********************************************************
+ * Receive the request of a client and put it in the queue
+ * (statistics requests are answered at once)
+ * @param pool the pool of workers
+ * @param fd the socket of the client
+ ***********************************************************/
+void handle_client(pool_t *pool, int fd){
+	struct timeval timeout = { .tv_sec = RECV_TIMEOUT_S };
+	request_t request;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if(!recv_all(fd, &request, sizeof(request)) || request.magic != STEG_MAGIC ||
+	   request.length > MAX_REQUEST_SIZE){
+		close(fd);
+		return;
+	}
+
+    // The arguments are always terminated by '\0'
+	char *args = my_calloc(request.length + 1, sizeof(char));
+	if(!recv_all(fd, args, request.length)){
+		free(args);
+		close(fd);
+		return;
+	}
+
+	if(request.op == OP_STATS){
+		char stats[512];
+		pool_stats(pool, stats, sizeof(stats));
+		response_t response = { .magic = STEG_MAGIC, .length = strlen(stats) };
+		send_all(fd, &response, sizeof(response));
+		send_all(fd, stats, response.length);
+		free(args);
+		close(fd);
+		return;
+	}
+
+	job_t *job = my_malloc(sizeof(job_t));
+	job->fd = fd;
+	job->request = request;
+	job->args = args;
+	submit_job(pool, job);
+}
+
+/***********************************************************
+ * Reader thread: receive the request of one client
+ * @param param the client (freed here)
+ * @return NULL
+ ***********************************************************/
+static void *reader_thread(void *param){
+	client_t *client = param;
+
+	handle_client(client->pool, client->fd);
+	free(client);
+
+	pthread_mutex_lock(&readers.lock);
+	readers.nb_readers--;
+	pthread_cond_broadcast(&readers.done);
+	pthread_mutex_unlock(&readers.lock);
+	return NULL;
+}
+
+/***********************************************************
+ * Give an accepted client to a reader thread, waiting while
+ * MAX_READERS are running (the client is read at once when
+ * no thread can be created)
+ * @param pool the pool of workers
+ * @param fd the socket of the client
+ ***********************************************************/
+static void start_reader(pool_t *pool, int fd){
+	client_t *client = my_malloc(sizeof(client_t));
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t signals, old;
+
+	client->pool = pool;
+	client->fd = fd;
+	pthread_mutex_lock(&readers.lock);
+	while(readers.nb_readers >= MAX_READERS)
+		pthread_cond_wait(&readers.done, &readers.lock);
+	readers.nb_readers++;
+	pthread_mutex_unlock(&readers.lock);
+
+    // The signals must interrupt accept, not a reader
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int ret = pthread_create(&thread, &attr, reader_thread, client);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(ret != 0)
+		reader_thread(client);
+}
+
+/***********************************************************
+ * Display the program's syntaxe.
+ * @param argv program's command line arguments
+ ***********************************************************/
+void usage(char **argv){
+	fprintf(stderr, "\nNumber of arguments is invalid\n\n"\
+        "usage: %s [-q queue_size] socket_path worker_count\n"\
+		"       where socket_path is the Unix socket to listen on\n"\
+		"       and worker_count the number of workers doing the jobs.\n"\
+		"       -q sets the maximum number of jobs waiting (default %d).\n",
+		basename(argv[0]), DEFAULT_QUEUE_SIZE);
+	exit(EXIT_FAILURE);
+}
+
+/****************************************************
+ * Program entry point.
+ * @param argc command line argument count
+ * @param argv program's command line arguments
+ ****************************************************/
+int main(int argc, char **argv){
+	// Parse command line
+	int queue_size = DEFAULT_QUEUE_SIZE;
+	int opt;
+	while((opt = getopt(argc, argv, "q:")) != -1){
+		switch(opt){
+			case 'q':
+				queue_size = atoi(optarg);
+				if(queue_size <= 0)
+					usage(argv);
+				break;
+			default:
+				usage(argv);
+		}
+	}
+	if(argc - optind != NB_ARG)
+		usage(argv);
+	char *path = argv[optind];
+	int nb_workers = atoi(argv[optind + 1]);
+
+    if(nb_workers <= 0){
+        fprintf(stderr,"NUMBERS OF WORKERS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+    }
+
+    // Listen on the socket
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "SOCKET PATH %s TOO LONG\nExiting now...\n", path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0 || bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server, SOMAXCONN) != 0){
+		fprintf(stderr, "CANNOT LISTEN ON %s\nExiting now...\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+    // No SA_RESTART, so that accept is interrupted by the signals
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pool_t *pool = create_pool(nb_workers, queue_size);
+	printf("Listening on %s with %d workers\n", path, nb_workers);
+	fflush(stdout);
+
+	while(!stop){
+		int fd = accept(server, NULL, NULL);
+		if(fd < 0){
+			if(errno != EINTR)
+				perror("accept");
+			continue;
+		}
+		start_reader(pool, fd);
+	}
+
+    // Finish the requests being read and the jobs already received
+	close(server);
+	unlink(path);
+	pthread_mutex_lock(&readers.lock);
+	while(readers.nb_readers > 0)
+		pthread_cond_wait(&readers.done, &readers.lock);
+	pthread_mutex_unlock(&readers.lock);
+	destroy_pool(pool);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/************************************************************************************
+ * @file daemon_lib.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 28 Nov 2017
+ * @brief Pool of workers doing the jobs received by the daemon
+ *
+ * The workers are created once with the pool and take the jobs from a bounded
+ * queue. Each job is done by a single worker, in its own image and text buffers,
+ * which are only grown when a job needs more memory than the previous ones.
+ * Errors never stop the daemon: they are sent back to the client.
+ ***********************************************************************************/
+#include <unistd.h>
+#include <sys/stat.h>
+#include "daemon_lib.h"
+#include "../libs/alloc.h"
+#include "../libs/lz.h"
+#include "../libs/crc32c.h"
+
+#define MSG_SIZE 256
+#define MAX_ARGS 3
+
+/***********************************************************
+ * Time elapsed between two instants
+ * @param from the first instant
+ * @param to the second instant
+ * @return the elapsed time in microseconds
+ ***********************************************************/
+static uint64_t elapsed_us(struct timespec *from, struct timespec *to){
+	return (to->tv_sec - from->tv_sec) * 1000000LL + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/***********************************************************
+ * Make sure a buffer of a worker is large enough
+ * @param buffer pointer to the buffer, reallocated if needed
+ * @param size pointer to the size of the buffer
+ * @param needed size in bytes needed by the job
+ * @return false if the memory cannot be allocated
+ ***********************************************************/
+static bool reserve(void **buffer, size_t *size, size_t needed){
+	if(needed <= *size)
+		return true;
+	void *ptr = realloc(*buffer, needed);
+	if(!ptr)
+		return false;
+	*buffer = ptr;
+	*size = needed;
+	return true;
+}
+
+/***********************************************************
+ * Load a binary image into the image buffer of a worker
+ * @param w the worker
+ * @param filename the path of the image
+ * @param img receives the image, using the worker buffer
+ * @param msg receives the error message
+ * @return false if the image cannot be loaded
+ ***********************************************************/
+static bool load_image(worker_t *w, char *filename, img_t *img, char *msg){
+	ppm_stream_t *s = open_ppm_stream(filename);
+	if(!s){
+		snprintf(msg, MSG_SIZE, "CANNOT READ THE IMAGE %s", filename);
+		return false;
+	}
+	size_t size = (size_t)s->width * s->height * sizeof(pixel_t);
+	bool ok = reserve((void **)&w->pixels, &w->pixels_size, size) &&
+	          read_ppm_band(s, w->pixels, s->height);
+	if(!ok)
+		snprintf(msg, MSG_SIZE, "CANNOT READ THE IMAGE %s", filename);
+
+	img->width = s->width;
+	img->height = s->height;
+	img->raw = w->pixels;
+	img->pix = NULL;
+	img->map = NULL;
+	img->map_size = 0;
+	img->block_size = 0;
+	close_ppm_stream(s);
+	return ok;
+}
+
+/***********************************************************
+ * Encode a text into an image
+ * @param w the worker doing the job
+ * @param args text_file, input_image and output_image
+ * @param msg receives the error message
+ * @return 0 if the job succeeded
+ ***********************************************************/
+static int run_encode(worker_t *w, char **args, char *msg){
+	struct stat st;
+	img_t img;
+
+	if(stat(args[0], &st) != 0){
+		snprintf(msg, MSG_SIZE, "CANNOT DETERMINATE SIZE OF %s", args[0]);
+		return 1;
+	}
+	uint nb_char = st.st_size;
+	if(!load_image(w, args[1], &img, msg))
+		return 1;
+	if(nb_char > max_char_encode(&img, DEFAULT_FORMAT)){
+		snprintf(msg, MSG_SIZE, "TEXT TOO LONG FOR THIS IMAGE");
+		return 1;
+	}
+
+	FILE *f = fopen(args[0], "r");
+	bool ok = f && reserve((void **)&w->text, &w->text_size, nb_char) &&
+	          fread(w->text, 1, nb_char, f) == nb_char;
+	if(f)
+		fclose(f);
+	if(!ok){
+		snprintf(msg, MSG_SIZE, "FILE %s NOT FOUND OR CANNOT BE OPENED", args[0]);
+		return 1;
+	}
+
+	encode_text(&img, w->text, nb_char, DEFAULT_FORMAT);
+
+	ppm_stream_t *out = create_ppm_stream(args[2], img.width, img.height, NULL);
+	ok = out && write_ppm_band(out, img.raw, img.height);
+	if(!out || !close_ppm_stream(out) || !ok){
+		snprintf(msg, MSG_SIZE, "ERROR CREATING THE OUTPUT FILE %s", args[2]);
+		return 1;
+	}
+	return 0;
+}
+
+/***********************************************************
+ * Decode the text hidden in an image
+ * @param w the worker doing the job
+ * @param args image and output_file (empty to send the text)
+ * @param msg receives the error message
+ * @param length receives the length of the text to send
+ * @return 0 if the job succeeded
+ ***********************************************************/
+static int run_decode(worker_t *w, char **args, char *msg, size_t *length){
+	img_t img;
+	format_t fmt;
+
+	if(!load_image(w, args[0], &img, msg))
+		return 1;
+	int nb_char = get_nb_char_img(&img, &fmt);
+	if(nb_char < 0 || (uint)nb_char > max_char_encode(&img, fmt)){
+		snprintf(msg, MSG_SIZE, "NO VALID TEXT IN THE IMAGE %s", args[0]);
+		return 1;
+	}
+	if(fmt.keyed){
+		snprintf(msg, MSG_SIZE, "THE TEXT OF %s IS SCATTERED WITH A KEY", args[0]);
+		return 1;
+	}
+	if(fmt.container){
+		snprintf(msg, MSG_SIZE, "THE IMAGE %s HOLDS A CONTAINER: USE decode -e", args[0]);
+		return 1;
+	}
+	if(fmt.sharded && fmt.nb_shards > 1){
+		snprintf(msg, MSG_SIZE, "THE IMAGE %s HOLDS A PART OF A TEXT CUT OVER %d IMAGES: USE decode -M",
+		         args[0], fmt.nb_shards);
+		return 1;
+	}
+
+    // A compressed text is decoded into the packed buffer, then decompressed
+	bool compressed = fmt.codec != CODEC_NONE;
+	size_t text_len = compressed ? fmt.raw_len : (size_t)nb_char;
+	if(!reserve((void **)&w->text, &w->text_size, text_len) ||
+	   (compressed && !reserve((void **)&w->packed, &w->packed_size, nb_char))){
+		snprintf(msg, MSG_SIZE, "TEXT TOO LONG FOR THE MEMORY OF THE DAEMON");
+		return 1;
+	}
+
+	decode_text(&img, compressed ? w->packed : w->text, nb_char, fmt);
+	if(fmt.checked && crc32c(0, compressed ? w->packed : w->text, nb_char) != fmt.checksum){
+		snprintf(msg, MSG_SIZE, "THE TEXT OF %s DOES NOT MATCH ITS CHECKSUM", args[0]);
+		return 1;
+	}
+	if(compressed && !lz_decompress(w->packed, nb_char, w->text, text_len, 1)){
+		snprintf(msg, MSG_SIZE, "NO VALID TEXT IN THE IMAGE %s", args[0]);
+		return 1;
+	}
+
+	if(args[1][0] == '\0'){
+		*length = text_len;
+		return 0;
+	}
+	FILE *f = fopen(args[1], "w");
+	bool ok = f && fwrite(w->text, 1, text_len, f) == text_len;
+	if(!f || fclose(f) != 0 || !ok){
+		snprintf(msg, MSG_SIZE, "ERROR CREATING THE OUTPUT FILE %s", args[1]);
+		return 1;
+	}
+	return 0;
+}
+
+/***********************************************************
+ * Do a job, send its response and update the statistics
+ * @param w the worker doing the job
+ * @param job the job, freed once done
+ ***********************************************************/
+static void run_job(worker_t *w, job_t *job){
+	pool_t *pool = w->pool;
+	char msg[MSG_SIZE] = "";
+	char *args[MAX_ARGS];
+	size_t length = 0;
+	int status = 1;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Split the arguments (strings terminated by '\0')
+	int nb_args = 0;
+	for (uint32_t i = 0; i < job->request.length && nb_args < MAX_ARGS; i += strlen(job->args + i) + 1)
+		args[nb_args++] = job->args + i;
+
+	if(job->request.op == OP_ENCODE && nb_args == 3)
+		status = run_encode(w, args, msg);
+	else if(job->request.op == OP_DECODE && nb_args == 2)
+		status = run_decode(w, args, msg, &length);
+	else
+		snprintf(msg, MSG_SIZE, "INVALID REQUEST");
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	response_t response = {
+		.magic = STEG_MAGIC,
+		.status = status,
+		.length = status ? strlen(msg) : length,
+		.queued_us = elapsed_us(&job->queued, &start),
+		.service_us = elapsed_us(&start, &end)
+	};
+	send_all(job->fd, &response, sizeof(response));
+	send_all(job->fd, status ? msg : w->text, response.length);
+	close(job->fd);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->busy--;
+	pool->nb_jobs++;
+	pool->nb_failed += status != 0;
+	pool->last_us = response.queued_us + response.service_us;
+	pool->total_us += pool->last_us;
+	if(pool->last_us > pool->max_us)
+		pool->max_us = pool->last_us;
+	pthread_mutex_unlock(&pool->lock);
+
+	free(job->args);
+	free(job);
+}
+
+/***********************************************************
+ * Threads of the workers, doing the jobs of the queue until
+ * the pool is destroyed
+ * @param param the worker (see the struct worker_t)
+ * @return NULL
+ ***********************************************************/
+static void *worker_thread(void *param){
+	worker_t *w = (worker_t *)param;
+	pool_t *pool = w->pool;
+
+	for(;;){
+		pthread_mutex_lock(&pool->lock);
+		while(!pool->head && !pool->closing)
+			pthread_cond_wait(&pool->not_empty, &pool->lock);
+		job_t *job = pool->head;
+		if(!job){
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pool->head = job->next;
+		if(!pool->head)
+			pool->tail = NULL;
+		pool->depth--;
+		pool->busy++;
+		pthread_cond_signal(&pool->not_full);
+		pthread_mutex_unlock(&pool->lock);
+
+		run_job(w, job);
+	}
+
+	free(w->pixels);
+	free(w->text);
+	free(w->packed);
+	return NULL;
+}
+
+/***********************************************************
+ * Create a pool and start its workers
+ * @param nb_workers number of workers
+ * @param max_depth maximum number of jobs in the queue
+ * @return the pool
+ ***********************************************************/
+pool_t *create_pool(int nb_workers, int max_depth){
+	pool_t *pool = my_calloc(1, sizeof(pool_t));
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->not_empty, NULL);
+	pthread_cond_init(&pool->not_full, NULL);
+	pool->max_depth = max_depth;
+	pool->nb_workers = nb_workers;
+	pool->workers = my_calloc(nb_workers, sizeof(worker_t));
+
+	for (int i = 0; i < nb_workers; i++){
+		pool->workers[i].pool = pool;
+		if (pthread_create(&pool->workers[i].thread, NULL, worker_thread, &pool->workers[i]) != 0){
+			fprintf(stderr, "pthread_create failed!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return pool;
+}
+
+/***********************************************************
+ * Put a job in the queue, waiting if the queue is full
+ * @param pool the pool
+ * @param job the job, freed by the worker doing it
+ ***********************************************************/
+void submit_job(pool_t *pool, job_t *job){
+	clock_gettime(CLOCK_MONOTONIC, &job->queued);
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->depth >= pool->max_depth)
+		pthread_cond_wait(&pool->not_full, &pool->lock);
+	if(pool->tail)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pool->depth++;
+	pthread_cond_signal(&pool->not_empty);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/***********************************************************
+ * Write the statistics of the pool as text
+ * @param pool the pool
+ * @param buffer receives the statistics
+ * @param size size in bytes of the buffer
+ ***********************************************************/
+void pool_stats(pool_t *pool, char *buffer, size_t size){
+	pthread_mutex_lock(&pool->lock);
+	snprintf(buffer, size,
+	         "workers %d\nbusy_workers %d\nqueue_depth %d\nqueue_size %d\n"
+	         "jobs %llu\nfailed_jobs %llu\n"
+	         "latency_last_us %llu\nlatency_avg_us %llu\nlatency_max_us %llu\n",
+	         pool->nb_workers, pool->busy, pool->depth, pool->max_depth,
+	         (unsigned long long)pool->nb_jobs, (unsigned long long)pool->nb_failed,
+	         (unsigned long long)pool->last_us,
+	         (unsigned long long)(pool->nb_jobs ? pool->total_us / pool->nb_jobs : 0),
+	         (unsigned long long)pool->max_us);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/***********************************************************
+ * Stop the workers once the queue is empty, then free the
+ * pool
+ * @param pool the pool
+ ***********************************************************/
+void destroy_pool(pool_t *pool){
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = true;
+	pthread_cond_broadcast(&pool->not_empty);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->nb_workers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->not_empty);
+	pthread_cond_destroy(&pool->not_full);
+	free(pool->workers);
+	free(pool);
+}
@@ -0,0 +1,95 @@
+/************************************************************************************
+ * @file daemon_lib.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 28 Nov 2017
+ * @brief Pool of workers doing the jobs received by the daemon
+ ***********************************************************************************/
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "protocol.h"
+#include "../encode/encode_lib.h"
+#include "../decode/decode_lib.h"
+
+/***********************************************************
+ * A job waiting in the queue of the pool
+ * @param fd the socket of the client, to send the response
+ * @param request the header of the request
+ * @param args the arguments of the request
+ * @param queued when the job was put in the queue
+ * @param next the next job of the queue
+ ***********************************************************/
+typedef struct job_st {
+	int fd;
+	request_t request;
+	char *args;
+	struct timespec queued;
+	struct job_st *next;
+} job_t;
+
+/***********************************************************
+ * A worker of the pool, with its buffers kept from one job
+ * to the next one
+ * @param thread the thread of the worker
+ * @param pool the pool of the worker
+ * @param pixels buffer of the images
+ * @param pixels_size size in bytes of pixels
+ * @param text buffer of the texts
+ * @param text_size size in bytes of text
+ * @param packed buffer of the compressed texts
+ * @param packed_size size in bytes of packed
+ ***********************************************************/
+typedef struct worker_st {
+	pthread_t thread;
+	struct pool_st *pool;
+	pixel_t *pixels;
+	size_t pixels_size;
+	char *text;
+	size_t text_size;
+	char *packed;
+	size_t packed_size;
+} worker_t;
+
+/***********************************************************
+ * A pool of workers sharing a bounded queue of jobs
+ * @param lock protects the queue and the statistics
+ * @param not_empty signaled when a job is put in the queue
+ * @param not_full signaled when a job leaves the queue
+ * @param head first job of the queue
+ * @param tail last job of the queue
+ * @param depth number of jobs in the queue
+ * @param max_depth maximum number of jobs in the queue
+ * @param closing true when the workers must stop
+ * @param nb_workers number of workers
+ * @param workers the workers
+ * @param busy number of workers doing a job
+ * @param nb_jobs number of jobs done
+ * @param nb_failed number of jobs that failed
+ * @param last_us latency (queue + service) of the last job
+ * @param total_us sum of the latencies of the jobs
+ * @param max_us highest latency of a job
+ ***********************************************************/
+typedef struct pool_st {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	job_t *head;
+	job_t *tail;
+	int depth;
+	int max_depth;
+	bool closing;
+	int nb_workers;
+	worker_t *workers;
+	int busy;
+	uint64_t nb_jobs;
+	uint64_t nb_failed;
+	uint64_t last_us;
+	uint64_t total_us;
+	uint64_t max_us;
+} pool_t;
+
+pool_t *create_pool(int nb_workers, int max_depth);
+void submit_job(pool_t *pool, job_t *job);
+void pool_stats(pool_t *pool, char *buffer, size_t size);
+void destroy_pool(pool_t *pool);
@@ -0,0 +1,54 @@
+/************************************************************************************
+ * @file protocol.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 28 Nov 2017
+ * @brief Framed protocol between the steg daemon and its clients
+ ***********************************************************************************/
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "protocol.h"
+
+/***********************************************************
+ * Send a whole buffer on a socket
+ * @param fd the socket
+ * @param buffer the data to send
+ * @param size size in bytes of the data
+ * @return true if everything was sent
+ ***********************************************************/
+bool send_all(int fd, const void *buffer, size_t size){
+	const char *ptr = buffer;
+
+	while(size > 0){
+		ssize_t nb = send(fd, ptr, size, MSG_NOSIGNAL);
+		if(nb < 0 && errno == EINTR)
+			continue;
+		if(nb <= 0)
+			return false;
+		ptr += nb;
+		size -= nb;
+	}
+	return true;
+}
+
+/***********************************************************
+ * Receive a whole buffer from a socket
+ * @param fd the socket
+ * @param buffer receives the data
+ * @param size size in bytes of the data
+ * @return true if everything was received
+ ***********************************************************/
+bool recv_all(int fd, void *buffer, size_t size){
+	char *ptr = buffer;
+
+	while(size > 0){
+		ssize_t nb = recv(fd, ptr, size, 0);
+		if(nb < 0 && errno == EINTR)
+			continue;
+		if(nb <= 0)
+			return false;
+		ptr += nb;
+		size -= nb;
+	}
+	return true;
+}
@@ -0,0 +1,61 @@
+/************************************************************************************
+ * @file protocol.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 28 Nov 2017
+ * @brief Framed protocol between the steg daemon and its clients
+ *
+ * A client connects to the Unix socket of the daemon and sends one request: a
+ * request_t header followed by length bytes of arguments, each of them being a
+ * string terminated by '\0':
+ *   OP_ENCODE: text_file input_image output_image
+ *   OP_DECODE: image output_file (empty output_file: the text is sent back)
+ *   OP_STATS:  no argument
+ * The daemon answers with a response_t header followed by length bytes: the
+ * decoded text, the statistics or an error message if status is not 0.
+ ***********************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STEG_MAGIC 0x53544547
+#define MAX_REQUEST_SIZE 8192
+
+/***********************************************************
+ * Jobs the daemon can do
+ ***********************************************************/
+enum STEG_OP {
+	OP_ENCODE = 1,
+	OP_DECODE = 2,
+	OP_STATS = 3
+};
+
+/***********************************************************
+ * Header of a request
+ * @param magic STEG_MAGIC
+ * @param op the job to do (see enum STEG_OP)
+ * @param length size in bytes of the arguments
+ ***********************************************************/
+typedef struct request_st {
+	uint32_t magic;
+	uint32_t op;
+	uint32_t length;
+} request_t;
+
+/***********************************************************
+ * Header of a response
+ * @param magic STEG_MAGIC
+ * @param status 0 if the job succeeded
+ * @param length size in bytes of the data following
+ * @param queued_us time (in us) the job waited in the queue
+ * @param service_us time (in us) a worker spent on the job
+ ***********************************************************/
+typedef struct response_st {
+	uint32_t magic;
+	int32_t status;
+	uint64_t length;
+	uint64_t queued_us;
+	uint64_t service_us;
+} response_t;
+
+bool send_all(int fd, const void *buffer, size_t size);
+bool recv_all(int fd, void *buffer, size_t size);
@@ -4,9 +4,13 @@
  * @date 1 nov 2017
  * @brief Decode a hidden text encoded into a ppm image
  *
- * This program will decode a text hidden in a ppm image (argument 1).
- * The text is hidden in the lowest bit of R, G or B.
- * It will decode this text in multi-threading (argument 2)
+ * This program will decode a text hidden in an image (PPM or PNG, see png.h),
+ * in the lowest bits given by the header of the image (see format.h). It will
+ * decode this text in multi-threading, the threads drawing chunks of the text
+ * from a work queue (see scheduler.h), and print it or write it into a file.
+ *
+ * The other modes (streaming by bands, batch, containers, sets of images) are
+ * described by the usage of the program.
  ***********************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,81 +20,758 @@
 #include <unistd.h>
 #include <math.h>
 #include <errno.h>
-#include "decode_lib.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include "decode.h"
+#include "shard.h"
+#include "extract.h"
 #include "../libs/alloc.h"
+#include "../libs/files.h"
+#include "../libs/pipeline.h"
+#include "../libs/lz.h"
+#include "../libs/scatter.h"
+#include "../libs/crc32c.h"
+#include "../libs/scheduler.h"
+#include "../libs/aio.h"
+#include "../libs/png.h"
 
-#define BITS_PER_CHAR 7
-#define FIRST_PIXEL 11
 #define NB_ARG 2
+#define NB_ARG_BATCH 1
+#define WRITE_BUFFER_SIZE 65536
+#define NB_SLOTS 2
 
 /***********************************************************
- * Store where the threads begins
- * @param initial_indice Pixel of the image
- * @param initial_pos_rgb R, G or B (0, 1 or 2) in the pixel
- ***********************************************************/
-typedef struct limit_threads_st {
-	int initial_indice;
-	int initial_pos_rgb;
-} limit_threads_t;
-
-/***********************************************************
- * Store the arguments for the threads
- * @param limit see the struct limit_threads_t
- * @param char_interval number of char to decode
- * @param img a pointer to the image to read
+ * Store the arguments for the threads, which draw the
+ * chunks of the text from a work queue (see scheduler.h)
+ * @param payload pointer to the first component after the
+ *                header
+ * @param first_field index of the field holding the first
+ *                    bit of the chars to decode
+ * @param bounds first char of each chunk (whole groups of
+ *               chars, see group_symbols), then the number
+ *               of chars of the text
+ * @param queue the queue drawing the chunks
+ * @param crcs receives the checksum of each chunk (if the
+ *             layout has one)
+ * @param text where to write the decoded chars, or NULL to
+ *             write them into the output file
+ * @param out_fd the output file
+ * @param out_offset position of the first char in the
+ *                   output file
+ * @param fmt layout of the payload (see format.h)
+ * @param scatter the permutation of a keyed layout, or NULL
+ * @param stats statistics of the run, or NULL
+ * @param index index of the thread
  ***********************************************************/
 typedef struct param_st {
-	limit_threads_t limit;
-	int char_interval;
-	img_t *img;
+	const uint8_t *payload;
+	size_t first_field;
+	const size_t *bounds;
+	work_queue_t *queue;
+	uint32_t *crcs;
+	char *text;
+	int out_fd;
+	off_t out_offset;
+	format_t fmt;
+	const scatter_t *scatter;
+	stats_t *stats;
+	int index;
 } param_t;
 
 /***********************************************************
- * To know the limits of a thread
- * @param min first char position of the cut text
- * @return where the threads begins (pixel position)
+ * Decode chars of the text, from the component holding the
+ * first one or at the positions given by the key
+ * @param p see the struct param_t
+ * @param first position of the first char from the first
+ *              one to decode (at the beginning of a group)
+ * @param text receives the chars
+ * @param nb number of chars to decode
  ***********************************************************/
-limit_threads_t get_limits(int min){
-	limit_threads_t ret;
-	
-	ret.initial_indice = floor((float)(min * BITS_PER_CHAR) / sizeof(pixel_t)) + FIRST_PIXEL;
-	ret.initial_pos_rgb = (min * BITS_PER_CHAR) % sizeof(pixel_t);
+static void decode_part(param_t *p, size_t first, char *text, size_t nb){
+    format_t fmt = p->fmt;
+    size_t field = p->first_field + first * fmt.sym_bits / fmt.nb_lsb;
 
-	return ret;
+    if(p->scatter)
+        scatter_gather(p->payload, p->scatter, field, text, nb * fmt.sym_bits, fmt.nb_lsb, fmt.sym_bits);
+    else
+        decode_bits(p->payload + field, text, 0, nb * fmt.sym_bits, fmt);
 }
 
 /***********************************************************
  * Threads doing the decoing
  * @param param see the struct param_t
- * @return return one part of the decoded text
+ * @return return NULL if no problem encountered
  ***********************************************************/
 void *thread(void *param){
     // Get arguments
     param_t *p = (param_t *)param;
-    int initial_ind = p->limit.initial_indice;
-    int initial_pos = p->limit.initial_pos_rgb;
-    img_t *img = p->img;
-    // Position the pointer to the first pixel (on R, G or B) we want to decode
-	uint8_t *ptr = &img->raw[initial_ind].r + initial_pos;
+    format_t fmt = p->fmt;
+    char buffer[WRITE_BUFFER_SIZE];
+    size_t piece = WRITE_BUFFER_SIZE - WRITE_BUFFER_SIZE % group_symbols(fmt);
+    size_t c, nb_done = 0;
+    begin_thread(p->stats, p->index);
+
+    while(next_chunk(p->queue, p->index, &c)){
+        size_t first = p->bounds[c], nb_char = p->bounds[c + 1] - first;
+        uint32_t crc = 0;
+
+        // Gather the bits of each char from the components, straight at their
+        // place in the decoded text..
+        if(p->text){
+            decode_part(p, first, p->text + first, nb_char);
+            if(fmt.checked)
+                crc = crc32c(0, p->text + first, nb_char);
+        }
+
+        //.. or piece by piece (whole groups of chars), each piece written at its
+        // place in the output file
+        for (size_t done = 0; !p->text && done < nb_char; done += piece){
+            size_t nb = nb_char - done < piece ? nb_char - done : piece;
+            decode_part(p, first + done, buffer, nb);
+            if(fmt.checked)
+                crc = crc32c(crc, buffer, nb);
+            if(pwrite(p->out_fd, buffer, nb, p->out_offset + first + done) != (ssize_t)nb)
+                return p;
+        }
+        p->crcs[c] = crc;
+        nb_done += nb_char;
+    }
+    end_thread(p->stats, p->index, nb_done);
+    return NULL;
+}
+
+/***********************************************************
+ * Decode the text of an image, or a range of it, the text
+ * being cut in chunks of whole groups of chars drawn by the
+ * threads, as many as the cost model finds worth (see
+ * plan_work)
+ * @param img a pointer to the image to read
+ * @param first_char index of the first char to decode (at
+ *                   the beginning of a group of chars)
+ * @param text receives the chars, or NULL to write them
+ *             into the output file
+ * @param out_fd the output file, used if text is NULL
+ * @param out_offset position of the first char in the
+ *                   output file
+ * @param nb_char number of chars to decode
+ * @param nb_threads maximum number of threads to use
+ * @param fmt layout of the payload (see format.h)
+ * @param stats statistics of the run, or NULL
+ * @param checksum receives the checksum of the chars, if
+ *                 the layout has one
+ * @return the number of threads used or -1 if the text
+ *         cannot be written
+ ***********************************************************/
+int decode_threads(img_t *img, size_t first_char, char *text, int out_fd, off_t out_offset, int nb_char,
+                   int nb_threads, format_t fmt, stats_t *stats, uint32_t *checksum){
+    size_t group = group_symbols(fmt);
+    size_t nb_groups = (nb_char + group - 1) / group;
+    size_t nb_chunks;
+
+    // Never more chunks than groups of chars, so that two threads never share a
+    // component, nor more threads than chunks
+    nb_threads = plan_work(nb_char, nb_threads, &nb_chunks);
+    if(nb_chunks > nb_groups)
+        nb_chunks = nb_groups ? nb_groups : 1;
+    if((size_t)nb_threads > nb_chunks)
+        nb_threads = nb_chunks;
+    size_t *bounds = my_malloc((nb_chunks + 1) * sizeof(size_t));
+    uint32_t *crcs = my_malloc(nb_chunks * sizeof(uint32_t));
+    param_t *threads_param = my_malloc(nb_threads * sizeof(param_t));
+    pthread_t *threads = my_malloc(nb_threads * sizeof(pthread_t));
+    for (size_t c = 0; c <= nb_chunks; c++){
+    	bounds[c] = nb_groups * c / nb_chunks * group;
+    	if(bounds[c] > (size_t)nb_char)
+    		bounds[c] = nb_char;
+    }
+    work_queue_t queue;
+    init_work_queue(&queue, nb_chunks, nb_threads);
+
+    // The keyed layout scatters the fields over all the components after the header
+    scatter_t scatter;
+    if(fmt.keyed)
+        init_scatter(&scatter, fmt.key, (size_t)img->width * img->height * sizeof(pixel_t) - payload_offset(fmt));
     
-    // Intialise return string pointer
-    char *str_return = my_calloc(p->char_interval+1, sizeof(char));
+    // Threads launching loop (a single thread being the calling one)
+    set_stats_threads(stats, nb_threads);
+    begin_phase(stats, "spawn");
+	for (int i = 0; i < nb_threads; i++){
+        // Assign the threads arguments
+        threads_param[i].payload = &img->raw[0].r + payload_offset(fmt);
+        threads_param[i].first_field = first_char * fmt.sym_bits / fmt.nb_lsb;
+        threads_param[i].bounds = bounds;
+        threads_param[i].queue = &queue;
+        threads_param[i].crcs = crcs;
+        threads_param[i].text = text;
+        threads_param[i].out_fd = out_fd;
+        threads_param[i].out_offset = out_offset;
+        threads_param[i].fmt = fmt;
+        threads_param[i].scatter = fmt.keyed ? &scatter : NULL;
+        threads_param[i].stats = stats;
+        threads_param[i].index = i;
+
+        // Create thread and check for fail
+        if (nb_threads > 1 && pthread_create(&threads[i], NULL, thread, &threads_param[i]) != 0){
+            fprintf(stderr, "pthread_create failed!\n");
+            exit(EXIT_FAILURE);
+        }
+	}
+    end_phase(stats, 0);
     
-    // This loop go through each pixel we decode
-    for (int i = 0; i < p->char_interval; i++){
-        // Initialize current char to 0
-    	char tmp_char = 0;
-        // For each char it must decode 7 lowest bits
-    	for (int indice = BITS_PER_CHAR-1; indice >= 0; indice--){
-            // If the lowest bit is 1, the right pow of 2 is added
-    		tmp_char += add_pow_2(ptr, indice);
-            // Reposition the pixel to the next R, G or B
-    		ptr++;
-    	}
-        // 1 decoded char is added into the string of return
-		str_return[i] = tmp_char;
+    // Threads "waiting" loop
+    bool write_failed = false;
+    begin_phase(stats, "join");
+    if(nb_threads == 1)
+        write_failed = thread(&threads_param[0]) != NULL;
+    for (int i = 0; nb_threads > 1 && i < nb_threads; i++){
+        void *ret;
+        pthread_join(threads[i], &ret);
+        write_failed |= ret != NULL;
+    }
+    end_phase(stats, nb_char);
+
+    // The checksums of the chunks are combined in order
+    *checksum = 0;
+    for (size_t c = 0; fmt.checked && !write_failed && c < nb_chunks; c++)
+        *checksum = crc32c_combine(*checksum, crcs[c], bounds[c + 1] - bounds[c]);
+    free_work_queue(&queue);
+    free(threads);
+    free(threads_param);
+    free(crcs);
+    free(bounds);
+    return write_failed ? -1 : nb_threads;
+}
+
+/***********************************************************
+ * Give its key to a keyed layout (see scatter.h)
+ * @param fmt the layout read from the header
+ * @param key the key given with the -K option, or NULL
+ * @return false if the layout is keyed but no key is given
+ ***********************************************************/
+bool set_key(format_t *fmt, const char *key){
+	if(!fmt->keyed)
+		return true;
+	if(!key)
+		return false;
+	fmt->key = parse_key(key);
+	return true;
+}
+
+/***********************************************************
+ * Decompress the decoded text if the layout has a codec
+ * (see lz.h), the threads decompressing different blocks
+ * @param text the decoded text, freed if it is compressed
+ * @param nb_char pointer to the number of chars, replaced
+ *                by the length of the decompressed text
+ * @param fmt layout of the payload (see format.h)
+ * @param nb_threads number of threads to use
+ * @param stats statistics of the run, or NULL
+ * @return the text (terminated by '\0' if decompressed),
+ *         NULL if the compressed text is corrupted
+ ***********************************************************/
+char *decompress_text(char *text, int *nb_char, format_t fmt, int nb_threads, stats_t *stats){
+	if(fmt.codec == CODEC_NONE)
+		return text;
+	if(fmt.raw_len > INT_MAX){
+		free(text);
+		return NULL;
+	}
+	begin_phase(stats, "decompress");
+	char *raw = my_calloc(fmt.raw_len + 1, sizeof(char));
+	bool ok = lz_decompress(text, *nb_char, raw, fmt.raw_len, nb_threads);
+	end_phase(stats, fmt.raw_len);
+	free(text);
+	if(!ok){
+		free(raw);
+		return NULL;
+	}
+	*nb_char = fmt.raw_len;
+	return raw;
+}
+
+/***********************************************************
+ * Store the arguments for the threads of the streaming mode
+ * @param comp pointer to the component holding the first bit
+ * @param text pointer to the char receiving the first bit
+ * @param first_bit position of the first bit from this char
+ * @param nb_bits number of bits to decode
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+typedef struct band_param_st {
+	const uint8_t *comp;
+	char *text;
+	size_t first_bit;
+	size_t nb_bits;
+	format_t fmt;
+} band_param_t;
+
+/***********************************************************
+ * Threads doing the decoding of a part of a band
+ * @param param see the struct band_param_t
+ * @return return NULL if no problem encountered
+ ***********************************************************/
+void *band_thread(void *param){
+    band_param_t *p = (band_param_t *)param;
+    decode_bits(p->comp, p->text, p->first_bit, p->nb_bits, p->fmt);
+    return NULL;
+}
+
+/***********************************************************
+ * Decode a range of bits of a band into the text, the range
+ * being shared between the threads at group boundaries (see
+ * group_symbols)
+ * @param comp pointer to the component holding the first bit
+ * @param text the chars decoded from the band (text[0]
+ *             receives the first bit)
+ * @param first_char position of text[0] in the whole text
+ * @param first_bit position of the first bit in text[0]
+ * @param nb_bits number of bits to decode
+ * @param nb_threads maximum number of threads to use (see
+ *                   plan_work)
+ * @param fmt layout of the payload (see format.h)
+ * @return the number of threads used
+ ***********************************************************/
+int decode_band(const uint8_t *comp, char *text, size_t first_char, int first_bit, size_t nb_bits,
+                int nb_threads, format_t fmt){
+    // Positions of the bits in the whole text
+    size_t text_bit = first_char * fmt.sym_bits;
+    size_t begin_bit = text_bit + first_bit;
+    size_t end_bit = begin_bit + nb_bits;
+    size_t group = group_bits(fmt);
+    size_t first_group = begin_bit / group;
+    size_t nb_groups = (end_bit + group - 1) / group - first_group;
+
+	nb_threads = plan_work(nb_bits / fmt.sym_bits, nb_threads, NULL);
+	if(nb_threads > (int)nb_groups)
+        nb_threads = nb_groups;
+	pthread_t    *threads = my_malloc(nb_threads * sizeof(pthread_t));
+	band_param_t *threads_param = my_malloc(nb_threads * sizeof(band_param_t));
+
+	for (int i = 0; i < nb_threads; i++){
+        // Bits of the groups given to this thread, clipped to the range
+        size_t begin = (first_group + nb_groups * i / nb_threads) * group;
+        size_t end = (first_group + nb_groups * (i + 1) / nb_threads) * group;
+        if(begin < begin_bit)
+            begin = begin_bit;
+        if(end > end_bit)
+            end = end_bit;
+
+        threads_param[i].comp = comp + (begin - begin_bit) / fmt.nb_lsb;
+        threads_param[i].text = text;
+        threads_param[i].first_bit = begin - text_bit;
+        threads_param[i].nb_bits = end - begin;
+        threads_param[i].fmt = fmt;
+
+        if (pthread_create(&threads[i], NULL, band_thread, &threads_param[i]) != 0){
+            fprintf(stderr, "pthread_create failed!\n");
+            exit(EXIT_FAILURE);
+        }
+	}
+	for (int i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads_param);
+    free(threads);
+    return nb_threads;
+}
+
+/***********************************************************
+ * Decompress the blocks of a compressed text that are
+ * complete and write them (streaming mode)
+ * @param pending the decoded chars not yet decompressed,
+ *                the ones used being removed
+ * @param nb_pending pointer to the number of pending chars
+ * @param raw_left pointer to the number of chars of the
+ *                 decompressed text not yet written
+ * @param block receives a decompressed block
+ * @param out the output file
+ * @return false if a block is corrupted
+ ***********************************************************/
+bool flush_blocks(char *pending, size_t *nb_pending, size_t *raw_left, char *block, FILE *out){
+	size_t used = 0;
+	long size = 0;
+
+	while(*raw_left && (size = lz_decompress_block(pending + used, *nb_pending - used, block, *raw_left)) > 0){
+		size_t n = *raw_left < LZ_BLOCK_SIZE ? *raw_left : LZ_BLOCK_SIZE;
+		if(fwrite(block, 1, n, out) != n){
+			fprintf(stderr, "ERROR WRITING THE OUTPUT FILE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+		used += size;
+		*raw_left -= n;
+	}
+	memmove(pending, pending + used, *nb_pending - used);
+	*nb_pending -= used;
+	return size >= 0;
+}
+
+/***********************************************************
+ * Decode the text band by band, without loading the whole
+ * image in memory (streaming mode)
+ * @param input the path of the image
+ * @param output the path of the output file, or NULL to
+ *               print the text
+ * @param nb_threads maximum number of threads used for each
+ *                   band (the number used being printed at
+ *                   the end)
+ * @param budget memory (in bytes) that the bands can use
+ ***********************************************************/
+void stream_decode(char *input, char *output, int nb_threads, size_t budget){
+	ppm_stream_t *in = open_ppm_stream(input);
+	if(!in){
+		fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	size_t row_size = in->width * sizeof(pixel_t);
+	size_t row_text = row_size * MAX_LSB / BITS_PER_CHAR + 1;
+
+    // A row needs room for its components in each of the bands read and decoded
+    // at the same time, and for the chars decoded from it (as many as the
+    // densest layout can hold, the layout being in the header)
+	size_t band_rows = budget / (NB_SLOTS * row_size + row_text);
+	if(band_rows == 0){
+		fprintf(stderr,"MEMORY BUDGET TOO SMALL FOR ONE ROW OF THE IMAGE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	if(band_rows > (size_t)in->height)
+		band_rows = in->height;
+    if(nb_threads <= 0){
+        fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+    }
+
+	FILE *out = stdout;
+	char    *text = my_calloc(band_rows * row_text + 2, sizeof(char));
+	pixel_t *bands[NB_SLOTS];
+	for (int i = 0; i < NB_SLOTS; i++){
+		bands[i] = aio_alloc(band_rows * row_size);
+		if(!bands[i]){
+			fprintf(stderr, "MEMORY BUDGET TOO LARGE FOR THIS MACHINE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	aio_t *q = aio_create(NB_SLOTS);
+	if(!q || !submit_ppm_band(q, in, false, bands[0], 0, band_rows, bands[0])){
+		fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+
+    // A compressed text goes through the pending chars, a block being
+    // decompressed and written as soon as all its chars are decoded
+	char *pending = NULL, *block = NULL;
+	size_t nb_pending = 0, raw_left = 0;
+
+    // Components (over the whole image) holding the text, known once the header is read
+	uint8_t header[MAX_HEADER_SIZE];
+	uint32_t nb_char = 0;
+	format_t fmt = DEFAULT_FORMAT;
+	int header_read = 0, threads_used = 0;
+	size_t text_begin = 0;
+	size_t text_end = 0;
+	uint32_t crc = 0;
+
+	for (int row = 0, b = 0; row < in->height; row += band_rows, b++){
+		int rows = in->height - row < (int)band_rows ? in->height - row : (int)band_rows;
+		size_t first = row * row_size;
+		size_t last = first + rows * row_size;
+		const uint8_t *comp = &bands[b % NB_SLOTS][0].r;
+
+		bool read_ok;
+		if(aio_complete(q, &read_ok) != bands[b % NB_SLOTS] || !read_ok){
+			fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+			exit(EXIT_FAILURE);
+		}
+
+        // Keep the part of the header that is in this band
+		if(!header_read){
+			for (size_t i = first; i < last && i < sizeof(header); i++)
+				header[i] = comp[i - first];
+			header_read = read_header(header, last < sizeof(header) ? last : sizeof(header), &nb_char, &fmt);
+			if(header_read < 0){
+				fprintf(stderr, "NO VALID TEXT IN THE IMAGE %s\nExiting now...\n", input);
+				exit(EXIT_FAILURE);
+			}
+			if(header_read && fmt.keyed){
+				fprintf(stderr, "THE TEXT OF %s IS SCATTERED WITH A KEY: -m CANNOT BE USED\nExiting now...\n", input);
+				exit(EXIT_FAILURE);
+			}
+			if(header_read && fmt.sharded && fmt.nb_shards > 1){
+				fprintf(stderr, "THE IMAGE %s HOLDS THE SHARD %d OF %d OF A SET, DECODE THE SET WITH -M\n"
+				        "Exiting now...\n", input, fmt.seq + 1, fmt.nb_shards);
+				exit(EXIT_FAILURE);
+			}
+			if(header_read && fmt.container){
+				fprintf(stderr, "THE IMAGE %s HOLDS A CONTAINER: -m CANNOT BE USED, EXTRACT ITS FILES WITH -e\n"
+				        "Exiting now...\n", input);
+				exit(EXIT_FAILURE);
+			}
+
+            // Once the whole header is read and accepted, the text can be printed
+            // (the output file is only created then)
+			if(header_read){
+				if(output)
+					out = open_file(output, "w");
+				text_begin = payload_offset(fmt);
+				text_end = text_begin + payload_comps(nb_char, fmt);
+				if(fmt.codec != CODEC_NONE){
+					pending = my_malloc(LZ_BLOCK_SIZE + LZ_BLOCK_HEADER + band_rows * row_text);
+					block = my_malloc(LZ_BLOCK_SIZE);
+					raw_left = fmt.raw_len;
+				}
+				if(!output)
+					printf("\n---------- TEXT DECODED ----------\n\n");
+			}
+		}
+
+        // The next band is read while this one is decoded, unless the text ends
+        // in this one
+		int next = row + band_rows;
+		if(next < in->height && !(text_end && last >= text_end)){
+			int next_rows = in->height - next < (int)band_rows ? in->height - next : (int)band_rows;
+			pixel_t *next_band = bands[(b + 1) % NB_SLOTS];
+			if(!submit_ppm_band(q, in, false, next_band, next, next_rows, next_band)){
+				fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		size_t begin = first > text_begin ? first : text_begin;
+		size_t end = last < text_end ? last : text_end;
+		if(begin < end){
+			size_t begin_bit = (begin - text_begin) * fmt.nb_lsb;
+			size_t end_bit = (end - text_begin) * fmt.nb_lsb;
+			if(end_bit > (size_t)nb_char * fmt.sym_bits)
+				end_bit = (size_t)nb_char * fmt.sym_bits;
+			size_t first_char = begin_bit / fmt.sym_bits;
+			size_t nb_full = end_bit / fmt.sym_bits - first_char;
+
+            // text[0] keeps the bits of a char started in the previous band, the
+            // number of threads used depending on the number of chars of the band
+			int used = decode_band(comp + (begin - first), text, first_char, begin_bit % fmt.sym_bits,
+			                       end_bit - begin_bit, nb_threads, fmt);
+			if(used > threads_used)
+				threads_used = used;
+			if(fmt.checked)
+				crc = crc32c(crc, text, nb_full);
+			if(pending){
+				memcpy(pending + nb_pending, text, nb_full);
+				nb_pending += nb_full;
+				if(!flush_blocks(pending, &nb_pending, &raw_left, block, out)){
+					fprintf(stderr, "NO VALID TEXT IN THE IMAGE %s\nExiting now...\n", input);
+					exit(EXIT_FAILURE);
+				}
+			}else if(fwrite(text, 1, nb_full, out) != nb_full){
+				fprintf(stderr, "ERROR WRITING THE OUTPUT FILE\nExiting now...\n");
+				exit(EXIT_FAILURE);
+			}
+			text[0] = text[nb_full];
+			memset(text + 1, 0, nb_full);
+		}
+		if(text_end && last >= text_end)
+			break;
+	}
+	if(header_read <= 0 || (pending && (raw_left || nb_pending))){
+		fprintf(stderr, "NO VALID TEXT IN THE IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	if(fmt.checked && crc != fmt.checksum){
+		if(output){
+			fclose(out);
+			unlink(output);
+		}
+		fprintf(stderr, "THE TEXT OF %s DOES NOT MATCH ITS CHECKSUM\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+
+	if(!output)
+		printf("\n\n---------- TEXT DECODED ----------\n\n");
+	else if(fclose(out) != 0){
+		fprintf(stderr, "ERROR WRITING THE OUTPUT FILE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("%s%d threads were used\n\n", output ? "\n" : "", threads_used);
+
+	aio_destroy(q);
+	close_ppm_stream(in);
+	free(block);
+	free(pending);
+	free(text);
+	for (int i = 0; i < NB_SLOTS; i++)
+		free(bands[i]);
+}
+
+/***********************************************************
+ * A job of the batch mode going through the pipeline
+ * @param paths image and output_file
+ * @param img the image, once loaded
+ * @param text the decoded text
+ * @param nb_char number of chars of the text
+ * @param fmt layout of the text in the image
+ ***********************************************************/
+typedef struct batch_job_st {
+	char **paths;
+	img_t *img;
+	char *text;
+	int nb_char;
+	format_t fmt;
+} batch_job_t;
+
+/***********************************************************
+ * Context of the batch mode
+ * @param jobs the jobs of the manifest
+ * @param nb_threads number of threads decoding an image
+ * @param key the key of the keyed images, or NULL
+ * @param bytes number of bytes of the images decoded
+ ***********************************************************/
+typedef struct batch_st {
+	char ***jobs;
+	int nb_threads;
+	const char *key;
+	size_t bytes;
+} batch_t;
+
+/***********************************************************
+ * Free a job of the batch mode
+ * @param job the job
+ ***********************************************************/
+void free_batch_job(batch_job_t *job){
+	if(job->img)
+		free_img(job->img);
+	free(job->text);
+	free(job);
+}
+
+/***********************************************************
+ * Load stage of the batch mode: read the image
+ * @param ctx see the struct batch_t
+ * @param index number of the job in the manifest
+ * @return the job (see the struct batch_job_t) or NULL
+ ***********************************************************/
+void *batch_load(void *ctx, int index){
+	batch_t *b = (batch_t *)ctx;
+	batch_job_t *job = my_calloc(1, sizeof(batch_job_t));
+	job->paths = b->jobs[index];
+
+	job->img = load_image(job->paths[0]);
+	if(!job->img){
+		fprintf(stderr, "JOB %d: CANNOT READ THE IMAGE %s\n", index + 1, job->paths[0]);
+		free_batch_job(job);
+		return NULL;
+	}
+	populate_img(job->img);
+
+    // The number of chars must fit in the image
+	job->nb_char = get_nb_char_img(job->img, &job->fmt);
+	size_t nb_comp = (size_t)job->img->width * job->img->height * sizeof(pixel_t);
+	if(job->nb_char < 0 || (size_t)job->nb_char > max_symbols(nb_comp, job->fmt)){
+		fprintf(stderr, "JOB %d: NO VALID TEXT IN THE IMAGE %s\n", index + 1, job->paths[0]);
+		free_batch_job(job);
+		return NULL;
+	}
+	if(!set_key(&job->fmt, b->key)){
+		fprintf(stderr, "JOB %d: THE TEXT OF %s IS SCATTERED WITH A KEY, GIVE IT WITH -K\n", index + 1, job->paths[0]);
+		free_batch_job(job);
+		return NULL;
+	}
+	if(job->fmt.sharded && job->fmt.nb_shards > 1){
+		fprintf(stderr, "JOB %d: THE IMAGE %s HOLDS THE SHARD %d OF %d OF A SET, DECODE THE SET WITH -M\n", index + 1,
+		        job->paths[0], job->fmt.seq + 1, job->fmt.nb_shards);
+		free_batch_job(job);
+		return NULL;
+	}
+	if(job->fmt.container){
+		fprintf(stderr, "JOB %d: THE IMAGE %s HOLDS A CONTAINER, EXTRACT ITS FILES WITH -e\n", index + 1, job->paths[0]);
+		free_batch_job(job);
+		return NULL;
+	}
+	job->text = my_calloc(job->nb_char + 1, sizeof(char));
+	return job;
+}
+
+/***********************************************************
+ * Process stage of the batch mode: decode the text
+ * @param ctx see the struct batch_t
+ * @param item the job (see the struct batch_job_t)
+ * @return false if the text does not match its checksum
+ *         or the compressed text is corrupted
+ ***********************************************************/
+bool batch_process(void *ctx, void *item){
+	batch_t *b = (batch_t *)ctx;
+	batch_job_t *job = (batch_job_t *)item;
+	uint32_t crc;
+
+	decode_threads(job->img, 0, job->text, -1, 0, job->nb_char, b->nb_threads, job->fmt, NULL, &crc);
+	if(job->fmt.checked && crc != job->fmt.checksum){
+		fprintf(stderr, "THE TEXT OF %s DOES NOT MATCH ITS CHECKSUM\n", job->paths[0]);
+		return false;
+	}
+	job->text = decompress_text(job->text, &job->nb_char, job->fmt, b->nb_threads, NULL);
+	if(!job->text){
+		fprintf(stderr, "NO VALID TEXT IN THE IMAGE %s\n", job->paths[0]);
+		return false;
+	}
+	return true;
+}
+
+/***********************************************************
+ * Store stage of the batch mode: write the text
+ * @param ctx see the struct batch_t
+ * @param item the job (see the struct batch_job_t) or NULL
+ * @param ok false if a previous stage failed
+ * @return false if the text cannot be written
+ ***********************************************************/
+bool batch_store(void *ctx, void *item, bool ok){
+	batch_t *b = (batch_t *)ctx;
+	batch_job_t *job = (batch_job_t *)item;
+
+	if(!job)
+		return false;
+	if(ok){
+		FILE *fp = fopen(job->paths[1], "w");
+		ok = fp && fwrite(job->text, 1, job->nb_char, fp) == (size_t)job->nb_char;
+		if(!fp || fclose(fp) != 0 || !ok){
+			fprintf(stderr, "ERROR WRITING THE OUTPUT FILE %s\n", job->paths[1]);
+			ok = false;
+		}
+	}
+	if(ok)
+		b->bytes += (size_t)job->img->width * job->img->height * sizeof(pixel_t);
+	free_batch_job(job);
+	return ok;
+}
+
+/***********************************************************
+ * Decode all the jobs of a manifest (batch mode) and
+ * display the throughput
+ * @param manifest the path of the manifest
+ * @param nb_threads number of threads decoding an image
+ * @param key the key of the keyed images, or NULL
+ * @return EXIT_SUCCESS if no job failed
+ ***********************************************************/
+int batch_decode(char *manifest, int nb_threads, const char *key){
+	struct timespec start, end;
+	stages_t stages = { batch_load, batch_process, batch_store };
+	batch_t b = { .nb_threads = nb_threads, .key = key, .bytes = 0 };
+	int nb_jobs;
+
+    if(nb_threads <= 0){
+        fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
     }
-    return str_return;
+	b.jobs = read_manifest(manifest, 2, &nb_jobs);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int nb_failed = run_pipeline(&stages, &b, nb_jobs, BATCH_DEPTH);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d images decoded (%d failed) in %.3f s: %.1f images/s, %.1f MB/s\n",
+	       nb_jobs - nb_failed, nb_failed, seconds,
+	       (nb_jobs - nb_failed) / seconds, b.bytes / 1e6 / seconds);
+
+	free_manifest(b.jobs, nb_jobs, 2);
+	return nb_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /***********************************************************
@@ -99,9 +780,26 @@ void *thread(void *param){
  ***********************************************************/
 void usage(char **argv){
 	fprintf(stderr, "\nNumber of arguments is invalid\n\n"\
-        "usage: %s image thread_count\n"\
-		"       where image is a PPM file containing an encoded secret message\n"\
-		"       and thread_count the number of threads to use.\n", basename(argv[0]));
+        "usage: %s [-K key] [-m memory_budget] [-e name] [-o output_file] [--stats[=file]] image thread_count\n"\
+        "       %s [-K key] [--stats[=file]] -b manifest thread_count\n"\
+        "       %s -M [-K key] [--stats[=file]] -o output_file images thread_count\n"\
+		"       where image is a PPM or PNG file containing an encoded secret message\n"\
+		"       and thread_count the number of threads to use, or auto to let a\n"\
+		"       cost model choose it (up to the number of processors).\n"\
+		"       -m streams the image by bands using at most memory_budget\n"\
+		"          bytes (K, M or G suffix allowed); image must be binary.\n"\
+		"       -o writes the text into output_file instead of printing it.\n"\
+		"       -e extracts the file name from a container made by encode -a,\n"\
+		"          decoding only its components (without -e, the files of the\n"\
+		"          container are listed); -m cannot be used with it.\n"\
+		"       -K gives the key of a text scattered by encode -K.\n"\
+		"       -b decodes every job of manifest, a job per line being made of\n"\
+		"          image output_file.\n"\
+		"       -M decodes a text cut over a set of images by encode -M into\n"\
+		"          output_file, images being a directory (its PPM and PNG files)\n"\
+		"          or a file listing the images, one per line, in any order.\n"\
+		"       --stats writes the timings of the run as JSON on stderr or in file.\n",
+		basename(argv[0]), basename(argv[0]), basename(argv[0]));
 	exit(EXIT_FAILURE);
 }
 
@@ -112,70 +810,196 @@ void usage(char **argv){
  ****************************************************/
 int main(int argc, char **argv){
 	// Parse command line
-    if(argc != NB_ARG + 1)
+	size_t budget = 0;
+	char *output = NULL;
+	char *manifest = NULL;
+	char *key = NULL;
+	char *name = NULL;
+	bool sharded = false;
+	stats_t *stats = NULL;
+	FILE *stats_file = stderr;
+	struct option long_options[] = {{"stats", optional_argument, NULL, 'S'}, {NULL, 0, NULL, 0}};
+	int opt;
+	while((opt = getopt_long(argc, argv, "m:o:b:K:e:M", long_options, NULL)) != -1){
+		switch(opt){
+			case 'K':
+				key = optarg;
+				break;
+			case 'S':
+				stats = create_stats("decode");
+				if(optarg && !(stats_file = fopen(optarg, "w"))){
+					fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\nExiting now...\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'b':
+				manifest = optarg;
+				break;
+			case 'm':
+				budget = parse_size(optarg);
+				if(!budget)
+					usage(argv);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'e':
+				name = optarg;
+				break;
+			case 'M':
+				sharded = true;
+				break;
+			default:
+				usage(argv);
+		}
+	}
+	if(manifest){
+		if(argc - optind != NB_ARG_BATCH || name || sharded)
+			usage(argv);
+		begin_phase(stats, "batch");
+		int ret = batch_decode(manifest, parse_threads(argv[optind]), key);
+		end_phase(stats, 0);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return ret;
+	}
+    if(argc - optind != NB_ARG || (budget && name) || (sharded && (!output || budget || name)))
 		usage(argv);
-	char *input=argv[1];
-	int nb_threads = atoi(argv[2]);
+	char *input=argv[optind];
+	int nb_threads = parse_threads(argv[optind + 1]);
+
+	if(sharded){
+		shard_decode(input, output, nb_threads, key, stats);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return EXIT_SUCCESS;
+	}
+	if(budget){
+		begin_phase(stats, "stream");
+		stream_decode(input, output, nb_threads, budget);
+		end_phase(stats, 0);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return EXIT_SUCCESS;
+	}
 	
-	img_t *img = load_ppm(input);
-	int nb_char = get_nb_char_img(img);
-    float interval;
-	void *part_str_decoded;
-	char *text_decoded = my_calloc(nb_char + 1, sizeof(char));
+	// Read the rows holding the header, then the ones holding the text
+	begin_phase(stats, "load");
+	format_t fmt;
+	int height;
+	img_t *img = load_image_head(input, MAX_HEADER_SIZE, &height);
+	if(!img){
+		fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	int nb_char = get_nb_char_img(img, &fmt);
+	if(nb_char >= 0 && !set_key(&fmt, key)){
+		fprintf(stderr, "THE TEXT OF %s IS SCATTERED WITH A KEY, GIVE IT WITH -K\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	if(nb_char >= 0 && fmt.sharded){
+		fprintf(stderr, "THE IMAGE %s HOLDS THE SHARD %d OF %d OF A SET, DECODE THE SET WITH -M\nExiting now...\n",
+		        input, fmt.seq + 1, fmt.nb_shards);
+		exit(EXIT_FAILURE);
+	}
+	if(nb_char >= 0){
+        // A scattered text may be in any row
+		size_t nb_comp = payload_offset(fmt) + payload_comps(nb_char, fmt);
+		if(fmt.keyed && nb_comp <= (size_t)img->width * height * sizeof(pixel_t))
+			nb_comp = (size_t)img->width * height * sizeof(pixel_t);
+		if(nb_comp > (size_t)img->width * height * sizeof(pixel_t))
+			nb_char = -1;
+		else if(!fmt.container && nb_comp > (size_t)img->width * img->height * sizeof(pixel_t)){
+			free_img(img);
+			img = load_image_head(input, nb_comp, &height);
+			if(!img){
+				fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	end_phase(stats, (size_t)img->width * img->height * sizeof(pixel_t));
+	char *text_decoded = NULL;
+	int out_fd = -1;
+
+    if(nb_char < 0){
+        fprintf(stderr, "NO VALID TEXT IN THE IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+    }
     
     // Check if there is a correct number of threads
     if(nb_threads <= 0){
         fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
 		exit(EXIT_FAILURE);
     }
-    
-    // Check if there is more threads thans char in the text and allocate memory
-	if(nb_threads > (int)nb_char)
-        nb_threads = nb_char;
-	param_t *threads_param = my_malloc(nb_threads * sizeof(param_t));
-	pthread_t *threads = my_malloc(nb_threads * sizeof(pthread_t));
-    
-    // Get the general (float) interval of each decoded texts part
-    interval = (float)nb_char / (float)nb_threads;
-    
-    // Threads launching loop
-	for (int i = 0; i < nb_threads; i++){
-        // Get the "real" interval and limits
-		int min = round(interval * i) + 0;
-		int char_in_interval = round(interval * (i + 1)) - min;
-        
-        // Assign the threads arguments
-        threads_param[i].limit = get_limits(min);
-        threads_param[i].char_interval = char_in_interval;
-        threads_param[i].img = img;
 
-        // Create thread and check for fail
-        if (pthread_create(&threads[i], NULL, thread, &threads_param[i]) != 0){
-            fprintf(stderr, "pthread_create failed!\n");
+    // Only the directory and the file extracted are decoded from a container
+    if(name && !fmt.container){
+        fprintf(stderr, "THE IMAGE %s IS NOT A CONTAINER\nExiting now...\n", input);
+        exit(EXIT_FAILURE);
+    }
+    if(fmt.container){
+        extract_file(input, img, height, nb_char, fmt, name, output, nb_threads, stats);
+        write_stats(stats, stats_file);
+        free_stats(stats);
+        return EXIT_SUCCESS;
+    }
+    
+    // The threads decode straight into the output file or the final text (a
+    // compressed text being decoded in memory)
+    if(output && fmt.codec == CODEC_NONE){
+        out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(out_fd < 0 || ftruncate(out_fd, nb_char) != 0){
+            fprintf(stderr, "FILE %s NOT FOUND OR CANNOT BE OPENED\n", output);
+            exit(EXIT_FAILURE);
+        }
+    }else{
+        text_decoded = my_calloc(nb_char + 1, sizeof(char));
+    }
+    uint32_t crc;
+    nb_threads = decode_threads(img, 0, text_decoded, out_fd, 0, nb_char, nb_threads, fmt, stats, &crc);
+    if(nb_threads < 0 || (out_fd >= 0 && close(out_fd) != 0)){
+        fprintf(stderr, "ERROR WRITING THE OUTPUT FILE\nExiting now...\n");
+        exit(EXIT_FAILURE);
+    }
+    if(fmt.checked && crc != fmt.checksum){
+        if(out_fd >= 0)
+            unlink(output);
+        fprintf(stderr, "THE TEXT OF %s DOES NOT MATCH ITS CHECKSUM\nExiting now...\n", input);
+        exit(EXIT_FAILURE);
+    }
+    if(fmt.codec != CODEC_NONE && !(text_decoded = decompress_text(text_decoded, &nb_char, fmt, nb_threads, stats))){
+        fprintf(stderr, "NO VALID TEXT IN THE IMAGE %s\nExiting now...\n", input);
+        exit(EXIT_FAILURE);
+    }
+    if(output && fmt.codec != CODEC_NONE){
+        FILE *fp = fopen(output, "w");
+        bool ok = fp && fwrite(text_decoded, 1, nb_char, fp) == (size_t)nb_char;
+        if(!fp || fclose(fp) != 0 || !ok){
+            fprintf(stderr, "ERROR WRITING THE OUTPUT FILE\nExiting now...\n");
             exit(EXIT_FAILURE);
         }
-	}
-    
-    // Threads "waiting" loop
-	for (int i = 0; i < nb_threads; i++){
-        pthread_join(threads[i], &part_str_decoded);
-        
-        // Add the part of the decoded text into the final result
-        strcat(text_decoded, part_str_decoded);
-        
-        free(part_str_decoded);
     }
     
     printf("\n%u threads were used\n\n", nb_threads);
     
-    // Print the text decoded
-    printf("---------- TEXT DECODED ----------\n\n%s"\
-       "\n\n---------- TEXT DECODED ----------\n\n", text_decoded);
+    // Print the text decoded (symbols of 8 bits may hold any byte, even '\0')
+    begin_phase(stats, "print");
+    if(!output && fmt.sym_bits == 8){
+        printf("---------- TEXT DECODED ----------\n\n");
+        fwrite(text_decoded, 1, nb_char, stdout);
+        printf("\n\n---------- TEXT DECODED ----------\n\n");
+    }else if(!output)
+        printf("---------- TEXT DECODED ----------\n\n%s"\
+           "\n\n---------- TEXT DECODED ----------\n\n", text_decoded);
+    
+    fflush(stdout);
+    end_phase(stats, output ? 0 : nb_char);
     
     free_img(img);
     free(text_decoded);
-    free(threads);
-    free(threads_param);
+    write_stats(stats, stats_file);
+    free_stats(stats);
        
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,21 @@
+/************************************************************************************
+ * @file decode.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Multi-threaded decoding of decode.c, used by its other modes
+ ***********************************************************************************/
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "decode_lib.h"
+#include "../libs/stats.h"
+
+#define BATCH_DEPTH 2
+
+int decode_threads(img_t *img, size_t first_char, char *text, int out_fd, off_t out_offset, int nb_char,
+                   int nb_threads, format_t fmt, stats_t *stats, uint32_t *checksum);
+bool set_key(format_t *fmt, const char *key);
+
+#endif
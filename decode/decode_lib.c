@@ -18,19 +18,45 @@ int add_pow_2(uint8_t *rgb, int exp){
 
 /***********************************************************
  * Get number of char encoded in the image (32 lowest bits)
+ * and the layout of the payload (see format.h)
  * @param img a pointer to the image
- * @return return the number of char
+ * @param fmt receives the layout of the payload
+ * @return return the number of char, -1 if the layout is
+ *         not supported
  ***********************************************************/
-int get_nb_char_img(img_t *img){
-    // Point into the first Pixel
-	uint8_t *rgb = &img->raw[0].r;
-	int nb_char=0, exp=0;
-    
-    // Starts with exp = 1 and ends with exp = 31
-	for (int i = BYTES_HEADER_CHAR-1; i >= 0; i--){
-        // If the lowest bit is 1, the right pow of 2 is added
-		nb_char += add_pow_2(rgb + i, exp);
-		exp++;
-	}
+int get_nb_char_img(img_t *img, format_t *fmt){
+	uint32_t nb_char;
+
+	if(read_header(&img->raw[0].r, (size_t)img->width * img->height * sizeof(pixel_t), &nb_char, fmt) != 1)
+		return -1;
 	return nb_char;
-}
\ No newline at end of file
+}
+
+/***********************************************************
+ * Decode a range of bits from consecutive components into
+ * a text (the bits of a symbol go from the highest to the
+ * lowest, as in the decoding threads). The bits of the
+ * symbols partly in the range are added to them, so these
+ * ones must be initialised to 0.
+ * @param comp pointer to the component holding the first bit
+ * @param text pointer to the symbol receiving the first bit
+ * @param first_bit position of the first bit from text[0]
+ *                  (0 for the highest bit of text[0])
+ * @param nb_bits number of bits to decode
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+void decode_bits(const uint8_t *comp, char *text, size_t first_bit, size_t nb_bits, format_t fmt){
+	gather_bits(comp, text, first_bit, nb_bits, fmt.nb_lsb, fmt.sym_bits);
+}
+
+/***********************************************************
+ * Decode a whole text from an image, without threads
+ * @param img a pointer to the image to read
+ * @param text receives the chars of the text
+ * @param nb_char number of chars of the text (see
+ *                get_nb_char_img)
+ * @param fmt layout of the payload (see get_nb_char_img)
+ ***********************************************************/
+void decode_text(img_t *img, char *text, int nb_char, format_t fmt){
+	decode_bits(&img->raw[0].r + payload_offset(fmt), text, 0, (size_t)nb_char * fmt.sym_bits, fmt);
+}
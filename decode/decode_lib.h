@@ -7,11 +7,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <math.h>
+#include <stddef.h>
 #include "../libs/ppm.h"
-
-#define BYTES_HEADER_CHAR 32
+#include "../libs/bitplane.h"
+#include "../libs/format.h"
 
 int add_pow_2(uint8_t *ptr, int exp);
-int get_nb_char_img(img_t *img);
+int get_nb_char_img(img_t *img, format_t *fmt);
+void decode_bits(const uint8_t *comp, char *text, size_t first_bit, size_t nb_bits, format_t fmt);
+void decode_text(img_t *img, char *text, int nb_char, format_t fmt);
 
 
@@ -0,0 +1,147 @@
+/************************************************************************************
+ * @file extract.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Extraction of a file from a container
+ *
+ * The directory of a container (encode -a, see container.h) is decoded first,
+ * then only the components holding the file, read from the image if they are
+ * not loaded yet. Without a name, the files of the container are listed.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "extract.h"
+#include "decode.h"
+#include "../libs/alloc.h"
+#include "../libs/png.h"
+#include "../libs/crc32c.h"
+#include "../libs/container.h"
+
+/***********************************************************
+ * Decode a range of chars of the payload, reading first the
+ * rows holding it if they are not loaded yet
+ * @param input name of the image
+ * @param img pointer to the loaded rows, replaced if more
+ *            rows are read
+ * @param height receives the height of the image
+ * @param first index of the first char of the range
+ * @param nb number of chars of the range
+ * @param nb_threads maximum number of threads to use
+ * @param fmt layout of the payload (see format.h)
+ * @param stats statistics of the run, or NULL
+ * @param text receives the chars (to free, terminated by
+ *             '\0')
+ * @return the number of threads used
+ ***********************************************************/
+static int decode_range(char *input, img_t **img, int *height, size_t first, size_t nb, int nb_threads,
+                        format_t fmt, stats_t *stats, char **text){
+    size_t start = first - first % group_symbols(fmt);
+    size_t nb_comp = payload_offset(fmt) + payload_comps(first + nb, fmt);
+    uint32_t crc;
+
+    if(nb_comp > (size_t)(*img)->width * (*img)->height * sizeof(pixel_t)){
+        free_img(*img);
+        if(!(*img = load_image_head(input, nb_comp, height))){
+            fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Decoding starts at the group holding the first char
+    *text = my_calloc(first + nb - start + 1, sizeof(char));
+    nb_threads = decode_threads(*img, start, *text, -1, 0, first + nb - start, nb_threads, fmt, stats, &crc);
+    memmove(*text, *text + (first - start), nb);
+    (*text)[nb] = '\0';
+    return nb_threads;
+}
+
+/***********************************************************
+ * Extract a file from a container (see container.h): only
+ * the directory, then the components of the file are
+ * decoded; the files are listed if no name is given
+ * @param input name of the image
+ * @param img the rows of the image holding the header
+ * @param height height of the image
+ * @param nb_char number of chars of the payload
+ * @param fmt layout of the payload (see format.h)
+ * @param name name of the file to extract, or NULL
+ * @param output file receiving the file extracted, or NULL
+ *               to print it
+ * @param nb_threads maximum number of threads to use
+ * @param stats statistics of the run, or NULL
+ ***********************************************************/
+void extract_file(char *input, img_t *img, int height, size_t nb_char, format_t fmt, const char *name,
+                  char *output, int nb_threads, stats_t *stats){
+    uint32_t nb_entries, dir_size = 0;
+    entry_t *entries = NULL;
+    char *head = NULL, *dir, *data;
+
+    // A scattered payload may be in any row
+    if(fmt.keyed && img->height < height){
+        size_t nb_comp = (size_t)img->width * height * sizeof(pixel_t);
+        free_img(img);
+        if(!(img = load_image_head(input, nb_comp, &height))){
+            fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The head of the directory gives its size
+    begin_phase(stats, "directory");
+    if(nb_char >= DIRECTORY_HEAD)
+        decode_range(input, &img, &height, 0, DIRECTORY_HEAD, 1, fmt, NULL, &head);
+    if(head && read_directory_head(head, &nb_entries, &dir_size) && dir_size <= nb_char){
+        decode_range(input, &img, &height, 0, dir_size, nb_threads, fmt, NULL, &dir);
+        entries = read_directory(dir, nb_entries, dir_size, nb_char);
+        free(dir);
+    }
+    free(head);
+    end_phase(stats, dir_size);
+    if(!entries){
+        fprintf(stderr, "NO VALID DIRECTORY IN THE IMAGE %s\nExiting now...\n", input);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!name){
+        printf("---------- FILES ----------\n\n");
+        for (uint32_t i = 0; i < nb_entries; i++)
+            printf("%10u  %s%s\n", entries[i].length, entries[i].name,
+                   entries[i].flags & ENTRY_CHECKED ? " (checked)" : "");
+        printf("\n---------- FILES ----------\n\n");
+        free(entries);
+        free_img(img);
+        return;
+    }
+    const entry_t *e = find_entry(entries, nb_entries, name);
+    if(!e){
+        fprintf(stderr, "NO FILE NAMED %s IN THE IMAGE %s\nExiting now...\n", name, input);
+        exit(EXIT_FAILURE);
+    }
+    nb_threads = decode_range(input, &img, &height, dir_size + e->offset, e->length, nb_threads, fmt, stats, &data);
+    if((e->flags & ENTRY_CHECKED) && crc32c(0, data, e->length) != e->checksum){
+        fprintf(stderr, "THE FILE %s OF %s DOES NOT MATCH ITS CHECKSUM\nExiting now...\n", name, input);
+        exit(EXIT_FAILURE);
+    }
+    if(output){
+        FILE *fp = fopen(output, "w");
+        bool ok = fp && fwrite(data, 1, e->length, fp) == e->length;
+        if(!fp || fclose(fp) != 0 || !ok){
+            fprintf(stderr, "ERROR WRITING THE OUTPUT FILE\nExiting now...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("\n%u threads were used\n\n", nb_threads);
+    begin_phase(stats, "print");
+    if(!output){
+        printf("---------- FILE %s ----------\n\n", name);
+        fwrite(data, 1, e->length, stdout);
+        printf("\n\n---------- FILE %s ----------\n\n", name);
+    }
+    fflush(stdout);
+    end_phase(stats, output ? 0 : e->length);
+
+    free(data);
+    free(entries);
+    free_img(img);
+}
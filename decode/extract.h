@@ -0,0 +1,16 @@
+/************************************************************************************
+ * @file extract.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Extraction of a file from a container
+ ***********************************************************************************/
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include "decode_lib.h"
+#include "../libs/stats.h"
+
+void extract_file(char *input, img_t *img, int height, size_t nb_char, format_t fmt, const char *name,
+                  char *output, int nb_threads, stats_t *stats);
+
+#endif
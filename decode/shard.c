@@ -0,0 +1,204 @@
+/************************************************************************************
+ * @file shard.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Decoding of a text cut over a set of images
+ *
+ * The headers of the images (encode -M) give the identifier of the set, the index
+ * of each shard and its position in the text. The images then go through a
+ * pipeline (see pipeline.h), the threads writing each shard straight at its
+ * position in the output file.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shard.h"
+#include "decode.h"
+#include "../libs/alloc.h"
+#include "../libs/files.h"
+#include "../libs/pipeline.h"
+#include "../libs/png.h"
+
+/***********************************************************
+ * A shard of a set of images going through the pipeline
+ * @param path the image
+ * @param img the image, once loaded
+ * @param fmt layout of the shard, giving its position in
+ *            the payload (see format.h)
+ * @param nb_char number of chars of the shard
+ ***********************************************************/
+typedef struct shard_st {
+	char *path;
+	img_t *img;
+	format_t fmt;
+	int nb_char;
+} shard_t;
+
+/***********************************************************
+ * Context of the decoding of a set of images
+ * @param shards the shards, by index
+ * @param nb_threads number of threads decoding an image
+ * @param out_fd the output file, receiving each shard at
+ *               its position
+ * @param bytes number of bytes of the images decoded
+ ***********************************************************/
+typedef struct shard_set_st {
+	shard_t *shards;
+	int nb_threads;
+	int out_fd;
+	size_t bytes;
+} shard_set_t;
+
+/***********************************************************
+ * Load stage of a set: read the rows of the image holding
+ * the shard (the whole image if it is keyed)
+ * @param ctx see the struct shard_set_t
+ * @param index index of the shard
+ * @return the shard (see the struct shard_t) or NULL
+ ***********************************************************/
+static void *shard_load(void *ctx, int index){
+	shard_set_t *set = (shard_set_t *)ctx;
+	shard_t *shard = &set->shards[index];
+	size_t nb_comp = payload_offset(shard->fmt) + payload_comps(shard->nb_char, shard->fmt);
+	int height;
+
+	shard->img = shard->fmt.keyed ? load_image(shard->path) : load_image_head(shard->path, nb_comp, &height);
+	if(!shard->img){
+		fprintf(stderr, "SHARD %d: CANNOT READ THE IMAGE %s\n", index + 1, shard->path);
+		return NULL;
+	}
+	return shard;
+}
+
+/***********************************************************
+ * Process stage of a set: decode the shard, the threads
+ * writing it at its position in the output file
+ * @param ctx see the struct shard_set_t
+ * @param item the shard (see the struct shard_t)
+ * @return false if the shard cannot be written or does not
+ *         match its checksum
+ ***********************************************************/
+static bool shard_process(void *ctx, void *item){
+	shard_set_t *set = (shard_set_t *)ctx;
+	shard_t *shard = (shard_t *)item;
+	uint32_t crc;
+
+	if(decode_threads(shard->img, 0, NULL, set->out_fd, shard->fmt.shard_offset, shard->nb_char, set->nb_threads,
+	                  shard->fmt, NULL, &crc) < 0){
+		fprintf(stderr, "ERROR WRITING THE SHARD OF %s\n", shard->path);
+		return false;
+	}
+	if(shard->fmt.checked && crc != shard->fmt.checksum){
+		fprintf(stderr, "THE TEXT OF %s DOES NOT MATCH ITS CHECKSUM\n", shard->path);
+		return false;
+	}
+	return true;
+}
+
+/***********************************************************
+ * Store stage of a set: free the image (the shard is
+ * already written)
+ * @param ctx see the struct shard_set_t
+ * @param item the shard (see the struct shard_t) or NULL
+ * @param ok false if a previous stage failed
+ * @return ok
+ ***********************************************************/
+static bool shard_store(void *ctx, void *item, bool ok){
+	shard_set_t *set = (shard_set_t *)ctx;
+	shard_t *shard = (shard_t *)item;
+
+	if(!shard)
+		return false;
+	if(ok)
+		set->bytes += (size_t)shard->img->width * shard->img->height * sizeof(pixel_t);
+	free_img(shard->img);
+	shard->img = NULL;
+	return ok;
+}
+
+/***********************************************************
+ * Decode a payload cut over a set of images (encode -M):
+ * the headers give the index and the position of each
+ * shard, then the images go through a pipeline (while a
+ * shard is decoded, the next image is read), each shard
+ * being written at its position in the output file
+ * @param images a directory or a list of the images (see
+ *               list_images), in any order
+ * @param output the file receiving the payload
+ * @param nb_threads number of threads decoding an image
+ * @param key the key of the keyed images, or NULL
+ * @param stats statistics of the run, or NULL
+ ***********************************************************/
+void shard_decode(char *images, char *output, int nb_threads, const char *key, stats_t *stats){
+	stages_t stages = { shard_load, shard_process, shard_store };
+	shard_set_t set = { .nb_threads = nb_threads, .bytes = 0 };
+	int nb_images;
+
+    if(nb_threads <= 0){
+        fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+    }
+	char ***list = list_images(images, &nb_images);
+	if(!nb_images){
+		fprintf(stderr, "NO IMAGE IN %s\nExiting now...\n", images);
+		exit(EXIT_FAILURE);
+	}
+	set.shards = my_calloc(nb_images, sizeof(shard_t));
+
+    // The headers place every shard: all the images must belong to one set,
+    // with each index once
+	begin_phase(stats, "headers");
+	uint32_t set_id = 0;
+	for (int i = 0; i < nb_images; i++){
+		format_t fmt;
+		int height;
+		img_t *img = load_image_head(list[i][0], MAX_HEADER_SIZE, &height);
+		int nb_char = img ? get_nb_char_img(img, &fmt) : -1;
+		if(nb_char < 0 || !fmt.sharded ||
+		   payload_offset(fmt) + payload_comps(nb_char, fmt) > (size_t)img->width * height * sizeof(pixel_t)){
+			fprintf(stderr, "NO VALID SHARD IN THE IMAGE %s\nExiting now...\n", list[i][0]);
+			exit(EXIT_FAILURE);
+		}
+		if(!set_key(&fmt, key)){
+			fprintf(stderr, "THE TEXT OF %s IS SCATTERED WITH A KEY, GIVE IT WITH -K\nExiting now...\n", list[i][0]);
+			exit(EXIT_FAILURE);
+		}
+		free_img(img);
+		if(!i)
+			set_id = fmt.set_id;
+		if(fmt.nb_shards != nb_images || set.shards[fmt.seq].path || fmt.set_id != set_id){
+			fprintf(stderr, "THE IMAGES OF %s ARE NOT ONE WHOLE SET\nExiting now...\n", images);
+			exit(EXIT_FAILURE);
+		}
+		set.shards[fmt.seq] = (shard_t){ list[i][0], NULL, fmt, nb_char };
+	}
+	size_t total = 0;
+	for (int i = 0; i < nb_images; i++){
+		if(set.shards[i].fmt.shard_offset != total){
+			fprintf(stderr, "THE IMAGES OF %s ARE NOT ONE WHOLE SET\nExiting now...\n", images);
+			exit(EXIT_FAILURE);
+		}
+		total += set.shards[i].nb_char;
+	}
+	end_phase(stats, 0);
+
+	set.out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(set.out_fd < 0 || ftruncate(set.out_fd, total) != 0){
+		fprintf(stderr, "FILE %s NOT FOUND OR CANNOT BE OPENED\nExiting now...\n", output);
+		exit(EXIT_FAILURE);
+	}
+	begin_phase(stats, "shards");
+	int nb_failed = run_pipeline(&stages, &set, nb_images, BATCH_DEPTH);
+	end_phase(stats, total);
+	if(close(set.out_fd) != 0 || nb_failed){
+		unlink(output);
+		fprintf(stderr, "%d SHARDS OF %s COULD NOT BE DECODED\nExiting now...\n", nb_failed ? nb_failed : nb_images,
+		        images);
+		exit(EXIT_FAILURE);
+	}
+	printf("%d shards of set %08x decoded into %s (%zu chars)\n", nb_images, set_id, output, total);
+
+	free(set.shards);
+	free_manifest(list, nb_images, 1);
+}
@@ -0,0 +1,14 @@
+/************************************************************************************
+ * @file shard.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Decoding of a text cut over a set of images
+ ***********************************************************************************/
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "../libs/stats.h"
+
+void shard_decode(char *images, char *output, int nb_threads, const char *key, stats_t *stats);
+
+#endif
@@ -4,10 +4,15 @@
  * @date 29 Oct 2017
  * @brief Encode a text into a ppm file.
  *
- * This program receive, via argument, the path of a text file, and 2 ppm images
- * (input and output). It also receive a number of threads. The program will then
- * encode the text changing if needed the lowest bit from the input image and
- * outputing the new image. It will encode in multi-threading.
+ * This program receive, via argument, the path of a text file, and 2 images (PPM
+ * or PNG, see png.h), input and output. It also receive a number of threads. The
+ * program will then encode the text in the lowest bits of the input image (the
+ * layout being recorded in its header, see format.h) and output the new image.
+ * It will encode in multi-threading, the threads drawing chunks of the text from
+ * a work queue (see scheduler.h).
+ *
+ * The other modes (streaming by bands, patch in place, batch, containers, sets
+ * of images) are described by the usage of the program.
  ***********************************************************************************/
 
 #include <sys/stat.h>
@@ -18,58 +23,90 @@
 #include <math.h>
 #include <libgen.h>
 #include <unistd.h>
-#include "encode_lib.h"
+#include <getopt.h>
+#include <fcntl.h>
+#include "encode.h"
+#include "shard.h"
 #include "../libs/alloc.h"
 #include "../libs/files.h"
+#include "../libs/pipeline.h"
+#include "../libs/lz.h"
+#include "../libs/crc32c.h"
+#include "../libs/scatter.h"
+#include "../libs/scheduler.h"
+#include "../libs/aio.h"
+#include "../libs/png.h"
+#include "../libs/pack.h"
 
-const uint BYTES_HEADER_CHAR = sizeof(int) * 8;
-const uint FIRST_PIXEL = 11;
 const int NB_ARG = 4;
+const int NB_ARG_BATCH = 1;
+const int BATCH_DEPTH = 2;
+#define NB_SLOTS 3
 
 /***********************************************************
- * Store where the threads begins
- * @param initial_indice Pixel of the image
- * @param initial_pos_rgb R, G or B (0, 1 or 2) in the pixel
- ***********************************************************/
-typedef struct limit_threads_st{
-	int initial_indice;
-	uint8_t initial_pos_rgb;
-} limit_threads_t;
-
-/***********************************************************
- * Store the arguments for the threads
- * @param limit see the struct limit_threads_t
- * @param text_cut pointer to the part of the text we encode
- * @param img a pointer to the image to write
+ * Store the arguments for the threads, which draw the
+ * chunks of the payload from a work queue (see scheduler.h)
+ * @param payload pointer to the first component after the
+ *                header
+ * @param text the whole text (not copied, nor terminated by
+ *             '\0')
+ * @param parts the chunks of the payload (see split_lines)
+ * @param queue the queue drawing the chunks
+ * @param crcs receives the checksum of the chars starting in
+ *             each chunk (if the layout has one)
+ * @param fmt layout of the payload (see format.h)
+ * @param scatter the permutation of a keyed layout, or NULL
+ * @param pin true to pin the thread on a processor
+ * @param stats statistics of the run, or NULL
+ * @param index index of the thread
  ***********************************************************/
 typedef struct param_st{
-	limit_threads_t limit;
-	char *text_cut;
-	img_t **img_out;
+	uint8_t *payload;
+	const char *text;
+	const line_part_t *parts;
+	work_queue_t *queue;
+	uint32_t *crcs;
+	format_t fmt;
+	const scatter_t *scatter;
+	bool pin;
+	stats_t *stats;
+	int index;
 } param_t;
 
 /***********************************************************
- * The maximum of chars that can fit in a picture
- * @param img a pointer to the image to read
- * @return the maximum of chars that can fit in a picture
+ * Chars owned by a chunk: those whose first bit is in it
+ * @param part the chunk
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ * @param first receives the index of the first char owned
+ * @return the number of chars owned
  ***********************************************************/
-uint max_char_encode(img_t *img){
-	return floor((img->height * img->width - FIRST_PIXEL) * 
-                 (float) sizeof(pixel_t) / (float) BITS_PER_CHAR);
+size_t owned_chars(const line_part_t *part, int sym_bits, size_t *first){
+	*first = (part->first_bit + sym_bits - 1) / sym_bits;
+	return (part->first_bit + part->nb_bits + sym_bits - 1) / sym_bits - *first;
 }
 
 /***********************************************************
- * To know the limits of a thread
- * @param min first char position of the cut text
- * @return where the threads begins (pixel position)
+ * Checksum of chars as they are encoded (a negative char
+ * being encoded as 0 in symbols of 7 bits)
+ * @param crc the checksum of the previous chars (0 for the
+ *            first ones)
+ * @param text the chars
+ * @param nb_char number of chars
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ * @return the checksum of the previous chars and of these
  ***********************************************************/
-limit_threads_t get_limits(int min){
-	limit_threads_t ret;
-	
-	ret.initial_indice = floor((float)(min * BITS_PER_CHAR) / sizeof(pixel_t)) + FIRST_PIXEL;
-	ret.initial_pos_rgb = (min * BITS_PER_CHAR) % sizeof(pixel_t);
+uint32_t checksum_symbols(uint32_t crc, const char *text, size_t nb_char, int sym_bits){
+	char symbols[4096];
 
-	return ret;
+	if(sym_bits == 8)
+		return crc32c(crc, text, nb_char);
+	for (size_t done = 0; done < nb_char; done += sizeof(symbols)){
+		size_t nb = nb_char - done < sizeof(symbols) ? nb_char - done : sizeof(symbols);
+		for (size_t i = 0; i < nb; i++)
+			symbols[i] = text[done + i] < 0 ? 0 : text[done + i];
+		crc = crc32c(crc, symbols, nb);
+	}
+	return crc;
 }
 
 /***********************************************************
@@ -80,47 +117,803 @@ limit_threads_t get_limits(int min){
 void *thread(void *param){
     // Get arguments
     param_t *p = (param_t *)param;
+    size_t c, first, nb_owned, nb_done = 0;
+    if(p->pin)
+        pin_thread(p->index);
+    begin_thread(p->stats, p->index);
 
-    int initial_ind = p->limit.initial_indice;
-    int initial_pos = p->limit.initial_pos_rgb;
-    img_t **img_out = p->img_out;
-    // Position the pointer to the first pixel (on R, G or B) we want to encode
-	uint8_t *ptr = &(*img_out)->raw[initial_ind].r + initial_pos;
-
-    // This loop go through each char of the cut text
-    for (uint i = 0; i < strlen(p->text_cut); i++){
-        // Current char
-		char temp = p->text_cut[i];
-        // For each char it must encode 7 lowest bits
-		for(int8_t indice = BITS_PER_CHAR - 1; indice >= 0;indice--){
-            // Initialise bit to zero and calculate current pow of 2
-			uint8_t bit = 0;
-			uint8_t temp_pow = (uint8_t) pow(2, indice);
-            // If current char current char >= current pow..
-            // ..bit to 1 and this pow of 2 is reduced to the char
-			if(temp >= temp_pow){
-				bit = 1;
-				temp -= temp_pow;
-			}
-            // Encode the bit into the R, G or B
-			*(ptr) = encode_int(*(ptr), bit);
-            
-            // Reposition the pixel to the next R, G or B
-			ptr++;
-		}
+    // Spread the bits of each chunk drawn into its components (from its first
+    // one, or at the positions given by the key)
+    while(next_chunk(p->queue, p->index, &c)){
+        const line_part_t *part = &p->parts[c];
+        const char *text = p->text + part->first_bit / p->fmt.sym_bits;
+        if(p->scatter)
+            scatter_spread(p->payload, p->scatter, part->first_comp, text, part->nb_bits,
+                           p->fmt.nb_lsb, p->fmt.sym_bits);
+        else
+            encode_bits(p->payload + part->first_comp, text, part->first_bit % p->fmt.sym_bits,
+                        part->nb_bits, p->fmt);
+        nb_owned = owned_chars(part, p->fmt.sym_bits, &first);
+        if(p->fmt.checked)
+            p->crcs[c] = checksum_symbols(0, p->text + first, nb_owned, p->fmt.sym_bits);
+        nb_done += nb_owned;
+    }
+    end_thread(p->stats, p->index, nb_done);
+    return NULL;
+}
+
+/***********************************************************
+ * Cut a payload in parts of whole groups of chars (see
+ * group_symbols), for the keyed layout whose fields are
+ * scattered anyway
+ * @param nb_char number of chars of the text
+ * @param nb_parts number of parts wanted
+ * @param fmt layout of the payload (see format.h)
+ * @param parts receives the parts (see split_lines)
+ * @return the number of parts, at least 1
+ ***********************************************************/
+int split_groups(uint nb_char, int nb_parts, format_t fmt, line_part_t *parts){
+	size_t group = group_symbols(fmt);
+	size_t nb_groups = (nb_char + group - 1) / group;
+
+	if((size_t)nb_parts > nb_groups)
+		nb_parts = nb_groups ? nb_groups : 1;
+	for (int i = 0; i < nb_parts; i++){
+		size_t min = nb_groups * i / nb_parts * group;
+		size_t max = nb_groups * (i + 1) / nb_parts * group;
+		if(max > nb_char)
+			max = nb_char;
+		parts[i].first_comp = min * fmt.sym_bits / fmt.nb_lsb;
+		parts[i].first_bit = min * fmt.sym_bits;
+		parts[i].nb_bits = (max - min) * fmt.sym_bits;
+	}
+	return nb_parts;
+}
+
+/***********************************************************
+ * Encode a text into an image, the text being cut in chunks
+ * of whole cache lines of components (see split_lines)
+ * drawn by the threads, as many as the cost model finds
+ * worth (see plan_work)
+ * @param img a pointer to the image to write
+ * @param text the text to encode
+ * @param nb_char number of chars of the text, which must
+ *                fit in the image
+ * @param nb_threads maximum number of threads to use
+ * @param fmt layout of the payload (see format.h)
+ * @param pin true to pin the threads on the processors
+ * @param stats statistics of the run, or NULL
+ * @return the number of threads used
+ ***********************************************************/
+int encode_threads(img_t *img, const char *text, uint nb_char, int nb_threads, format_t fmt, bool pin,
+                   stats_t *stats){
+	uint8_t *payload = &img->raw[0].r + payload_offset(fmt);
+	size_t nb_bits = (size_t)nb_char * fmt.sym_bits, nb_chunks;
+	nb_threads = plan_work(nb_char, nb_threads, &nb_chunks);
+	line_part_t *parts = my_malloc(nb_chunks * sizeof(line_part_t));
+
+    // The keyed layout scatters the fields over all the components after the header
+	scatter_t scatter;
+	if(fmt.keyed){
+		init_scatter(&scatter, fmt.key, (size_t)img->width * img->height * sizeof(pixel_t) - payload_offset(fmt));
+		nb_chunks = split_groups(nb_char, nb_chunks, fmt, parts);
+	}else
+		nb_chunks = split_lines(payload, nb_bits, fmt.nb_lsb, nb_chunks, parts);
+	if((size_t)nb_threads > nb_chunks)
+		nb_threads = nb_chunks;
+	uint32_t  *crcs = my_malloc(nb_chunks * sizeof(uint32_t));
+	pthread_t *threads = my_malloc(nb_threads * sizeof(pthread_t));
+	param_t   *threads_param = my_malloc(nb_threads * sizeof(param_t));
+	work_queue_t queue;
+	init_work_queue(&queue, nb_chunks, nb_threads);
+	set_stats_threads(stats, nb_threads);
+    
+    // Threads launching loop (a single thread being the calling one)
+	begin_phase(stats, "spawn");
+	for (int i = 0; i < nb_threads; i++){
+        // Assign the threads arguments
+        threads_param[i].payload = payload;
+        threads_param[i].text = text;
+        threads_param[i].parts = parts;
+        threads_param[i].queue = &queue;
+        threads_param[i].crcs = crcs;
+        threads_param[i].fmt = fmt;
+        threads_param[i].scatter = fmt.keyed ? &scatter : NULL;
+        threads_param[i].pin = pin;
+        threads_param[i].stats = stats;
+        threads_param[i].index = i;
+
+        // Create thread and check for fail
+        if (nb_threads > 1 && pthread_create(&threads[i], NULL, thread, &threads_param[i]) != 0){
+            fprintf(stderr, "pthread_create failed!\n");
+            exit(0);
+        }
 	}
+	end_phase(stats, 0);
+    
+    // Threads "waiting" loop
+	begin_phase(stats, "join");
+	if(nb_threads == 1)
+		thread(&threads_param[0]);
+	for (int i = 0; nb_threads > 1 && i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+	end_phase(stats, nb_char);
+
+    // Write in the first pixels the number of chars of the text and its layout,
+    // with the checksums of the chunks combined in order
+	begin_phase(stats, "header");
+	for (size_t c = 0, first; fmt.checked && c < nb_chunks; c++)
+		fmt.checksum = crc32c_combine(fmt.checksum, crcs[c], owned_chars(&parts[c], fmt.sym_bits, &first));
+	write_header(&img->raw[0].r, 0, header_size(fmt), nb_char, fmt);
+	end_phase(stats, header_size(fmt));
+    free_work_queue(&queue);
+    free(threads_param);
+    free(threads);
+    free(crcs);
+    free(parts);
+    return nb_threads;
+}
+
+/***********************************************************
+ * Compress the text if the layout has a codec (see lz.h),
+ * the threads compressing different blocks
+ * @param text pointer to the text, replaced by the
+ *             compressed text
+ * @param nb_char pointer to the number of chars, replaced
+ *                by the size of the compressed text
+ * @param fmt pointer to the layout, receiving the length
+ *            of the text
+ * @param nb_threads number of threads to use
+ * @param stats statistics of the run, or NULL
+ * @return the compressed text (to free), or NULL if the
+ *         layout has no codec
+ ***********************************************************/
+char *compress_text(const char **text, uint *nb_char, format_t *fmt, int nb_threads, stats_t *stats){
+	if(fmt->codec == CODEC_NONE)
+		return NULL;
+	begin_phase(stats, "compress");
+	char *packed = my_malloc(lz_bound(*nb_char) + 1);
+	fmt->raw_len = *nb_char;
+	*nb_char = lz_compress(*text, *nb_char, packed, nb_threads);
+	*text = packed;
+	end_phase(stats, fmt->raw_len);
+	return packed;
+}
+
+/***********************************************************
+ * Store the arguments for the threads of the streaming mode
+ * @param comp pointer to the component receiving the first bit
+ * @param text pointer to the char holding the first bit
+ * @param first_bit position of the first bit from this char
+ * @param nb_bits number of bits to encode
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+typedef struct band_param_st{
+	uint8_t *comp;
+	char *text;
+	size_t first_bit;
+	size_t nb_bits;
+	format_t fmt;
+} band_param_t;
+
+/***********************************************************
+ * Threads doing the encoding of a part of a band
+ * @param param see the struct band_param_t
+ * @return return NULL if no problem encountered
+ ***********************************************************/
+void *band_thread(void *param){
+    band_param_t *p = (band_param_t *)param;
+    encode_bits(p->comp, p->text, p->first_bit, p->nb_bits, p->fmt);
     return NULL;
 }
 
+/***********************************************************
+ * Encode a range of bits of the text into a band, the range
+ * being shared between the threads at group boundaries (see
+ * group_symbols)
+ * @param comp pointer to the component receiving the first bit
+ * @param text the chars encoded in the band (text[0] holds
+ *             the first bit)
+ * @param first_char position of text[0] in the whole text
+ * @param first_bit position of the first bit in text[0]
+ * @param nb_bits number of bits to encode
+ * @param nb_threads maximum number of threads to use (see
+ *                   plan_work)
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+void encode_band(uint8_t *comp, char *text, size_t first_char, int first_bit, size_t nb_bits,
+                 int nb_threads, format_t fmt){
+    // Positions of the bits in the whole text
+    size_t text_bit = first_char * fmt.sym_bits;
+    size_t begin_bit = text_bit + first_bit;
+    size_t end_bit = begin_bit + nb_bits;
+    size_t group = group_bits(fmt);
+    size_t first_group = begin_bit / group;
+    size_t nb_groups = (end_bit + group - 1) / group - first_group;
+
+	nb_threads = plan_work(nb_bits / fmt.sym_bits, nb_threads, NULL);
+	if(nb_threads > (int)nb_groups)
+        nb_threads = nb_groups;
+	pthread_t    *threads = my_malloc(nb_threads * sizeof(pthread_t));
+	band_param_t *threads_param = my_malloc(nb_threads * sizeof(band_param_t));
+
+	for (int i = 0; i < nb_threads; i++){
+        // Bits of the groups given to this thread, clipped to the range
+        size_t begin = (first_group + nb_groups * i / nb_threads) * group;
+        size_t end = (first_group + nb_groups * (i + 1) / nb_threads) * group;
+        if(begin < begin_bit)
+            begin = begin_bit;
+        if(end > end_bit)
+            end = end_bit;
+
+        threads_param[i].comp = comp + (begin - begin_bit) / fmt.nb_lsb;
+        threads_param[i].text = text;
+        threads_param[i].first_bit = begin - text_bit;
+        threads_param[i].nb_bits = end - begin;
+        threads_param[i].fmt = fmt;
+
+        if (pthread_create(&threads[i], NULL, band_thread, &threads_param[i]) != 0){
+            fprintf(stderr, "pthread_create failed!\n");
+            exit(EXIT_FAILURE);
+        }
+	}
+	for (int i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads_param);
+    free(threads);
+}
+
+/***********************************************************
+ * A band of the streaming mode, in one of the NB_SLOTS
+ * buffers turning between reading, encoding and writing
+ * @param band the pixels of the band
+ * @param text the chars encoded in the band
+ * @param row index of the first row of the band
+ * @param rows number of rows of the band
+ * @param writing true once the band is being written
+ * @param pending number of requests of the band (see aio.h)
+ *                not yet completed
+ ***********************************************************/
+typedef struct slot_st {
+	pixel_t *band;
+	char *text;
+	int row;
+	int rows;
+	bool writing;
+	int pending;
+} slot_t;
+
+/***********************************************************
+ * Bits of the text encoded in a range of components
+ * @param first index of the first component of the range
+ * @param last index of the component after the range
+ * @param nb_char number of chars of the text
+ * @param fmt layout of the payload (see format.h)
+ * @param begin_bit receives the position of the first bit
+ * @param end_bit receives the position after the last bit
+ * @return false if the range holds no bit of the text
+ ***********************************************************/
+bool band_bits(size_t first, size_t last, uint nb_char, format_t fmt, size_t *begin_bit, size_t *end_bit){
+	size_t text_begin = payload_offset(fmt);
+	size_t text_end = text_begin + payload_comps(nb_char, fmt);
+	size_t begin = first > text_begin ? first : text_begin;
+	size_t end = last < text_end ? last : text_end;
+
+	if(begin >= end)
+		return false;
+	*begin_bit = (begin - text_begin) * fmt.nb_lsb;
+	*end_bit = (end - text_begin) * fmt.nb_lsb;
+	if(*end_bit > (size_t)nb_char * fmt.sym_bits)
+		*end_bit = (size_t)nb_char * fmt.sym_bits;
+	return true;
+}
+
+/***********************************************************
+ * Submit the reads of a band: its rows of the input image,
+ * and the chars of the text encoded in it (unless they are
+ * taken from the compressed text)
+ * @param q the queue of the requests
+ * @param in the input image
+ * @param text_fd the text file
+ * @param packed the compressed text, or NULL
+ * @param slot receives the band
+ * @param row index of the first row of the band
+ * @param rows number of rows of the band
+ * @param nb_char number of chars of the text
+ * @param fmt layout of the payload (see format.h)
+ * @return false if the reads cannot be submitted
+ ***********************************************************/
+bool read_band(aio_t *q, ppm_stream_t *in, int text_fd, const char *packed, slot_t *slot, int row, int rows,
+               uint nb_char, format_t fmt){
+	size_t row_size = in->width * sizeof(pixel_t), begin_bit, end_bit;
+
+	slot->row = row;
+	slot->rows = rows;
+	slot->writing = false;
+	slot->pending = 0;
+	if(!submit_ppm_band(q, in, false, slot->band, row, rows, slot))
+		return false;
+	slot->pending++;
+	if(packed || !band_bits(row * row_size, (row + rows) * row_size, nb_char, fmt, &begin_bit, &end_bit))
+		return true;
+	size_t first_char = begin_bit / fmt.sym_bits;
+	size_t last_char = (end_bit + fmt.sym_bits - 1) / fmt.sym_bits;
+	if(!aio_submit(q, false, text_fd, slot->text, last_char - first_char, first_char, slot->text))
+		return false;
+	slot->pending++;
+	return true;
+}
+
+/***********************************************************
+ * Wait for the requests of a band to be completed, the
+ * requests of the other bands completed meanwhile being
+ * counted as well
+ * @param q the queue of the requests
+ * @param slots the NB_SLOTS bands
+ * @param slot the band to wait for
+ * @param filename the path of the text file
+ * @param input the path of the input image
+ ***********************************************************/
+void wait_band(aio_t *q, slot_t *slots, slot_t *slot, char *filename, char *input){
+	while(slot->pending > 0){
+		bool ok;
+		void *tag = aio_complete(q, &ok);
+		for (int i = 0; i < NB_SLOTS; i++){
+			if(tag != &slots[i] && tag != slots[i].text)
+				continue;
+			if(!ok && tag == slots[i].text)
+				fprintf(stderr, "CANNOT READ THE TEXT FILE %s\nExiting now...\n", filename);
+			else if(!ok && slots[i].writing)
+				fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
+			else if(!ok)
+				fprintf(stderr, "CANNOT READ THE INPUT IMAGE %s\nExiting now...\n", input);
+			if(!ok)
+				exit(EXIT_FAILURE);
+			slots[i].pending--;
+		}
+		if(!tag){
+			fprintf(stderr, "CANNOT READ THE INPUT IMAGE %s\nExiting now...\n", input);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/***********************************************************
+ * Encode the text band by band, without loading the whole
+ * image in memory (streaming mode)
+ * @param filename the path of the text file
+ * @param input the path of the input image
+ * @param output the path of the output image
+ * @param nb_threads number of threads used for each band
+ * @param budget memory (in bytes) that the bands can use
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+void stream_encode(char *filename, char *input, char *output, int nb_threads, size_t budget,
+                   format_t fmt){
+	ppm_stream_t *in = open_ppm_stream(input);
+	if(!in){
+		fprintf(stderr, "CANNOT READ THE INPUT IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	img_t size = { .width = in->width, .height = in->height };
+	size_t row_size = in->width * sizeof(pixel_t);
+	size_t row_text = row_size * fmt.nb_lsb / fmt.sym_bits + 1;
+
+    // A row needs room for its components and for the chars encoded in it, in
+    // each of the bands read, encoded and written at the same time
+	size_t band_rows = budget / (NB_SLOTS * (row_size + row_text));
+	if(band_rows == 0){
+		fprintf(stderr,"MEMORY BUDGET TOO SMALL FOR ONE ROW OF THE IMAGE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	if(band_rows > (size_t)in->height)
+		band_rows = in->height;
+
+   	uint nb_char = fsize(filename);
+    if(nb_threads <= 0){
+        fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+    }
+
+    // A compressed text is compressed as a whole before the bands, and the
+    // bands take their chars from it instead of reading them from the file
+	bool mapped;
+	const char *payload = NULL;
+	char *packed = NULL;
+	if(fmt.codec != CODEC_NONE){
+		char *text = load_file(filename, nb_char, &mapped);
+		payload = text;
+		packed = compress_text(&payload, &nb_char, &fmt, nb_threads, NULL);
+		release_file(text, fmt.raw_len, mapped);
+	}
+	if (nb_char > max_char_encode(&size, fmt)){
+		fprintf(stderr,"TEXT TOO LONG FOR THIS IMAGE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	if(nb_threads > (int)nb_char)
+        nb_threads = nb_char;
+
+    // The header, in the first band, needs the checksum of the whole text
+	if(fmt.checked && packed)
+		fmt.checksum = crc32c(0, packed, nb_char);
+	else if(fmt.checked){
+		char *text = load_file(filename, nb_char, &mapped);
+		fmt.checksum = checksum_symbols(0, text, nb_char, fmt.sym_bits);
+		release_file(text, nb_char, mapped);
+	}
+
+	FILE *text_file = open_file(filename, "r");
+	ppm_stream_t *out = create_ppm_stream(output, in->width, in->height, in);
+	aio_t *q = aio_create(2 * NB_SLOTS);
+	if(!out || !q){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	slot_t slots[NB_SLOTS];
+	for (int i = 0; i < NB_SLOTS; i++){
+		slots[i].band = aio_alloc(band_rows * row_size);
+		slots[i].text = aio_alloc(band_rows * row_text + 2);
+		slots[i].pending = 0;
+		if(!slots[i].band || !slots[i].text){
+			fprintf(stderr, "MEMORY BUDGET TOO LARGE FOR THIS MACHINE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+    // While a band is encoded, the next one is read and the previous one is written
+	int nb_bands = (in->height + band_rows - 1) / band_rows;
+	for (int b = 0; b < nb_bands; b++){
+		slot_t *slot = &slots[b % NB_SLOTS];
+		bool read_ok = b > 0 || read_band(q, in, fileno(text_file), packed, slot, 0, band_rows, nb_char, fmt);
+		if(read_ok && b + 1 < nb_bands){
+            // The buffer of the next band is free once the band before this one is written
+			slot_t *next = &slots[(b + 1) % NB_SLOTS];
+			int row = (b + 1) * band_rows;
+			int rows = in->height - row < (int)band_rows ? in->height - row : (int)band_rows;
+			wait_band(q, slots, next, filename, input);
+			read_ok = read_band(q, in, fileno(text_file), packed, next, row, rows, nb_char, fmt);
+		}
+		if(!read_ok){
+			fprintf(stderr, "CANNOT READ THE INPUT IMAGE %s\nExiting now...\n", input);
+			exit(EXIT_FAILURE);
+		}
+		wait_band(q, slots, slot, filename, input);
+		size_t first = slot->row * row_size;
+		size_t last = first + slot->rows * row_size;
+		uint8_t *comp = &slot->band[0].r;
+
+        // Write the part of the header that is in this band..
+		write_header(comp, first, last, nb_char, fmt);
+
+        //.. and the part of the text
+		size_t begin_bit, end_bit;
+		if(band_bits(first, last, nb_char, fmt, &begin_bit, &end_bit)){
+			size_t first_char = begin_bit / fmt.sym_bits;
+			char *chars = packed ? packed + first_char : slot->text;
+			encode_band(comp + payload_offset(fmt) + begin_bit / fmt.nb_lsb - first, chars, first_char,
+			            begin_bit % fmt.sym_bits, end_bit - begin_bit, nb_threads, fmt);
+		}
+
+		slot->writing = true;
+		slot->pending = 1;
+		if(!submit_ppm_band(q, out, true, slot->band, slot->row, slot->rows, slot)){
+			fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < NB_SLOTS; i++)
+		wait_band(q, slots, &slots[i], filename, input);
+
+    printf("%u threads were used\n", nb_threads);
+
+	if(!close_ppm_stream(out)){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	aio_destroy(q);
+	close_ppm_stream(in);
+	fclose(text_file);
+	free(packed);
+	for (int i = 0; i < NB_SLOTS; i++){
+		free(slots[i].band);
+		free(slots[i].text);
+	}
+}
+
+/***********************************************************
+ * Encode the text by patching a copy of the input image
+ * (or the input image itself): only the rows holding the
+ * header and the text are read, and only the components
+ * they change are written
+ * @param filename the path of the text file
+ * @param input the path of the input image
+ * @param output the path of the output image, or NULL to
+ *               modify the input image in place
+ * @param nb_threads number of threads to use
+ * @param fmt layout of the payload (see format.h)
+ * @param pin true to pin the threads on the processors
+ * @param stats statistics of the run, or NULL
+ ***********************************************************/
+void patch_encode(char *filename, char *input, char *output, int nb_threads, format_t fmt, bool pin,
+                  stats_t *stats){
+	struct stat in_st, out_st;
+	ppm_stream_t *in = open_ppm_stream(input);
+	if(!in || fstat(fileno(in->f), &in_st) != 0 || !S_ISREG(in_st.st_mode)){
+		fprintf(stderr, "CANNOT READ THE INPUT IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	off_t offset = ftell(in->f);
+	img_t size = { .width = in->width, .height = in->height };
+	uint nb_char = fsize(filename);
+	if(nb_threads <= 0){
+		fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bool mapped;
+	begin_phase(stats, "read_text");
+	char *text = load_file(filename, nb_char, &mapped);
+	end_phase(stats, nb_char);
+	const char *payload = text;
+	char *packed = compress_text(&payload, &nb_char, &fmt, nb_threads, stats);
+	if(nb_char > max_char_encode(&size, fmt)){
+		fprintf(stderr,"TEXT TOO LONG FOR THIS IMAGE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+
+    // Read the rows holding the components to change
+	begin_phase(stats, "load");
+	size_t nb_comp = payload_offset(fmt) + payload_comps(nb_char, fmt);
+	size_t row_size = in->width * sizeof(pixel_t);
+	int rows = (nb_comp + row_size - 1) / row_size;
+	img_t *img = alloc_img(in->width, rows);
+	if(!img || !read_ppm_band(in, img->raw, rows)){
+		fprintf(stderr, "CANNOT READ THE INPUT IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	close_ppm_stream(in);
+	end_phase(stats, rows * row_size);
+
+	nb_threads = encode_threads(img, payload, nb_char, nb_threads, fmt, pin, stats);
+	release_file(text, packed ? fmt.raw_len : nb_char, mapped);
+	free(packed);
+	printf("%u threads were used\n", nb_threads);
+
+    // The output starts as a copy of the input (unless it is the input itself)..
+	if(output && stat(output, &out_st) == 0 && out_st.st_dev == in_st.st_dev && out_st.st_ino == in_st.st_ino)
+		output = NULL;
+	begin_phase(stats, "clone");
+	if(output && !clone_file(input, output)){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	end_phase(stats, output ? in_st.st_size : 0);
+
+    //.. then only the changed components are written
+	begin_phase(stats, "write");
+	int fd = open(output ? output : input, O_WRONLY);
+	if(fd < 0 || pwrite(fd, img->raw, nb_comp, offset) != (ssize_t)nb_comp || close(fd) != 0){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	end_phase(stats, nb_comp);
+	free_img(img);
+}
+
+/***********************************************************
+ * A job of the batch mode going through the pipeline
+ * @param paths text_file, input_image and output_image
+ * @param img the image, once loaded
+ * @param text the text, once loaded (and compressed)
+ * @param nb_char number of chars of the text
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+typedef struct batch_job_st{
+	char **paths;
+	img_t *img;
+	char *text;
+	uint nb_char;
+	format_t fmt;
+} batch_job_t;
+
+/***********************************************************
+ * Context of the batch mode
+ * @param jobs the jobs of the manifest
+ * @param nb_threads number of threads encoding an image
+ * @param fmt layout of the payloads (see format.h)
+ * @param pin true to pin the threads on the processors
+ * @param bytes number of bytes of the images encoded
+ ***********************************************************/
+typedef struct batch_st{
+	char ***jobs;
+	int nb_threads;
+	format_t fmt;
+	bool pin;
+	size_t bytes;
+} batch_t;
+
+/***********************************************************
+ * Free a job of the batch mode
+ * @param job the job
+ ***********************************************************/
+void free_batch_job(batch_job_t *job){
+	if(job->img)
+		free_img(job->img);
+	free(job->text);
+	free(job);
+}
+
+/***********************************************************
+ * Load stage of the batch mode: read the image and the text
+ * @param ctx see the struct batch_t
+ * @param index number of the job in the manifest
+ * @return the job (see the struct batch_job_t) or NULL
+ ***********************************************************/
+void *batch_load(void *ctx, int index){
+	batch_t *b = (batch_t *)ctx;
+	batch_job_t *job = my_calloc(1, sizeof(batch_job_t));
+	job->paths = b->jobs[index];
+
+	job->img = load_image(job->paths[1]);
+	if(!job->img){
+		fprintf(stderr, "JOB %d: CANNOT READ THE INPUT IMAGE %s\n", index + 1, job->paths[1]);
+		free_batch_job(job);
+		return NULL;
+	}
+	populate_img(job->img);
+
+	struct stat st;
+	FILE *fp = fopen(job->paths[0], "r");
+	if(!fp || fstat(fileno(fp), &st) != 0){
+		fprintf(stderr, "JOB %d: FILE %s NOT FOUND OR CANNOT BE OPENED\n", index + 1, job->paths[0]);
+		if(fp)
+			fclose(fp);
+		free_batch_job(job);
+		return NULL;
+	}
+	job->nb_char = st.st_size;
+	job->fmt = b->fmt;
+	if(job->fmt.codec == CODEC_NONE && job->nb_char > max_char_encode(job->img, job->fmt)){
+		fprintf(stderr, "JOB %d: TEXT TOO LONG FOR THIS IMAGE\n", index + 1);
+		fclose(fp);
+		free_batch_job(job);
+		return NULL;
+	}
+	job->text = my_calloc(job->nb_char + 1, sizeof(char));
+	size_t nb_read = fread(job->text, 1, job->nb_char, fp);
+	fclose(fp);
+	if(nb_read != job->nb_char){
+		fprintf(stderr, "JOB %d: FILE %s NOT FOUND OR CANNOT BE OPENED\n", index + 1, job->paths[0]);
+		free_batch_job(job);
+		return NULL;
+	}
+
+	const char *payload = job->text;
+	char *packed = compress_text(&payload, &job->nb_char, &job->fmt, b->nb_threads, NULL);
+	if(packed){
+		free(job->text);
+		job->text = packed;
+		if(job->nb_char > max_char_encode(job->img, job->fmt)){
+			fprintf(stderr, "JOB %d: TEXT TOO LONG FOR THIS IMAGE\n", index + 1);
+			free_batch_job(job);
+			return NULL;
+		}
+	}
+	return job;
+}
+
+/***********************************************************
+ * Process stage of the batch mode: encode the text
+ * @param ctx see the struct batch_t
+ * @param item the job (see the struct batch_job_t)
+ * @return true
+ ***********************************************************/
+bool batch_process(void *ctx, void *item){
+	batch_t *b = (batch_t *)ctx;
+	batch_job_t *job = (batch_job_t *)item;
+
+	encode_threads(job->img, job->text, job->nb_char, b->nb_threads, job->fmt, b->pin, NULL);
+	return true;
+}
+
+/***********************************************************
+ * Store stage of the batch mode: write the image
+ * @param ctx see the struct batch_t
+ * @param item the job (see the struct batch_job_t) or NULL
+ * @param ok false if a previous stage failed
+ * @return false if the image cannot be written
+ ***********************************************************/
+bool batch_store(void *ctx, void *item, bool ok){
+	batch_t *b = (batch_t *)ctx;
+	batch_job_t *job = (batch_job_t *)item;
+
+	if(!job)
+		return false;
+	if(ok && !write_image(job->paths[2], job->img)){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\n", job->paths[2]);
+		ok = false;
+	}
+	if(ok)
+		b->bytes += (size_t)job->img->width * job->img->height * sizeof(pixel_t);
+	free_batch_job(job);
+	return ok;
+}
+
+/***********************************************************
+ * Encode all the jobs of a manifest (batch mode) and
+ * display the throughput
+ * @param manifest the path of the manifest
+ * @param nb_threads number of threads encoding an image
+ * @param fmt layout of the payloads (see format.h)
+ * @param pin true to pin the threads on the processors
+ * @return EXIT_SUCCESS if no job failed
+ ***********************************************************/
+int batch_encode(char *manifest, int nb_threads, format_t fmt, bool pin){
+	struct timespec start, end;
+	stages_t stages = { batch_load, batch_process, batch_store };
+	batch_t b = { .nb_threads = nb_threads, .fmt = fmt, .pin = pin, .bytes = 0 };
+	int nb_jobs;
+
+    if(nb_threads <= 0){
+        fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+    }
+	b.jobs = read_manifest(manifest, 3, &nb_jobs);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int nb_failed = run_pipeline(&stages, &b, nb_jobs, BATCH_DEPTH);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d images encoded (%d failed) in %.3f s: %.1f images/s, %.1f MB/s\n",
+	       nb_jobs - nb_failed, nb_failed, seconds,
+	       (nb_jobs - nb_failed) / seconds, b.bytes / 1e6 / seconds);
+
+	free_manifest(b.jobs, nb_jobs, 3);
+	return nb_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 /***********************************************************
  * Display the program's syntaxe.
  * @param argv program's command line arguments
  ***********************************************************/
 void usage(char **argv){
 	fprintf(stderr, "\nNumber of arguments is invalid\n\n"\
-        "usage: %s text_file input_image output_image thread_count\n"\
-		"       where input_image and output_image are PPM files\n"\
-		"       and thread_count the number of threads to use.\n", basename(argv[0]));
+        "usage: %s [-c] [-z] [-P] [-K key] [-k lsb_count] [-s symbol_bits] [-m memory_budget] [--stats[=file]]\n"\
+        "          text_file input_image output_image thread_count\n"\
+        "       %s -i [-c] [-z] [-P] [-k lsb_count] [-s symbol_bits] [--stats[=file]] text_file image thread_count\n"\
+        "       %s [-c] [-z] [-P] [-K key] [-k lsb_count] [-s symbol_bits] [--stats[=file]] -b manifest thread_count\n"\
+        "       %s -a [-c] [-P] [-K key] [-k lsb_count] [--stats[=file]] input_image output_image thread_count file...\n"\
+        "       %s -M [-c] [-P] [-K key] [-k lsb_count] [-s symbol_bits] [--stats[=file]]\n"\
+        "          text_file images output_dir thread_count\n"\
+		"       where input_image and output_image are PPM or PNG files (PNG if\n"\
+		"       output_image ends with .png; -m, -p and -i need binary PPM files)\n"\
+		"       and thread_count the number of threads to use, or auto to let a\n"\
+		"       cost model choose it (up to the number of processors).\n"\
+		"       -k stores lsb_count (1 to %d) bits per component (default 1).\n"\
+		"       -s stores symbols of symbol_bits (7 or 8) bits (default 7);\n"\
+		"          8 allows any byte in text_file.\n"\
+		"       -z compresses text_file before encoding it (implies -s 8).\n"\
+		"       -c records the checksum of the text, checked by decode.\n"\
+		"       -P pins each thread on a processor.\n"\
+		"       -K scatters the text over the image with key (needed to decode it);\n"\
+		"          -m, -p and -i cannot be used with it.\n"\
+		"       -p only writes the changed components into a copy of input_image\n"\
+		"          and -i into image itself (binary images only).\n"\
+		"       -m streams the image by bands using at most memory_budget\n"\
+		"          bytes (K, M or G suffix allowed); input_image must be binary.\n"\
+		"       -b encodes every job of manifest, a job per line being made of\n"\
+		"          text_file input_image output_image.\n"\
+		"       -a packs the files into a container (implies -s 8), from which\n"\
+		"          decode -e extracts a file by its name; -c records the checksum\n"\
+		"          of each file. -z, -m, -p, -i and -b cannot be used with it.\n"\
+		"       -M cuts text_file over a set of images, filled in their order,\n"\
+		"          images being a directory (its PPM and PNG files, by name) or a\n"\
+		"          file listing the images, one per line; the images are written\n"\
+		"          into output_dir. -z, -a, -m, -p, -i and -b cannot be used with it.\n"\
+		"       --stats writes the timings of the run as JSON on stderr or in file.\n",
+		basename(argv[0]), basename(argv[0]), basename(argv[0]), basename(argv[0]), basename(argv[0]), MAX_LSB);
 	exit(EXIT_FAILURE);
 }
 
@@ -131,24 +924,138 @@ void usage(char **argv){
  ****************************************************/
 int main(int argc, char **argv){	
     // Parse command line
-	if(argc != NB_ARG + 1)
+	size_t budget = 0;
+	char *manifest = NULL;
+	format_t fmt = DEFAULT_FORMAT;
+	bool patch = false, in_place = false, compress = false, pin = false, sharded = false;
+	stats_t *stats = NULL;
+	FILE *stats_file = stderr;
+	struct option long_options[] = {{"stats", optional_argument, NULL, 'S'}, {NULL, 0, NULL, 0}};
+	int opt;
+	while((opt = getopt_long(argc, argv, "m:b:k:s:K:pizcPaM", long_options, NULL)) != -1){
+		switch(opt){
+			case 'K':
+				fmt.keyed = true;
+				fmt.key = parse_key(optarg);
+				break;
+			case 'z':
+				compress = true;
+				break;
+			case 'a':
+				fmt.container = true;
+				fmt.sym_bits = 8;
+				break;
+			case 'M':
+				sharded = true;
+				break;
+			case 'c':
+				fmt.checked = true;
+				break;
+			case 'P':
+				pin = true;
+				break;
+			case 'p':
+				patch = true;
+				break;
+			case 'i':
+				in_place = true;
+				break;
+			case 'S':
+				stats = create_stats("encode");
+				if(optarg && !(stats_file = fopen(optarg, "w"))){
+					fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\nExiting now...\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'k':
+				fmt.nb_lsb = atoi(optarg);
+				break;
+			case 's':
+				fmt.sym_bits = atoi(optarg);
+				break;
+			case 'b':
+				manifest = optarg;
+				break;
+			case 'm':
+				budget = parse_size(optarg);
+				if(!budget)
+					usage(argv);
+				break;
+			default:
+				usage(argv);
+		}
+	}
+	if(compress){
+		fmt.codec = CODEC_LZ;
+		fmt.sym_bits = 8;
+	}
+	if(!is_valid_format(fmt) || ((fmt.keyed || fmt.container) && (budget || patch || in_place)) ||
+	   ((fmt.container || sharded) && manifest) ||
+	   (sharded && (compress || fmt.container || budget || patch || in_place)))
 		usage(argv);
-	char *filename=argv[1];
-	char *input=argv[2];
-	char *output=argv[3];
-	int nb_threads = atoi(argv[4]);
+	if(manifest){
+		if(argc - optind != NB_ARG_BATCH || patch || in_place)
+			usage(argv);
+		begin_phase(stats, "batch");
+		int ret = batch_encode(manifest, parse_threads(argv[optind]), fmt, pin);
+		end_phase(stats, 0);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return ret;
+	}
+	if(in_place){
+		if(argc - optind != NB_ARG - 1 || budget || patch)
+			usage(argv);
+		patch_encode(argv[optind], argv[optind + 1], NULL, parse_threads(argv[optind + 2]), fmt, pin, stats);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return EXIT_SUCCESS;
+	}
+	if(fmt.container ? argc - optind < NB_ARG : argc - optind != NB_ARG || (patch && budget))
+		usage(argv);
+	// A container has no text file, its files following the other arguments
+	int first = fmt.container ? optind - 1 : optind;
+	char *filename = fmt.container ? NULL : argv[first];
+	char *input=argv[first + 1];
+	char *output=argv[first + 2];
+	int nb_threads = parse_threads(argv[first + 3]);
+
+	if(sharded){
+		int ret = shard_encode(filename, input, output, nb_threads, fmt, pin, stats);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return ret;
+	}
+	if(patch){
+		patch_encode(filename, input, output, nb_threads, fmt, pin, stats);
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return EXIT_SUCCESS;
+	}
+	if(budget){
+		begin_phase(stats, "stream");
+		stream_encode(filename, input, output, nb_threads, budget, fmt);
+		end_phase(stats, fsize(filename));
+		write_stats(stats, stats_file);
+		free_stats(stats);
+		return EXIT_SUCCESS;
+	}
     
-	float interval;
 	img_t *img;
 	char  *text;
-   	char  *text_cut;
     
     // Load the image, see the max char that it can contains..
-	img = load_ppm(input);
-	uint max_char = max_char_encode(img);
-   	uint nb_char = fsize(filename);
-    //.. and compare it to the number of chars in the text 
-	if (nb_char > max_char){
+	begin_phase(stats, "load");
+	img = load_image(input);
+	if (!img){
+		fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", input);
+		exit(EXIT_FAILURE);
+	}
+	end_phase(stats, (size_t)img->width * img->height * sizeof(pixel_t));
+	uint max_char = max_char_encode(img, fmt);
+   	uint nb_char = filename ? fsize(filename) : 0;
+    //.. and compare it to the number of chars in the text (once compressed)
+	if (fmt.codec == CODEC_NONE && nb_char > max_char){
 		fprintf(stderr,"TEXT TOO LONG FOR THIS IMAGE\nExiting now...\n");
 		exit(EXIT_FAILURE);
 	}
@@ -159,64 +1066,46 @@ int main(int argc, char **argv){
 		exit(EXIT_FAILURE);
     }
     
-    // Check if there is more threads thans char in the text and allocate memory
-	if(nb_threads > (int)nb_char)
-        nb_threads = nb_char;
-	pthread_t *threads = my_malloc(nb_threads * sizeof(pthread_t));
-	param_t   *threads_param = my_malloc(nb_threads * sizeof(param_t));
-	char      *nb_char_header = my_calloc(BYTES_HEADER_CHAR + 1, sizeof(char));
-	
-    // Write in the first pixels the number of chars of the text
-	int_to_bin_str(nb_char, nb_char_header, BYTES_HEADER_CHAR);
-	write_nb_char_in_img(nb_char_header, &img);
-    free(nb_char_header);
-    
-    // Convert the file text to a string
-	file_to_str(filename, nb_char, &text);
-    
-    // Get the general (float) interval of each text cut
-	interval = (float)nb_char / (float)nb_threads;
-    
-    // Threads launching loop
-	for (int i = 0; i < nb_threads; i++){
-        // Get the "real" interval and limits
-		int min = round(interval * i) + 0;
-		int char_in_interval = round(interval * (i + 1)) - min;
-		text_cut = my_calloc(char_in_interval + 1, sizeof(char));
-        
-        // Cut the text
-        memcpy(text_cut, text + min, char_in_interval);
-        
-        // Assign the threads arguments
-        threads_param[i].limit = get_limits(min);
-        threads_param[i].text_cut = text_cut;
-        threads_param[i].img_out = &img;
+    // Map the text file (the threads encode parts of it, without copying them),
+    // or pack the files of a container
+	bool mapped = false;
+	if(fmt.container){
+		text = pack_files(argv + first + 4, argc - first - 4, nb_threads, fmt.checked, stats, &nb_char);
+		if(nb_char > max_char){
+			fprintf(stderr,"TEXT TOO LONG FOR THIS IMAGE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+	}else{
+		begin_phase(stats, "read_text");
+		text = load_file(filename, nb_char, &mapped);
+		end_phase(stats, nb_char);
+	}
 
-        // Create thread and check for fail
-        if (pthread_create(&threads[i], NULL, thread, &threads_param[i]) != 0){
-            fprintf(stderr, "pthread_create failed!\n");
-            exit(0);
-        }
+	const char *payload = text;
+	char *packed = compress_text(&payload, &nb_char, &fmt, nb_threads, stats);
+	if (packed && nb_char > max_char_encode(img, fmt)){
+		fprintf(stderr,"TEXT TOO LONG FOR THIS IMAGE\nExiting now...\n");
+		exit(EXIT_FAILURE);
 	}
-    free(text);
-    
-    // Threads "waiting" loop
-	for (int i = 0; i < nb_threads; i++){
-        pthread_join(threads[i], NULL);
-    }
+
+    // Encode it with the threads
+	nb_threads = encode_threads(img, payload, nb_char, nb_threads, fmt, pin, stats);
+    release_file(text, packed ? fmt.raw_len : nb_char, mapped);
+    free(packed);
     
     printf("%u threads were used\n", nb_threads);
     
     // Write image
-    if(!write_ppm(output, img, PPM_BINARY)){
+	begin_phase(stats, "write");
+    if(!write_image(output, img)){
 		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE\nExiting now...\n");
         free_img(img);
 		exit(EXIT_FAILURE);
     }
+	end_phase(stats, (size_t)img->width * img->height * sizeof(pixel_t));
     
     free_img(img);
-    free(text_cut);
-    free(threads_param);
-    free(threads);
+	write_stats(stats, stats_file);
+	free_stats(stats);
 	return EXIT_SUCCESS;
 }
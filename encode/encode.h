@@ -0,0 +1,19 @@
+/************************************************************************************
+ * @file encode.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Multi-threaded encoding of encode.c, used by its other modes
+ ***********************************************************************************/
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stdbool.h>
+#include "encode_lib.h"
+#include "../libs/stats.h"
+
+extern const int BATCH_DEPTH;
+
+int encode_threads(img_t *img, const char *text, uint nb_char, int nb_threads, format_t fmt, bool pin,
+                   stats_t *stats);
+
+#endif
@@ -4,6 +4,8 @@
  * @date 29 oct 2017
  * @brief Routines used by the main encode file
  ***********************************************************************************/
+#define _GNU_SOURCE
+#include <sched.h>
 #include "encode_lib.h"
 
 /***********************************************************
@@ -71,4 +73,108 @@ void write_nb_char_in_img(char *nb_char, img_t **img_out){
 
 	for (uint8_t i = 0; i < strlen(nb_char); i++)
 		*(rgb+i) = encode_char(*(rgb+i), nb_char[i]);
-}
\ No newline at end of file
+}
+
+/***********************************************************
+ * Encode a range of bits of a text into consecutive
+ * components (the bits of a symbol go from the highest
+ * to the lowest, as in the encoding threads)
+ * @param comp pointer to the component receiving the first bit
+ * @param text pointer to the symbol holding the first bit
+ * @param first_bit position of the first bit from text[0]
+ *                  (0 for the highest bit of text[0])
+ * @param nb_bits number of bits to encode
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+void encode_bits(uint8_t *comp, const char *text, size_t first_bit, size_t nb_bits, format_t fmt){
+	spread_bits(comp, text, first_bit, nb_bits, fmt.nb_lsb, fmt.sym_bits);
+}
+
+/***********************************************************
+ * The maximum of chars that can fit in a picture
+ * @param img a pointer to the image to read
+ * @param fmt layout of the payload (see format.h)
+ * @return the maximum of chars that can fit in a picture
+ ***********************************************************/
+uint max_char_encode(img_t *img, format_t fmt){
+	return max_symbols((size_t)img->height * img->width * sizeof(pixel_t), fmt);
+}
+
+/***********************************************************
+ * Encode a whole text (number of chars and chars) into an
+ * image, without threads
+ * @param img a pointer to the image to write
+ * @param text the text to encode
+ * @param nb_char number of chars of the text, which must
+ *                fit in the image (see max_char_encode)
+ * @param fmt layout of the payload (see format.h)
+ ***********************************************************/
+void encode_text(img_t *img, const char *text, uint nb_char, format_t fmt){
+	uint8_t *rgb = &img->raw[0].r;
+
+	write_header(rgb, 0, header_size(fmt), nb_char, fmt);
+	encode_bits(rgb + payload_offset(fmt), text, 0, (size_t)nb_char * fmt.sym_bits, fmt);
+}
+/***********************************************************
+ * Cut a payload in parts of whole cache lines of components
+ * (from their address), so that two threads never write in
+ * the same line: the first part starts at the first
+ * component of the payload and the last one ends with it.
+ * A symbol may straddle two parts, each one encoding its
+ * own bits of it.
+ * @param payload pointer to the first component of the
+ *                payload
+ * @param nb_bits number of bits of the symbols
+ * @param nb_lsb number of lowest bits used per component
+ * @param nb_parts number of parts wanted
+ * @param parts receives the parts (nb_parts at most)
+ * @return the number of parts, at least 1
+ ***********************************************************/
+int split_lines(const uint8_t *payload, size_t nb_bits, int nb_lsb, int nb_parts, line_part_t *parts){
+	size_t nb_comp = (nb_bits + nb_lsb - 1) / nb_lsb;
+
+    // Components before the first line boundary, then number of whole lines after it
+	size_t head = (CACHE_LINE - (uintptr_t)payload % CACHE_LINE) % CACHE_LINE;
+	size_t nb_lines = nb_comp > head ? (nb_comp - head + CACHE_LINE - 1) / CACHE_LINE : 0;
+	if(nb_parts > (int)nb_lines)
+		nb_parts = nb_lines ? nb_lines : 1;
+
+	size_t begin = 0;
+	for (int i = 0; i < nb_parts; i++){
+		size_t end = i == nb_parts - 1 ? nb_comp : head + nb_lines * (i + 1) / nb_parts * CACHE_LINE;
+		size_t end_bit = end * nb_lsb < nb_bits ? end * nb_lsb : nb_bits;
+		parts[i].first_comp = begin;
+		parts[i].first_bit = begin * nb_lsb;
+		parts[i].nb_bits = end_bit - parts[i].first_bit;
+		begin = end;
+	}
+	return nb_parts;
+}
+
+/***********************************************************
+ * Pin the calling thread on a processor, so that it stays
+ * next to the pages it touches first (on NUMA machines, a
+ * page is allocated on the node of the thread touching it
+ * first)
+ * @param index index of the thread, the threads being
+ *              spread over the processors allowed for the
+ *              process in turn
+ * @return false if the thread cannot be pinned
+ ***********************************************************/
+bool pin_thread(int index){
+	cpu_set_t allowed, set;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return false;
+	int nb_cpus = CPU_COUNT(&allowed);
+	if(nb_cpus == 0)
+		return false;
+	for (int cpu = 0, n = index % nb_cpus; cpu < CPU_SETSIZE; cpu++){
+		if(CPU_ISSET(cpu, &allowed) && n-- == 0){
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			return sched_setaffinity(0, sizeof(set), &set) == 0;
+		}
+	}
+	return false;
+}
@@ -9,12 +9,35 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <math.h>
 #include "../libs/ppm.h"
+#include "../libs/bitplane.h"
+#include "../libs/format.h"
 
-#define BITS_PER_CHAR 7
+#define CACHE_LINE 64
+
+/***********************************************************
+ * Part of a payload given to a thread: whole cache lines of
+ * components (see split_lines)
+ * @param first_comp index of its first component, from the
+ *                   first component of the payload
+ * @param first_bit position of its first bit in the bits of
+ *                  the symbols
+ * @param nb_bits number of bits of the part
+ ***********************************************************/
+typedef struct line_part_st {
+	size_t first_comp;
+	size_t first_bit;
+	size_t nb_bits;
+} line_part_t;
 
 void decode_char(char a, char* b);
 uint8_t encode_char(uint8_t rgb, char c);
 uint8_t encode_int(uint8_t rgb, uint8_t b);
 char *int_to_bin_str(int a, char *buffer, int buf_size);
-void write_nb_char_in_img(char *nb_char, img_t **img_out);
\ No newline at end of file
+void write_nb_char_in_img(char *nb_char, img_t **img_out);
+void encode_bits(uint8_t *comp, const char *text, size_t first_bit, size_t nb_bits, format_t fmt);
+uint max_char_encode(img_t *img, format_t fmt);
+void encode_text(img_t *img, const char *text, uint nb_char, format_t fmt);
+int split_lines(const uint8_t *payload, size_t nb_bits, int nb_lsb, int nb_parts, line_part_t *parts);
+bool pin_thread(int index);
@@ -0,0 +1,211 @@
+/************************************************************************************
+ * @file shard.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Encoding of a text cut over a set of images
+ *
+ * The images of the set are filled to their capacity in their order, the header
+ * of each one recording the identifier of the set, the index of the shard and
+ * its position in the text (see format.h). The images then go through a
+ * pipeline (see pipeline.h): while a shard is encoded, the next image is read
+ * and the previous one is written.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shard.h"
+#include "encode.h"
+#include "../libs/alloc.h"
+#include "../libs/files.h"
+#include "../libs/pipeline.h"
+#include "../libs/png.h"
+
+/***********************************************************
+ * A shard of the text going through the pipeline of the
+ * multi-carrier mode
+ * @param input the carrier image
+ * @param output the image written
+ * @param img the image, once loaded
+ * @param fmt layout of the shard, giving its index and its
+ *            position in the text (see format.h)
+ * @param nb_char number of chars of the shard
+ ***********************************************************/
+typedef struct shard_st{
+	char *input;
+	char *output;
+	img_t *img;
+	format_t fmt;
+	uint nb_char;
+} shard_t;
+
+/***********************************************************
+ * Context of the multi-carrier mode
+ * @param shards the shards, by index
+ * @param text the whole text (mapped, not copied)
+ * @param nb_threads number of threads encoding an image
+ * @param pin true to pin the threads on the processors
+ * @param bytes number of bytes of the images encoded
+ ***********************************************************/
+typedef struct shard_set_st{
+	shard_t *shards;
+	const char *text;
+	int nb_threads;
+	bool pin;
+	size_t bytes;
+} shard_set_t;
+
+/***********************************************************
+ * Load stage of the multi-carrier mode: read the image
+ * @param ctx see the struct shard_set_t
+ * @param index index of the shard
+ * @return the shard (see the struct shard_t) or NULL
+ ***********************************************************/
+static void *shard_load(void *ctx, int index){
+	shard_set_t *set = (shard_set_t *)ctx;
+	shard_t *shard = &set->shards[index];
+
+	shard->img = load_image(shard->input);
+	if(!shard->img || shard->nb_char > max_char_encode(shard->img, shard->fmt)){
+		fprintf(stderr, "SHARD %d: CANNOT READ THE INPUT IMAGE %s\n", index + 1, shard->input);
+		if(shard->img)
+			free_img(shard->img);
+		return NULL;
+	}
+	populate_img(shard->img);
+	return shard;
+}
+
+/***********************************************************
+ * Process stage of the multi-carrier mode: encode the shard
+ * @param ctx see the struct shard_set_t
+ * @param item the shard (see the struct shard_t)
+ * @return true
+ ***********************************************************/
+static bool shard_process(void *ctx, void *item){
+	shard_set_t *set = (shard_set_t *)ctx;
+	shard_t *shard = (shard_t *)item;
+
+	encode_threads(shard->img, set->text + shard->fmt.shard_offset, shard->nb_char, set->nb_threads, shard->fmt,
+	               set->pin, NULL);
+	return true;
+}
+
+/***********************************************************
+ * Store stage of the multi-carrier mode: write the image
+ * @param ctx see the struct shard_set_t
+ * @param item the shard (see the struct shard_t) or NULL
+ * @param ok false if a previous stage failed
+ * @return false if the image cannot be written
+ ***********************************************************/
+static bool shard_store(void *ctx, void *item, bool ok){
+	shard_set_t *set = (shard_set_t *)ctx;
+	shard_t *shard = (shard_t *)item;
+
+	if(!shard)
+		return false;
+	if(ok && !write_image(shard->output, shard->img)){
+		fprintf(stderr, "ERROR CREATING THE OUTPUT FILE %s\n", shard->output);
+		ok = false;
+	}
+	if(ok)
+		set->bytes += (size_t)shard->img->width * shard->img->height * sizeof(pixel_t);
+	free_img(shard->img);
+	shard->img = NULL;
+	return ok;
+}
+
+/***********************************************************
+ * Encode a text too long for one image over a set of
+ * images (multi-carrier mode): the images are filled to
+ * their capacity in their order, each header recording the
+ * identifier of the set, the index of the shard and its
+ * position in the text, then the images go through a
+ * pipeline (while a shard is encoded, the next image is
+ * read and the previous one is written)
+ * @param filename the text file
+ * @param images a directory or a list of the carrier images
+ *               (see list_images)
+ * @param output_dir the directory receiving the images, under
+ *                   the names of the carriers
+ * @param nb_threads number of threads encoding an image
+ * @param fmt layout of the payloads (see format.h)
+ * @param pin true to pin the threads on the processors
+ * @param stats statistics of the run, or NULL
+ * @return EXIT_SUCCESS if no image failed
+ ***********************************************************/
+int shard_encode(char *filename, char *images, char *output_dir, int nb_threads, format_t fmt, bool pin,
+                 stats_t *stats){
+	stages_t stages = { shard_load, shard_process, shard_store };
+	shard_set_t set = { .nb_threads = nb_threads, .pin = pin, .bytes = 0 };
+	int nb_images, nb_shards = 0;
+
+    if(nb_threads <= 0){
+        fprintf(stderr,"NUMBERS OF THREADS MUST BE GREATER THAN ZERO\nExiting now...\n");
+		exit(EXIT_FAILURE);
+    }
+	if(mkdir(output_dir, 0777) != 0 && errno != EEXIST){
+		fprintf(stderr, "CANNOT CREATE THE DIRECTORY %s\nExiting now...\n", output_dir);
+		exit(EXIT_FAILURE);
+	}
+	char ***list = list_images(images, &nb_images);
+	size_t nb_char = fsize(filename), offset = 0;
+	set.shards = my_calloc(nb_images ? nb_images : 1, sizeof(shard_t));
+
+    // A new identifier for the set, then the shards in the order of the images,
+    // each one as long as the image allows (the images too small are skipped)
+	fmt.sharded = true;
+	if(getentropy(&fmt.set_id, sizeof(fmt.set_id)) != 0)
+		fmt.set_id = time(NULL) ^ (uint32_t)getpid() << 16;
+	for (int i = 0; i < nb_images && (offset < nb_char || !nb_shards) && nb_shards < MAX_SHARDS; i++){
+		int width, height;
+		if(!image_size(list[i][0], &width, &height)){
+			fprintf(stderr, "CANNOT READ THE IMAGE %s\nExiting now...\n", list[i][0]);
+			exit(EXIT_FAILURE);
+		}
+		size_t capacity = max_symbols((size_t)width * height * sizeof(pixel_t), fmt);
+		if(!capacity)
+			continue;
+		shard_t *shard = &set.shards[nb_shards];
+		const char *name = strrchr(list[i][0], '/') ? strrchr(list[i][0], '/') + 1 : list[i][0];
+		shard->input = list[i][0];
+		shard->output = my_malloc(strlen(output_dir) + strlen(name) + 2);
+		sprintf(shard->output, "%s/%s", output_dir, name);
+		shard->nb_char = nb_char - offset < capacity ? nb_char - offset : capacity;
+		shard->fmt = fmt;
+		shard->fmt.seq = nb_shards++;
+		shard->fmt.shard_offset = offset;
+		offset += shard->nb_char;
+		if(offset > UINT32_MAX)
+			break;
+	}
+	if(offset < nb_char || offset > UINT32_MAX || !nb_shards){
+		fprintf(stderr,"TEXT TOO LONG FOR THESE IMAGES\nExiting now...\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < nb_shards; i++)
+		set.shards[i].fmt.nb_shards = nb_shards;
+
+    // The threads of every shard encode their part of the mapped text
+	bool mapped;
+	begin_phase(stats, "read_text");
+	char *text = load_file(filename, nb_char, &mapped);
+	set.text = text;
+	end_phase(stats, nb_char);
+
+	begin_phase(stats, "shards");
+	int nb_failed = run_pipeline(&stages, &set, nb_shards, BATCH_DEPTH);
+	end_phase(stats, nb_char);
+	printf("%d shards of set %08x written into %s (%d failed), %zu bytes of images\n", nb_shards, fmt.set_id,
+	       output_dir, nb_failed, set.bytes);
+
+	release_file(text, nb_char, mapped);
+	for (int i = 0; i < nb_shards; i++)
+		free(set.shards[i].output);
+	free(set.shards);
+	free_manifest(list, nb_images, 1);
+	return nb_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+/************************************************************************************
+ * @file shard.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Encoding of a text cut over a set of images
+ ***********************************************************************************/
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+#include "../libs/format.h"
+#include "../libs/stats.h"
+
+int shard_encode(char *filename, char *images, char *output_dir, int nb_threads, format_t fmt, bool pin,
+                 stats_t *stats);
+
+#endif
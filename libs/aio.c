@@ -0,0 +1,475 @@
+/************************************************************************************
+ * @file aio.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 16 Dec 2017
+ * @brief Asynchronous reads and writes of files, with io_uring or I/O threads
+ *
+ * A queue takes up to depth requests (read or write of a buffer at an offset of
+ * a file) at the same time, each one given back by aio_complete once the whole
+ * buffer is transferred, in any order.
+ *
+ * The requests go to the kernel through an io_uring (called with the raw system
+ * calls, without liburing): the device gets all of them at once, while the
+ * calling thread goes on. If io_uring is not available (forbidden by a sandbox,
+ * or a kernel older than 5.6, which has no read and write operations, see
+ * probe_ring) or the STEG_AIO variable is "threads", AIO_THREADS threads do the
+ * requests with pread and pwrite instead.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "aio.h"
+
+#define AIO_THREADS 2
+#define MAX_TRANSFER (1u << 30)
+#define PROBE_OPS 256
+
+/***********************************************************
+ * A request of a queue
+ * @param write true for a write, false for a read
+ * @param fd the file
+ * @param buf the buffer
+ * @param len number of bytes to transfer
+ * @param offset position of the first byte in the file
+ * @param done number of bytes already transferred
+ * @param tag given back by aio_complete
+ * @param used true while the request is in the queue
+ * @param ok false if the transfer failed
+ ***********************************************************/
+typedef struct request_st {
+	bool write;
+	int fd;
+	char *buf;
+	size_t len;
+	off_t offset;
+	size_t done;
+	void *tag;
+	bool used;
+	bool ok;
+} request_t;
+
+/***********************************************************
+ * The rings shared with the kernel (see io_uring_setup(2))
+ * @param fd the io_uring
+ * @param sq_ring mapping of the submission ring
+ * @param sq_size size of the mapping
+ * @param cq_ring mapping of the completion ring (may be the
+ *                same as sq_ring)
+ * @param cq_size size of the mapping
+ * @param sqes mapping of the submission entries
+ * @param sqes_size size of the mapping
+ * @param sq_head, sq_tail, sq_mask, sq_array fields of the
+ *                 submission ring
+ * @param cq_head, cq_tail, cq_mask, cqes fields of the
+ *                 completion ring
+ ***********************************************************/
+typedef struct uring_st {
+	int fd;
+	void *sq_ring;
+	size_t sq_size;
+	void *cq_ring;
+	size_t cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+} uring_t;
+
+/***********************************************************
+ * A queue of requests
+ * @param requests the requests, depth of them
+ * @param depth maximum number of requests in the queue
+ * @param nb_pending number of requests in the queue
+ * @param has_ring true if the io_uring is used, false for
+ *                 the I/O threads
+ * @param ring the io_uring
+ * @param threads the I/O threads
+ * @param lock protects the lists of the I/O threads
+ * @param submitted signaled when a request is submitted
+ * @param completed signaled when a request is done
+ * @param todo circular list of the requests to do (index)
+ * @param todo_first first request of todo
+ * @param todo_count number of requests in todo
+ * @param done circular list of the requests done (index)
+ * @param done_first first request of done
+ * @param done_count number of requests in done
+ * @param stop true when the I/O threads must end
+ ***********************************************************/
+struct aio_st {
+	request_t *requests;
+	int depth;
+	int nb_pending;
+	bool has_ring;
+	uring_t ring;
+	pthread_t threads[AIO_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t submitted;
+	pthread_cond_t completed;
+	int *todo;
+	int todo_first;
+	int todo_count;
+	int *done;
+	int done_first;
+	int done_count;
+	bool stop;
+};
+
+/***********************************************************
+ * Unmap the rings of an io_uring and close it
+ * @param r the io_uring
+ ***********************************************************/
+static void close_ring(uring_t *r){
+	if(r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if(r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_size);
+	if(r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_size);
+	close(r->fd);
+}
+
+/***********************************************************
+ * Check that an io_uring does the reads and writes of the
+ * queues (IORING_OP_READ and IORING_OP_WRITE, Linux 5.6,
+ * like the probe itself: an older kernel fails the probe)
+ * @param r the io_uring
+ * @return false if the kernel does not support them
+ ***********************************************************/
+static bool probe_ring(uring_t *r){
+	struct io_uring_probe *probe = calloc(1, sizeof(*probe) + PROBE_OPS * sizeof(struct io_uring_probe_op));
+	bool ok = probe && syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) == 0 &&
+	          probe->last_op >= IORING_OP_READ && probe->last_op >= IORING_OP_WRITE &&
+	          (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+	          (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return ok;
+}
+
+/***********************************************************
+ * Create an io_uring and map its rings
+ * @param r receives the io_uring
+ * @param depth number of entries of the rings
+ * @return false if io_uring is not available, or cannot do
+ *         the reads and writes (see probe_ring)
+ ***********************************************************/
+static bool open_ring(uring_t *r, int depth){
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, depth, &p);
+	if(r->fd < 0)
+		return false;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_size = r->cq_size = r->sq_size > r->cq_size ? r->sq_size : r->cq_size;
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sq_ring = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+	                  IORING_OFF_SQ_RING);
+	r->cq_ring = p.features & IORING_FEAT_SINGLE_MMAP ? r->sq_ring :
+	             mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+	                  IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+	               IORING_OFF_SQES);
+	if(r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED || !probe_ring(r)){
+		close_ring(r);
+		return false;
+	}
+
+	r->sq_head = (unsigned *)((char *)r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+	return true;
+}
+
+/***********************************************************
+ * Give the rest of a request to the kernel
+ * @param q the queue
+ * @param index index of the request
+ * @return false if the request cannot be submitted
+ ***********************************************************/
+static bool push_ring(aio_t *q, int index){
+	uring_t *r = &q->ring;
+	request_t *req = &q->requests[index];
+	unsigned tail = *r->sq_tail;
+	unsigned slot = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[slot];
+	size_t len = req->len - req->done;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = req->fd;
+	sqe->addr = (uintptr_t)(req->buf + req->done);
+	sqe->len = len < MAX_TRANSFER ? len : MAX_TRANSFER;
+	sqe->off = req->offset + req->done;
+	sqe->user_data = index;
+	r->sq_array[slot] = slot;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	long ret;
+	do
+		ret = syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0);
+	while(ret < 0 && errno == EINTR);
+
+    // An entry the kernel did not take is taken back, so that a later call does
+    // not submit it once the request is reused
+	if(ret != 1 && __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == tail)
+		__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+	return ret == 1;
+}
+
+/***********************************************************
+ * Wait for a request given to the kernel to be done, the
+ * short transfers being submitted again for the rest
+ * @param q the queue
+ * @return the index of the request, -1 if waiting failed
+ ***********************************************************/
+static int pop_ring(aio_t *q){
+	uring_t *r = &q->ring;
+
+	for (;;){
+		unsigned head = *r->cq_head;
+		if(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)){
+			if(syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+			   errno != EINTR)
+				return -1;
+			continue;
+		}
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		int index = cqe->user_data;
+		int res = cqe->res;
+		__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+		request_t *req = &q->requests[index];
+		if(res > 0)
+			req->done += res;
+		req->ok = res >= 0 && req->done == req->len;
+		if(res > 0 && req->done < req->len && push_ring(q, index))
+			continue;
+		return index;
+	}
+}
+
+/***********************************************************
+ * Do a request with pread or pwrite
+ * @param req the request
+ * @return false if the transfer failed
+ ***********************************************************/
+static bool transfer(request_t *req){
+	while(req->done < req->len){
+		ssize_t ret = req->write ?
+		              pwrite(req->fd, req->buf + req->done, req->len - req->done, req->offset + req->done) :
+		              pread(req->fd, req->buf + req->done, req->len - req->done, req->offset + req->done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return false;
+		req->done += ret;
+	}
+	return true;
+}
+
+/***********************************************************
+ * I/O thread doing the requests of the todo list
+ * @param param the queue
+ * @return NULL
+ ***********************************************************/
+static void *io_thread(void *param){
+	aio_t *q = param;
+
+	pthread_mutex_lock(&q->lock);
+	for (;;){
+		while(!q->stop && q->todo_count == 0)
+			pthread_cond_wait(&q->submitted, &q->lock);
+		if(q->todo_count == 0)
+			break;
+		int index = q->todo[q->todo_first];
+		q->todo_first = (q->todo_first + 1) % q->depth;
+		q->todo_count--;
+		pthread_mutex_unlock(&q->lock);
+
+		q->requests[index].ok = transfer(&q->requests[index]);
+
+		pthread_mutex_lock(&q->lock);
+		q->done[(q->done_first + q->done_count++) % q->depth] = index;
+		pthread_cond_signal(&q->completed);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/***********************************************************
+ * Create a queue of requests
+ * @param depth maximum number of requests in the queue
+ * @return the queue, or NULL if it cannot be created
+ ***********************************************************/
+aio_t *aio_create(int depth){
+	aio_t *q = calloc(1, sizeof(aio_t));
+	if(!q)
+		return NULL;
+	q->depth = depth;
+	q->requests = calloc(depth, sizeof(request_t));
+	q->todo = calloc(depth, sizeof(int));
+	q->done = calloc(depth, sizeof(int));
+	if(!q->requests || !q->todo || !q->done){
+		aio_destroy(q);
+		return NULL;
+	}
+
+	const char *forced = getenv("STEG_AIO");
+	if(!(forced && strcmp(forced, "threads") == 0))
+		q->has_ring = open_ring(&q->ring, depth);
+	if(q->has_ring)
+		return q;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->submitted, NULL);
+	pthread_cond_init(&q->completed, NULL);
+	for (int i = 0; i < AIO_THREADS; i++){
+		if(pthread_create(&q->threads[i], NULL, io_thread, q) != 0){
+			fprintf(stderr, "pthread_create failed!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return q;
+}
+
+/***********************************************************
+ * Name of the backend of a queue
+ * @param q the queue
+ * @return "io_uring" or "threads"
+ ***********************************************************/
+const char *aio_backend(const aio_t *q){
+	return q->has_ring ? "io_uring" : "threads";
+}
+
+/***********************************************************
+ * Allocate a buffer for the requests, aligned on AIO_ALIGN
+ * bytes (a page) so that the kernel transfers whole pages
+ * @param size size of the buffer in bytes
+ * @return the buffer (to free), or NULL if it cannot be
+ *         allocated
+ ***********************************************************/
+void *aio_alloc(size_t size){
+	void *buf;
+	size = (size + AIO_ALIGN - 1) / AIO_ALIGN * AIO_ALIGN;
+	return posix_memalign(&buf, AIO_ALIGN, size ? size : AIO_ALIGN) == 0 ? buf : NULL;
+}
+
+/***********************************************************
+ * Submit a request
+ * @param q the queue
+ * @param write true for a write, false for a read
+ * @param fd the file
+ * @param buf the buffer, which must stay until the request
+ *            is completed
+ * @param len number of bytes to transfer
+ * @param offset position of the first byte in the file
+ * @param tag given back by aio_complete with the request
+ * @return false if the queue is full or the request cannot
+ *         be submitted
+ ***********************************************************/
+bool aio_submit(aio_t *q, bool write, int fd, void *buf, size_t len, off_t offset, void *tag){
+	int index = 0;
+	while(index < q->depth && q->requests[index].used)
+		index++;
+	if(index == q->depth)
+		return false;
+	q->requests[index] = (request_t){ write, fd, buf, len, offset, 0, tag, true, false };
+
+	if(q->has_ring){
+		if(!push_ring(q, index)){
+			q->requests[index].used = false;
+			return false;
+		}
+	}else{
+		pthread_mutex_lock(&q->lock);
+		q->todo[(q->todo_first + q->todo_count++) % q->depth] = index;
+		pthread_cond_signal(&q->submitted);
+		pthread_mutex_unlock(&q->lock);
+	}
+	q->nb_pending++;
+	return true;
+}
+
+/***********************************************************
+ * Wait for a request of the queue to be completed
+ * @param q the queue
+ * @param ok receives false if the transfer failed
+ * @return the tag of the request, NULL if the queue is
+ *         empty (ok being false)
+ ***********************************************************/
+void *aio_complete(aio_t *q, bool *ok){
+	int index;
+
+	*ok = false;
+	if(q->nb_pending == 0)
+		return NULL;
+	if(q->has_ring){
+		index = pop_ring(q);
+		if(index < 0)
+			return NULL;
+	}else{
+		pthread_mutex_lock(&q->lock);
+		while(q->done_count == 0)
+			pthread_cond_wait(&q->completed, &q->lock);
+		index = q->done[q->done_first];
+		q->done_first = (q->done_first + 1) % q->depth;
+		q->done_count--;
+		pthread_mutex_unlock(&q->lock);
+	}
+	q->nb_pending--;
+	q->requests[index].used = false;
+	*ok = q->requests[index].ok;
+	return q->requests[index].tag;
+}
+
+/***********************************************************
+ * Number of requests not yet completed
+ * @param q the queue
+ * @return the number of requests
+ ***********************************************************/
+int aio_pending(const aio_t *q){
+	return q->nb_pending;
+}
+
+/***********************************************************
+ * Wait for the requests of a queue and free it
+ * @param q the queue
+ ***********************************************************/
+void aio_destroy(aio_t *q){
+	bool ok;
+	while(q->requests && q->nb_pending > 0 && aio_complete(q, &ok))
+		;
+	if(q->has_ring)
+		close_ring(&q->ring);
+	else if(q->requests && q->todo && q->done){
+		pthread_mutex_lock(&q->lock);
+		q->stop = true;
+		pthread_cond_broadcast(&q->submitted);
+		pthread_mutex_unlock(&q->lock);
+		for (int i = 0; i < AIO_THREADS; i++)
+			pthread_join(q->threads[i], NULL);
+		pthread_mutex_destroy(&q->lock);
+		pthread_cond_destroy(&q->submitted);
+		pthread_cond_destroy(&q->completed);
+	}
+	free(q->requests);
+	free(q->todo);
+	free(q->done);
+	free(q);
+}
@@ -0,0 +1,27 @@
+/************************************************************************************
+ * @file aio.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 16 Dec 2017
+ * @brief Asynchronous reads and writes of files, with io_uring or I/O threads
+ ***********************************************************************************/
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Alignment of the buffers given to the requests (see aio_alloc)
+#define AIO_ALIGN 4096
+
+typedef struct aio_st aio_t;
+
+aio_t *aio_create(int depth);
+const char *aio_backend(const aio_t *q);
+void *aio_alloc(size_t size);
+bool aio_submit(aio_t *q, bool write, int fd, void *buf, size_t len, off_t offset, void *tag);
+void *aio_complete(aio_t *q, bool *ok);
+int aio_pending(const aio_t *q);
+void aio_destroy(aio_t *q);
+
+#endif
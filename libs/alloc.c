@@ -38,4 +38,26 @@ void* my_calloc(size_t n, size_t s) {
     }else{
         return ptr;
     }
+}
+
+/***********************************************************
+ * Parse a memory size given on the command line
+ * @param str the size in bytes, optionally followed by
+ *            K, M or G (powers of 1024)
+ * @return the size in bytes or 0 if the string is invalid
+ ***********************************************************/
+size_t parse_size(const char *str) {
+    char *end;
+    unsigned long long size = strtoull(str, &end, 10);
+    if(end == str)
+        return 0;
+
+    switch(*end){
+        case 'G': case 'g': size <<= 10; // fall through
+        case 'M': case 'm': size <<= 10; // fall through
+        case 'K': case 'k': size <<= 10; end++; break;
+        case '\0': break;
+        default: return 0;
+    }
+    return *end == '\0' ? size : 0;
 }
\ No newline at end of file
@@ -9,4 +9,5 @@
 #include <errno.h>
 
 void* my_malloc(size_t bytes);
-void* my_calloc(size_t n, size_t s);
\ No newline at end of file
+void* my_calloc(size_t n, size_t s);
+size_t parse_size(const char *str);
\ No newline at end of file
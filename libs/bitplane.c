@@ -0,0 +1,512 @@
+/************************************************************************************
+ * @file bitplane.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 22 Nov 2017
+ * @brief Vectorized kernels spreading chars into the lowest bits of components
+ *
+ * Each char is stored in the lowest bit of 7 consecutive components, from its
+ * highest bit to its lowest bit. Chars out of the 7 bits range (negative chars)
+ * are stored as 0, as the original encoding loop did.
+ *
+ * The chars are processed by blocks of 64: the 64 chars of a block fill exactly
+ * 448 components, whose lowest bits are packed into 7 masks of 64 bits. The masks
+ * are then expanded into (or gathered from) the components with SSE2, AVX2 or
+ * AVX-512 instructions, the variant being chosen at startup according to CPUID.
+ * The chars that do not fill a whole block are processed one by one.
+ * The BITPLANE_KERNEL environment variable (scalar, sse2, avx2 or avx512) can be
+ * set to force a slower variant, to compare them.
+ *
+ * spread_bits and gather_bits handle any layout (1 to 4 lowest bits per
+ * component, symbols of 7 or 8 bits, see format.h) and any range of bits. The
+ * whole chars of the original layout go through the kernels above, the bytes
+ * stored in 1, 2 or 4 bits per component (which fill whole components) are done
+ * a byte at a time with a table, the other bits go through a bit accumulator.
+ ***********************************************************************************/
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitplane.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITPLANE_X86
+#endif
+
+#define BITS_PER_CHAR 7
+#define BLOCK_CHARS 64
+
+/***********************************************************
+ * Apply (or read) 7 masks of 64 lowest bits to (or from)
+ * 448 consecutive components
+ ***********************************************************/
+typedef void (*apply_masks_t)(uint8_t *comp, const uint64_t *masks);
+typedef void (*read_masks_t)(const uint8_t *comp, uint64_t *masks);
+
+// The 7 bits of a char in reverse order (first stored bit as bit 0), 0 if negative
+static uint8_t reversed[256];
+
+// The fields of a byte stored in 1, 2 or 4 bits per component, a field per byte
+static uint64_t spread_byte_1[256];
+static uint32_t spread_byte_2[256];
+static uint16_t spread_byte_4[256];
+
+/***********************************************************
+ * Generic version of the mask application
+ * @param comp pointer to the first component of the block
+ * @param masks the lowest bits of the 448 components
+ ***********************************************************/
+static void apply_masks_scalar(uint8_t *comp, const uint64_t *masks){
+	for (int w = 0; w < BITS_PER_CHAR; w++)
+		for (int i = 0; i < 64; i++, comp++)
+			*comp = (*comp & 0xFE) | ((masks[w] >> i) & 1);
+}
+
+/***********************************************************
+ * Generic version of the mask reading
+ * @param comp pointer to the first component of the block
+ * @param masks receives the lowest bits of the 448 components
+ ***********************************************************/
+static void read_masks_scalar(const uint8_t *comp, uint64_t *masks){
+	for (int w = 0; w < BITS_PER_CHAR; w++){
+		masks[w] = 0;
+		for (int i = 0; i < 64; i++, comp++)
+			masks[w] |= (uint64_t)(*comp & 1) << i;
+	}
+}
+
+#ifdef BITPLANE_X86
+/***********************************************************
+ * SSE2 version of the mask application (16 components at
+ * once, each byte of the mask being broadcast on 8 lanes)
+ ***********************************************************/
+__attribute__((target("sse2")))
+static void apply_masks_sse2(uint8_t *comp, const uint64_t *masks){
+	const __m128i select = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i high = _mm_set1_epi8((char)0xFE);
+	const __m128i one = _mm_set1_epi8(1);
+
+	for (int w = 0; w < BITS_PER_CHAR; w++){
+		uint64_t m = masks[w];
+		for (int i = 0; i < 4; i++, comp += 16, m >>= 16){
+			__m128i bytes = _mm_set_epi64x(((m >> 8) & 0xFF) * 0x0101010101010101ULL,
+			                               (m & 0xFF) * 0x0101010101010101ULL);
+			__m128i bits = _mm_cmpeq_epi8(_mm_and_si128(bytes, select), select);
+			__m128i v = _mm_loadu_si128((__m128i *)comp);
+			v = _mm_or_si128(_mm_and_si128(v, high), _mm_and_si128(bits, one));
+			_mm_storeu_si128((__m128i *)comp, v);
+		}
+	}
+}
+
+/***********************************************************
+ * SSE2 version of the mask reading
+ ***********************************************************/
+__attribute__((target("sse2")))
+static void read_masks_sse2(const uint8_t *comp, uint64_t *masks){
+	for (int w = 0; w < BITS_PER_CHAR; w++){
+		masks[w] = 0;
+		for (int i = 0; i < 4; i++, comp += 16){
+			__m128i v = _mm_slli_epi16(_mm_loadu_si128((const __m128i *)comp), 7);
+			masks[w] |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << (16 * i);
+		}
+	}
+}
+
+/***********************************************************
+ * AVX2 version of the mask application (32 components at
+ * once, each byte of the mask being shuffled on 8 lanes)
+ ***********************************************************/
+__attribute__((target("avx2")))
+static void apply_masks_avx2(uint8_t *comp, const uint64_t *masks){
+	const __m256i shuffle = _mm256_set_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+	                                        1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i select = _mm256_set1_epi64x(0x8040201008040201ULL);
+	const __m256i high = _mm256_set1_epi8((char)0xFE);
+	const __m256i one = _mm256_set1_epi8(1);
+
+	for (int w = 0; w < BITS_PER_CHAR; w++){
+		uint64_t m = masks[w];
+		for (int i = 0; i < 2; i++, comp += 32, m >>= 32){
+			__m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32((uint32_t)m), shuffle);
+			__m256i bits = _mm256_cmpeq_epi8(_mm256_and_si256(bytes, select), select);
+			__m256i v = _mm256_loadu_si256((__m256i *)comp);
+			v = _mm256_or_si256(_mm256_and_si256(v, high), _mm256_and_si256(bits, one));
+			_mm256_storeu_si256((__m256i *)comp, v);
+		}
+	}
+}
+
+/***********************************************************
+ * AVX2 version of the mask reading
+ ***********************************************************/
+__attribute__((target("avx2")))
+static void read_masks_avx2(const uint8_t *comp, uint64_t *masks){
+	for (int w = 0; w < BITS_PER_CHAR; w++){
+		masks[w] = 0;
+		for (int i = 0; i < 2; i++, comp += 32){
+			__m256i v = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)comp), 7);
+			masks[w] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << (32 * i);
+		}
+	}
+}
+
+/***********************************************************
+ * AVX-512 version of the mask application (64 components
+ * at once, the mask being used directly as a lane mask)
+ ***********************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static void apply_masks_avx512(uint8_t *comp, const uint64_t *masks){
+	const __m512i high = _mm512_set1_epi8((char)0xFE);
+
+	for (int w = 0; w < BITS_PER_CHAR; w++, comp += 64){
+		__m512i v = _mm512_and_si512(_mm512_loadu_si512(comp), high);
+		v = _mm512_mask_add_epi8(v, masks[w], v, _mm512_set1_epi8(1));
+		_mm512_storeu_si512(comp, v);
+	}
+}
+
+/***********************************************************
+ * AVX-512 version of the mask reading
+ ***********************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static void read_masks_avx512(const uint8_t *comp, uint64_t *masks){
+	const __m512i one = _mm512_set1_epi8(1);
+
+	for (int w = 0; w < BITS_PER_CHAR; w++, comp += 64)
+		masks[w] = _mm512_test_epi8_mask(_mm512_loadu_si512(comp), one);
+}
+#endif
+
+static apply_masks_t apply_masks = apply_masks_scalar;
+static read_masks_t read_masks = read_masks_scalar;
+static const char *kernel_name = "scalar";
+
+/***********************************************************
+ * Fill the table of reversed chars and choose the fastest
+ * kernels supported by the CPU (run once at startup)
+ ***********************************************************/
+__attribute__((constructor))
+static void select_kernels(void){
+	for (int c = 0; c < 128; c++)
+		for (int b = 0; b < BITS_PER_CHAR; b++)
+			reversed[c] |= ((c >> (BITS_PER_CHAR - 1 - b)) & 1) << b;
+	for (int c = 0; c < 256; c++){
+		for (int j = 0; j < 8; j++)
+			spread_byte_1[c] |= (uint64_t)((c >> (7 - j)) & 1) << (8 * j);
+		for (int j = 0; j < 4; j++)
+			spread_byte_2[c] |= (uint32_t)((c >> (6 - 2 * j)) & 3) << (8 * j);
+		for (int j = 0; j < 2; j++)
+			spread_byte_4[c] |= (uint16_t)((c >> (4 - 4 * j)) & 15) << (8 * j);
+	}
+
+	const char *forced = getenv("BITPLANE_KERNEL");
+	if (forced && strcmp(forced, "scalar") == 0)
+		return;
+
+#ifdef BITPLANE_X86
+	bool avx512 = !forced || strcmp(forced, "avx512") == 0;
+	bool avx2 = avx512 || strcmp(forced, "avx2") == 0;
+
+	__builtin_cpu_init();
+	if (avx512 && __builtin_cpu_supports("avx512bw")){
+		apply_masks = apply_masks_avx512;
+		read_masks = read_masks_avx512;
+		kernel_name = "avx512";
+	} else if (avx2 && __builtin_cpu_supports("avx2")){
+		apply_masks = apply_masks_avx2;
+		read_masks = read_masks_avx2;
+		kernel_name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")){
+		apply_masks = apply_masks_sse2;
+		read_masks = read_masks_sse2;
+		kernel_name = "sse2";
+	}
+#endif
+}
+
+/***********************************************************
+ * Store chars in the lowest bits of components
+ * @param comp pointer to the component receiving the
+ *             highest bit of the first char
+ * @param text the chars to store
+ * @param nb_char number of chars to store (7 * nb_char
+ *                components are modified)
+ ***********************************************************/
+void spread_chars(uint8_t *comp, const char *text, size_t nb_char){
+	uint64_t masks[BITS_PER_CHAR];
+
+	for (; nb_char >= BLOCK_CHARS; nb_char -= BLOCK_CHARS){
+        // Pack the 448 bits of the block, a mask being completed every 64 bits
+		uint64_t acc = 0;
+		int nb_bits = 0, w = 0;
+		for (int i = 0; i < BLOCK_CHARS; i++){
+			uint64_t bits = reversed[(uint8_t)*text++];
+			acc |= bits << nb_bits;
+			nb_bits += BITS_PER_CHAR;
+			if (nb_bits >= 64){
+				masks[w++] = acc;
+				nb_bits -= 64;
+				acc = nb_bits ? bits >> (BITS_PER_CHAR - nb_bits) : 0;
+			}
+		}
+		apply_masks(comp, masks);
+		comp += BLOCK_CHARS * BITS_PER_CHAR;
+	}
+
+    // Remaining chars
+	for (; nb_char > 0; nb_char--){
+		uint8_t bits = reversed[(uint8_t)*text++];
+		for (int b = 0; b < BITS_PER_CHAR; b++, comp++)
+			*comp = (*comp & 0xFE) | ((bits >> b) & 1);
+	}
+}
+
+/***********************************************************
+ * Read chars from the lowest bits of components
+ * @param comp pointer to the component holding the
+ *             highest bit of the first char
+ * @param text receives the chars
+ * @param nb_char number of chars to read (from
+ *                7 * nb_char components)
+ ***********************************************************/
+void gather_chars(const uint8_t *comp, char *text, size_t nb_char){
+	uint64_t masks[BITS_PER_CHAR + 1];
+
+	for (; nb_char >= BLOCK_CHARS; nb_char -= BLOCK_CHARS){
+		read_masks(comp, masks);
+		masks[BITS_PER_CHAR] = 0;
+		comp += BLOCK_CHARS * BITS_PER_CHAR;
+
+        // Unpack the 7 bits of each char, which may span two masks
+		for (int i = 0; i < BLOCK_CHARS; i++){
+			int pos = i * BITS_PER_CHAR;
+			uint64_t bits = masks[pos / 64] >> (pos % 64);
+			if (pos % 64 > 64 - BITS_PER_CHAR)
+				bits |= masks[pos / 64 + 1] << (64 - pos % 64);
+			*text++ = reversed[bits & 0x7F];
+		}
+	}
+
+    // Remaining chars
+	for (; nb_char > 0; nb_char--){
+		uint8_t bits = 0;
+		for (int b = 0; b < BITS_PER_CHAR; b++, comp++)
+			bits |= (*comp & 1) << b;
+		*text++ = reversed[bits];
+	}
+}
+
+/***********************************************************
+ * Value of a symbol stored in the payload
+ * @param c the char
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ * @return the value, 0 for a negative char of 7 bits
+ ***********************************************************/
+static inline uint8_t symbol_value(char c, int sym_bits){
+	if(sym_bits == 8)
+		return (uint8_t)c;
+	return c < 0 ? 0 : c;
+}
+
+/***********************************************************
+ * Generic version of spread_bits, with a bit accumulator
+ * (first_bit must be lower than sym_bits)
+ ***********************************************************/
+static void spread_bits_generic(uint8_t *comp, const char *text, int first_bit, size_t nb_bits,
+                                int nb_lsb, int sym_bits){
+	if(nb_bits == 0)
+		return;
+	uint32_t acc = symbol_value(*text++, sym_bits) & ((1u << (sym_bits - first_bit)) - 1);
+	int nb_acc = sym_bits - first_bit;
+
+	while(nb_bits > 0){
+		int n = nb_bits < (size_t)nb_lsb ? (int)nb_bits : nb_lsb;
+		if(nb_acc < n){
+			acc = (acc << sym_bits) | symbol_value(*text++, sym_bits);
+			nb_acc += sym_bits;
+		}
+		nb_acc -= n;
+		uint8_t mask = ((1 << n) - 1) << (nb_lsb - n);
+		uint8_t field = ((acc >> nb_acc) << (nb_lsb - n)) & mask;
+		*comp = (*comp & ~mask) | field;
+		comp++;
+		nb_bits -= n;
+	}
+}
+
+/***********************************************************
+ * Generic version of gather_bits, with a bit accumulator
+ * (first_bit must be lower than sym_bits)
+ ***********************************************************/
+static void gather_bits_generic(const uint8_t *comp, char *text, int first_bit, size_t nb_bits,
+                                int nb_lsb, int sym_bits){
+	uint32_t acc = 0;
+	int nb_acc = first_bit;
+	bool partial = first_bit > 0;
+
+	while(nb_bits > 0){
+		int n = nb_bits < (size_t)nb_lsb ? (int)nb_bits : nb_lsb;
+		acc = (acc << n) | ((*comp++ >> (nb_lsb - n)) & ((1 << n) - 1));
+		nb_acc += n;
+		nb_bits -= n;
+		if(nb_acc >= sym_bits){
+			nb_acc -= sym_bits;
+			char c = (acc >> nb_acc) & ((1 << sym_bits) - 1);
+			if(partial)
+				*text |= c;
+			else
+				*text = c;
+			text++;
+			partial = false;
+		}
+	}
+
+    // Beginning of a symbol whose end is after the range
+	if(nb_acc > 0)
+		*text |= (acc << (sym_bits - nb_acc)) & ((1 << sym_bits) - 1);
+}
+
+/***********************************************************
+ * Store whole bytes in 1, 2 or 4 lowest bits of components
+ * @param comp pointer to the component receiving the
+ *             highest bit of the first byte
+ * @param text the bytes to store
+ * @param nb_bytes number of bytes to store
+ * @param nb_lsb number of lowest bits used (1, 2 or 4)
+ ***********************************************************/
+static void spread_bytes(uint8_t *comp, const char *text, size_t nb_bytes, int nb_lsb){
+	if(nb_lsb == 1){
+		for (; nb_bytes > 0; nb_bytes--, comp += 8){
+			uint64_t v;
+			memcpy(&v, comp, 8);
+			v = (v & 0xFEFEFEFEFEFEFEFEULL) | spread_byte_1[(uint8_t)*text++];
+			memcpy(comp, &v, 8);
+		}
+	}else if(nb_lsb == 2){
+		for (; nb_bytes > 0; nb_bytes--, comp += 4){
+			uint32_t v;
+			memcpy(&v, comp, 4);
+			v = (v & 0xFCFCFCFCu) | spread_byte_2[(uint8_t)*text++];
+			memcpy(comp, &v, 4);
+		}
+	}else{
+		for (; nb_bytes > 0; nb_bytes--, comp += 2){
+			uint16_t v;
+			memcpy(&v, comp, 2);
+			v = (v & 0xF0F0u) | spread_byte_4[(uint8_t)*text++];
+			memcpy(comp, &v, 2);
+		}
+	}
+}
+
+/***********************************************************
+ * Read whole bytes from 1, 2 or 4 lowest bits of components
+ * @param comp pointer to the component holding the
+ *             highest bit of the first byte
+ * @param text receives the bytes
+ * @param nb_bytes number of bytes to read
+ * @param nb_lsb number of lowest bits used (1, 2 or 4)
+ ***********************************************************/
+static void gather_bytes(const uint8_t *comp, char *text, size_t nb_bytes, int nb_lsb){
+	if(nb_lsb == 1){
+        // The multiplication moves the lowest bit of the 8 bytes into the highest byte
+		for (; nb_bytes > 0; nb_bytes--, comp += 8){
+			uint64_t v;
+			memcpy(&v, comp, 8);
+			*text++ = ((v & 0x0101010101010101ULL) * 0x8040201008040201ULL) >> 56;
+		}
+	}else if(nb_lsb == 2){
+		for (; nb_bytes > 0; nb_bytes--, comp += 4)
+			*text++ = (comp[0] & 3) << 6 | (comp[1] & 3) << 4 | (comp[2] & 3) << 2 | (comp[3] & 3);
+	}else{
+		for (; nb_bytes > 0; nb_bytes--, comp += 2)
+			*text++ = (comp[0] & 15) << 4 | (comp[1] & 15);
+	}
+}
+
+/***********************************************************
+ * Store a range of bits of symbols in the lowest bits of
+ * components, in any layout (see format.h)
+ * @param comp pointer to the component receiving the first
+ *             bit, in the highest of its nb_lsb lowest bits
+ * @param text pointer to the symbol holding the first bit
+ * @param first_bit position of the first bit in the symbols
+ *                  (0 for the highest bit of text[0])
+ * @param nb_bits number of bits to store
+ * @param nb_lsb number of lowest bits used per component
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ ***********************************************************/
+void spread_bits(uint8_t *comp, const char *text, size_t first_bit, size_t nb_bits,
+                 int nb_lsb, int sym_bits){
+	text += first_bit / sym_bits;
+	first_bit %= sym_bits;
+
+	if((sym_bits == 8 && 8 % nb_lsb == 0) || (sym_bits == BITS_PER_CHAR && nb_lsb == 1)){
+        // End of the first byte..
+		if(first_bit > 0){
+			size_t nb = sym_bits - first_bit < nb_bits ? sym_bits - first_bit : nb_bits;
+			spread_bits_generic(comp, text++, first_bit, nb, nb_lsb, sym_bits);
+			comp += nb / nb_lsb;
+			nb_bits -= nb;
+			first_bit = 0;
+		}
+        //.. whole symbols..
+		size_t nb_sym = nb_bits / sym_bits;
+		if(sym_bits == 8)
+			spread_bytes(comp, text, nb_sym, nb_lsb);
+		else
+			spread_chars(comp, text, nb_sym);
+		comp += nb_sym * sym_bits / nb_lsb;
+		text += nb_sym;
+		nb_bits %= sym_bits;
+	}
+    //.. and the remaining bits
+	spread_bits_generic(comp, text, first_bit, nb_bits, nb_lsb, sym_bits);
+}
+
+/***********************************************************
+ * Read a range of bits of symbols from the lowest bits of
+ * components, in any layout (see format.h). The symbols
+ * partly in the range must be initialised to 0, as their
+ * bits are added; the other ones are overwritten.
+ * @param comp pointer to the component holding the first
+ *             bit, in the highest of its nb_lsb lowest bits
+ * @param text pointer to the symbol receiving the first bit
+ * @param first_bit position of the first bit in the symbols
+ *                  (0 for the highest bit of text[0])
+ * @param nb_bits number of bits to read
+ * @param nb_lsb number of lowest bits used per component
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ ***********************************************************/
+void gather_bits(const uint8_t *comp, char *text, size_t first_bit, size_t nb_bits,
+                 int nb_lsb, int sym_bits){
+	text += first_bit / sym_bits;
+	first_bit %= sym_bits;
+
+	if((sym_bits == 8 && 8 % nb_lsb == 0) || (sym_bits == BITS_PER_CHAR && nb_lsb == 1)){
+		if(first_bit > 0){
+			size_t nb = sym_bits - first_bit < nb_bits ? sym_bits - first_bit : nb_bits;
+			gather_bits_generic(comp, text++, first_bit, nb, nb_lsb, sym_bits);
+			comp += nb / nb_lsb;
+			nb_bits -= nb;
+			first_bit = 0;
+		}
+		size_t nb_sym = nb_bits / sym_bits;
+		if(sym_bits == 8)
+			gather_bytes(comp, text, nb_sym, nb_lsb);
+		else
+			gather_chars(comp, text, nb_sym);
+		comp += nb_sym * sym_bits / nb_lsb;
+		text += nb_sym;
+		nb_bits %= sym_bits;
+	}
+	gather_bits_generic(comp, text, first_bit, nb_bits, nb_lsb, sym_bits);
+}
+
+/***********************************************************
+ * Name of the kernels chosen at startup
+ * @return "avx512", "avx2", "sse2" or "scalar"
+ ***********************************************************/
+const char *bitplane_kernel_name(void){
+	return kernel_name;
+}
@@ -0,0 +1,16 @@
+/************************************************************************************
+ * @file bitplane.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 22 Nov 2017
+ * @brief Vectorized kernels spreading chars into the lowest bits of components
+ ***********************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+
+void spread_chars(uint8_t *comp, const char *text, size_t nb_char);
+void gather_chars(const uint8_t *comp, char *text, size_t nb_char);
+void spread_bits(uint8_t *comp, const char *text, size_t first_bit, size_t nb_bits,
+                 int nb_lsb, int sym_bits);
+void gather_bits(const uint8_t *comp, char *text, size_t first_bit, size_t nb_bits,
+                 int nb_lsb, int sym_bits);
+const char *bitplane_kernel_name(void);
@@ -0,0 +1,147 @@
+/************************************************************************************
+ * @file container.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 19 Dec 2017
+ * @brief Directory of the files packed in the payload of a container
+ *
+ * The payload of a container (bit 7 of the format word, see format.h) starts with
+ * a directory, followed by the data of the files one after the other. The
+ * directory is made of the number of entries and of its own size in bytes (32 bits
+ * each), then of the entries: the length of the name (8 bits), the name, then the
+ * offset of the file from the end of the directory, its length, its flags and its
+ * checksum (32 bits each). All the numbers are big-endian.
+ *
+ * As the symbols of a container are bytes, the file of an entry lies in a known
+ * range of components: it is decoded without decoding the other files.
+ ***********************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include "container.h"
+#include "alloc.h"
+
+#define ENTRY_FIXED 17
+
+/***********************************************************
+ * Write a 32 bits number (big-endian)
+ * @param dst where to write the 4 bytes
+ * @param value the number
+ ***********************************************************/
+static void put_u32(char *dst, uint32_t value){
+	for (int i = 0; i < 4; i++)
+		dst[i] = value >> (24 - 8 * i);
+}
+
+/***********************************************************
+ * Read a 32 bits number (big-endian)
+ * @param src the 4 bytes
+ * @return the number
+ ***********************************************************/
+static uint32_t get_u32(const char *src){
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++)
+		value = value << 8 | (uint8_t)src[i];
+	return value;
+}
+
+/***********************************************************
+ * Number of bytes of a directory
+ * @param entries the entries of the directory
+ * @param nb_entries number of entries
+ * @return the number of bytes, head included
+ ***********************************************************/
+size_t directory_size(const entry_t *entries, int nb_entries){
+	size_t size = DIRECTORY_HEAD;
+	for (int i = 0; i < nb_entries; i++)
+		size += ENTRY_FIXED + strlen(entries[i].name);
+	return size;
+}
+
+/***********************************************************
+ * Write a directory
+ * @param dst where to write it (directory_size bytes)
+ * @param entries the entries of the directory
+ * @param nb_entries number of entries
+ ***********************************************************/
+void write_directory(char *dst, const entry_t *entries, int nb_entries){
+	put_u32(dst, nb_entries);
+	put_u32(dst + 4, directory_size(entries, nb_entries));
+	dst += DIRECTORY_HEAD;
+	for (int i = 0; i < nb_entries; i++){
+		size_t len = strlen(entries[i].name);
+		*dst++ = len;
+		memcpy(dst, entries[i].name, len);
+		dst += len;
+		put_u32(dst, entries[i].offset);
+		put_u32(dst + 4, entries[i].length);
+		put_u32(dst + 8, entries[i].flags);
+		put_u32(dst + 12, entries[i].checksum);
+		dst += ENTRY_FIXED - 1;
+	}
+}
+
+/***********************************************************
+ * Read the head of a directory
+ * @param src the first DIRECTORY_HEAD bytes of the payload
+ * @param nb_entries receives the number of entries
+ * @param dir_size receives the size of the directory
+ * @return false if the head is not valid
+ ***********************************************************/
+bool read_directory_head(const char *src, uint32_t *nb_entries, uint32_t *dir_size){
+	*nb_entries = get_u32(src);
+	*dir_size = get_u32(src + 4);
+	return *dir_size >= DIRECTORY_HEAD && (*dir_size - DIRECTORY_HEAD) / ENTRY_FIXED >= *nb_entries;
+}
+
+/***********************************************************
+ * Read the entries of a directory
+ * @param src the directory (dir_size bytes)
+ * @param nb_entries number of entries (see
+ *                   read_directory_head)
+ * @param dir_size size of the directory
+ * @param nb_char number of bytes of the payload
+ * @return the entries (to free), NULL if the directory is
+ *         not valid or an entry is out of the payload
+ ***********************************************************/
+entry_t *read_directory(const char *src, uint32_t nb_entries, uint32_t dir_size, size_t nb_char){
+	if(dir_size > nb_char)
+		return NULL;
+	entry_t *entries = my_malloc((nb_entries ? nb_entries : 1) * sizeof(entry_t));
+	size_t pos = DIRECTORY_HEAD, data = nb_char - dir_size;
+
+	for (uint32_t i = 0; i < nb_entries; i++){
+		size_t len = (uint8_t)src[pos];
+		if(pos + ENTRY_FIXED + len > dir_size)
+			break;
+		memcpy(entries[i].name, src + pos + 1, len);
+		entries[i].name[len] = '\0';
+		pos += 1 + len;
+		entries[i].offset = get_u32(src + pos);
+		entries[i].length = get_u32(src + pos + 4);
+		entries[i].flags = get_u32(src + pos + 8);
+		entries[i].checksum = get_u32(src + pos + 12);
+		pos += ENTRY_FIXED - 1;
+		if(entries[i].offset > data || entries[i].length > data - entries[i].offset ||
+		   (entries[i].flags & ~ENTRY_CHECKED) || memchr(entries[i].name, '\0', len))
+			break;
+		if(i + 1 == nb_entries && pos == dir_size)
+			return entries;
+	}
+	if(!nb_entries && pos == dir_size)
+		return entries;
+	free(entries);
+	return NULL;
+}
+
+/***********************************************************
+ * Find an entry by its name
+ * @param entries the entries of a directory
+ * @param nb_entries number of entries
+ * @param name the name of the file
+ * @return the first entry with this name, NULL if none
+ ***********************************************************/
+const entry_t *find_entry(const entry_t *entries, int nb_entries, const char *name){
+	for (int i = 0; i < nb_entries; i++)
+		if(!strcmp(entries[i].name, name))
+			return &entries[i];
+	return NULL;
+}
@@ -0,0 +1,44 @@
+/************************************************************************************
+ * @file container.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 19 Dec 2017
+ * @brief Directory of the files packed in the payload of a container
+ ***********************************************************************************/
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MAX_NAME 255
+#define DIRECTORY_HEAD 8
+
+// Flags of an entry
+#define ENTRY_CHECKED 0x1
+
+/***********************************************************
+ * File packed in a container
+ * @param name name of the file (without its directories)
+ * @param offset position of the file in the data, after the
+ *               directory
+ * @param length number of bytes of the file
+ * @param flags ENTRY_CHECKED if checksum is recorded
+ * @param checksum CRC-32C of the bytes of the file (see
+ *                 crc32c.h), 0 if not checked
+ ***********************************************************/
+typedef struct entry_st {
+	char name[MAX_NAME + 1];
+	uint32_t offset;
+	uint32_t length;
+	uint32_t flags;
+	uint32_t checksum;
+} entry_t;
+
+size_t directory_size(const entry_t *entries, int nb_entries);
+void write_directory(char *dst, const entry_t *entries, int nb_entries);
+bool read_directory_head(const char *src, uint32_t *nb_entries, uint32_t *dir_size);
+entry_t *read_directory(const char *src, uint32_t nb_entries, uint32_t dir_size, size_t nb_char);
+const entry_t *find_entry(const entry_t *entries, int nb_entries, const char *name);
+
+#endif
@@ -0,0 +1,157 @@
+/************************************************************************************
+ * @file crc32c.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 14 Dec 2017
+ * @brief CRC-32C (Castagnoli) checksum of the payload, computed by parts
+ *
+ * The checksum is computed with the crc32 instruction of SSE 4.2 when the
+ * processor has it (8 bytes per instruction), with tables otherwise (8 bytes per
+ * step, slicing by 8). Both give the same CRC-32C, as the one of iSCSI or ext4.
+ *
+ * Each thread computes the checksum of its own part of the payload, then the
+ * checksums of the parts are combined in order (crc32c_combine): the checksum of
+ * a part is shifted by the length of the next part (a multiplication by x^(8*len)
+ * modulo the polynomial) and added to the checksum of the next part, without
+ * reading the chars again.
+ ***********************************************************************************/
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+// The Castagnoli polynomial, bits reversed
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc_table[8][256];
+static uint32_t x2n_table[32];
+static bool crc_hw;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/***********************************************************
+ * Multiply two polynomials modulo the polynomial of the CRC
+ * (bits reversed, x^0 being the highest bit)
+ * @param a first polynomial
+ * @param b second polynomial
+ * @return a * b modulo the polynomial
+ ***********************************************************/
+static uint32_t multmodp(uint32_t a, uint32_t b){
+	uint32_t m = (uint32_t)1 << 31, p = 0;
+
+	for (;;){
+		if(a & m){
+			p ^= b;
+			if((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/***********************************************************
+ * Compute the tables, and check if the processor has the
+ * crc32 instruction (once per process)
+ ***********************************************************/
+static void init_crc32c(void){
+	for (uint32_t n = 0; n < 256; n++){
+		uint32_t crc = n;
+		for (int k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc_table[0][n] = crc;
+	}
+	for (int n = 0; n < 256; n++)
+		for (int k = 1; k < 8; k++)
+			crc_table[k][n] = (crc_table[k - 1][n] >> 8) ^ crc_table[0][crc_table[k - 1][n] & 0xFF];
+
+    // x^(2^n) modulo the polynomial, from x^1
+	x2n_table[0] = (uint32_t)1 << 30;
+	for (int n = 1; n < 32; n++)
+		x2n_table[n] = multmodp(x2n_table[n - 1], x2n_table[n - 1]);
+
+#if defined(__x86_64__) || defined(__i386__)
+	crc_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/***********************************************************
+ * Update a CRC with the crc32 instruction (SSE 4.2)
+ * @param crc the CRC (not inverted)
+ * @param p the bytes
+ * @param len number of bytes
+ * @return the updated CRC
+ ***********************************************************/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len){
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+#if defined(__x86_64__)
+	uint64_t crc64 = crc;
+	for (; len >= 8; len -= 8, p += 8){
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+	}
+	crc = crc64;
+#endif
+	for (; len; len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	return crc;
+}
+#endif
+
+/***********************************************************
+ * Update a CRC with the tables, 8 bytes per step
+ * @param crc the CRC (not inverted)
+ * @param p the bytes
+ * @param len number of bytes
+ * @return the updated CRC
+ ***********************************************************/
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len){
+	for (; len >= 8; len -= 8, p += 8){
+		uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+		crc = crc_table[7][low & 0xFF] ^ crc_table[6][(low >> 8) & 0xFF] ^
+		      crc_table[5][(low >> 16) & 0xFF] ^ crc_table[4][low >> 24] ^
+		      crc_table[3][p[4]] ^ crc_table[2][p[5]] ^ crc_table[1][p[6]] ^ crc_table[0][p[7]];
+	}
+	for (; len; len--)
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+	return crc;
+}
+
+/***********************************************************
+ * Checksum of bytes, following the ones of a previous call
+ * @param crc the checksum of the previous bytes (0 for the
+ *            first ones)
+ * @param data the bytes
+ * @param len number of bytes
+ * @return the checksum of the previous bytes and of these
+ ***********************************************************/
+uint32_t crc32c(uint32_t crc, const void *data, size_t len){
+	pthread_once(&crc_once, init_crc32c);
+	crc = ~crc;
+#if defined(__x86_64__) || defined(__i386__)
+	if(crc_hw)
+		return ~crc32c_hw(crc, data, len);
+#endif
+	return ~crc32c_sw(crc, data, len);
+}
+
+/***********************************************************
+ * Checksum of two consecutive parts from their checksums
+ * @param crc1 checksum of the first part
+ * @param crc2 checksum of the second part
+ * @param len2 number of bytes of the second part
+ * @return the checksum of the two parts
+ ***********************************************************/
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2){
+	pthread_once(&crc_once, init_crc32c);
+
+    // crc1 * x^(8 * len2), the powers x^(2^n) of the bits of 8 * len2 being multiplied
+	uint32_t p = (uint32_t)1 << 31;
+	for (int k = 3; len2; len2 >>= 1, k++)
+		if(len2 & 1)
+			p = multmodp(x2n_table[k & 31], p);
+	return multmodp(p, crc1) ^ crc2;
+}
@@ -0,0 +1,16 @@
+/************************************************************************************
+ * @file crc32c.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 14 Dec 2017
+ * @brief CRC-32C (Castagnoli) checksum of the payload, computed by parts
+ ***********************************************************************************/
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+#endif
@@ -1,55 +1,280 @@
-/************************************************************************************
- * @file files.h
- * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
- * @date 1 Nov 2017
- * @brief Routines to treats with text files
- ***********************************************************************************/
-#include "files.h"
-
-/***********************************************************
- * Open a (text) file with it's path
- * @param filename string containing the name of the file
- * @param mode specify the file access mode 
- * @return a pointer to the stream of the file
- ***********************************************************/
-FILE *open_file(char* filename, char *mode){
-	FILE * file = fopen(filename,mode);
-    // If there is an error and the pointer is NULL
-	if(!file){
-		fprintf(stderr, "FILE %s NOT FOUND OR CANNOT BE OPENED\n", filename);
-		exit(EXIT_FAILURE);
-	}
-
-	return file;
-}
-
-/***********************************************************
- * Get the size of a file
- * @param filename string containing the name of the file
- * @return the file size
- ***********************************************************/
-off_t fsize(const char *filename){
-    // Get the stats of a file (the size is in the stats)
-    struct stat st;
-    if (!stat(filename, &st))
-        return st.st_size;
-
-    // If error
-    fprintf(stderr, "CANNOT DETERMINATE SIZE OF %s\n", filename);
-    exit(EXIT_FAILURE);
-}
-
-/***********************************************************
- * Get the string of a text file
- * @param filename string containing the name of the file
- * @param nb_char the number of chars in the text file
- * @param s a pointer to the final string of the text file
- ***********************************************************/
-void file_to_str(char* filename, int nb_char , char **s){
-	FILE *fp = open_file(filename, "r");
-
-	*s = my_calloc(nb_char + 1, sizeof(char));
-	fread(*s, 1, nb_char, fp);
-
-  	fclose (fp);
-}
\ No newline at end of file
+/************************************************************************************
+ * @file files.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 1 Nov 2017
+ * @brief Routines to treats with text files
+ ***********************************************************************************/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fs.h>
+#include <dirent.h>
+#include <strings.h>
+#include "files.h"
+
+#define COPY_BUFFER_SIZE (1 << 20)
+
+/***********************************************************
+ * Open a (text) file with it's path
+ * @param filename string containing the name of the file
+ * @param mode specify the file access mode 
+ * @return a pointer to the stream of the file
+ ***********************************************************/
+FILE *open_file(char* filename, char *mode){
+	FILE * file = fopen(filename,mode);
+    // If there is an error and the pointer is NULL
+	if(!file){
+		fprintf(stderr, "FILE %s NOT FOUND OR CANNOT BE OPENED\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	return file;
+}
+
+/***********************************************************
+ * Get the size of a file
+ * @param filename string containing the name of the file
+ * @return the file size
+ ***********************************************************/
+off_t fsize(const char *filename){
+    // Get the stats of a file (the size is in the stats)
+    struct stat st;
+    if (!stat(filename, &st))
+        return st.st_size;
+
+    // If error
+    fprintf(stderr, "CANNOT DETERMINATE SIZE OF %s\n", filename);
+    exit(EXIT_FAILURE);
+}
+
+/***********************************************************
+ * Get the string of a text file
+ * @param filename string containing the name of the file
+ * @param nb_char the number of chars in the text file
+ * @param s a pointer to the final string of the text file
+ ***********************************************************/
+void file_to_str(char* filename, int nb_char , char **s){
+	FILE *fp = open_file(filename, "r");
+
+	*s = my_calloc(nb_char + 1, sizeof(char));
+	fread(*s, 1, nb_char, fp);
+
+  	fclose (fp);
+}
+
+/***********************************************************
+ * Get the content of a file without copying it: the file
+ * is mapped in memory, or read at once if it cannot be
+ * mapped. The content is not terminated by '\0'.
+ * @param filename string containing the name of the file
+ * @param size the size of the file
+ * @param mapped receives true if the file is mapped
+ * @return the content, to be released with release_file
+ ***********************************************************/
+char *load_file(char *filename, size_t size, bool *mapped){
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0){
+		fprintf(stderr, "FILE %s NOT FOUND OR CANNOT BE OPENED\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	char *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	*mapped = data != MAP_FAILED;
+	if(*mapped){
+		madvise(data, size, MADV_SEQUENTIAL);
+	}else{
+		// Pipes, special files..: one bulk read
+		data = my_malloc(size + 1);
+		size_t done = 0;
+		ssize_t nb = 1;
+		while(done < size && (nb = read(fd, data + done, size - done)) > 0)
+			done += nb;
+		if(done < size){
+			fprintf(stderr, "CANNOT READ THE FILE %s\nExiting now...\n", filename);
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+	return data;
+}
+
+/***********************************************************
+ * Release the content of a file given by load_file
+ * @param data the content
+ * @param size the size of the file
+ * @param mapped true if the file is mapped
+ ***********************************************************/
+void release_file(char *data, size_t size, bool mapped){
+	if(mapped)
+		munmap(data, size);
+	else
+		free(data);
+}
+
+/***********************************************************
+ * Read a manifest, listing one job per line: nb_fields
+ * paths separated by spaces or tabulations (empty lines and
+ * lines starting with '#' are ignored)
+ * @param filename string containing the name of the file
+ * @param nb_fields number of paths of a job
+ * @param nb_jobs receives the number of jobs
+ * @return the jobs, each one being an array of nb_fields paths
+ ***********************************************************/
+char ***read_manifest(char* filename, int nb_fields, int *nb_jobs){
+	FILE *fp = open_file(filename, "r");
+	char ***jobs = NULL;
+	char *line = NULL;
+	size_t line_size = 0;
+	int nb_lines = 0, capacity = 0;
+
+	*nb_jobs = 0;
+	while(getline(&line, &line_size, fp) != -1){
+		char *save, *field = strtok_r(line, " \t\r\n", &save);
+		nb_lines++;
+		if(!field || field[0] == '#')
+			continue;
+
+		if(*nb_jobs == capacity){
+			capacity = capacity ? capacity * 2 : 16;
+			jobs = realloc(jobs, capacity * sizeof(char **));
+			if(!jobs){
+				fprintf(stderr, "MANIFEST %s TOO LONG\nExiting now...\n", filename);
+				exit(EXIT_FAILURE);
+			}
+		}
+		char **job = my_malloc(nb_fields * sizeof(char *));
+		for (int i = 0; i < nb_fields; i++, field = strtok_r(NULL, " \t\r\n", &save)){
+			if(!field){
+				fprintf(stderr, "LINE %d OF %s MUST CONTAIN %d PATHS\nExiting now...\n",
+				        nb_lines, filename, nb_fields);
+				exit(EXIT_FAILURE);
+			}
+			job[i] = my_malloc(strlen(field) + 1);
+			strcpy(job[i], field);
+		}
+		if(field){
+			fprintf(stderr, "LINE %d OF %s MUST CONTAIN %d PATHS\nExiting now...\n",
+			        nb_lines, filename, nb_fields);
+			exit(EXIT_FAILURE);
+		}
+		jobs[(*nb_jobs)++] = job;
+	}
+
+	free(line);
+	fclose(fp);
+	return jobs;
+}
+
+/***********************************************************
+ * Free the jobs of a manifest
+ * @param jobs the jobs given by read_manifest
+ * @param nb_jobs number of jobs
+ * @param nb_fields number of paths of a job
+ ***********************************************************/
+void free_manifest(char ***jobs, int nb_jobs, int nb_fields){
+	for (int i = 0; i < nb_jobs; i++){
+		for (int j = 0; j < nb_fields; j++)
+			free(jobs[i][j]);
+		free(jobs[i]);
+	}
+	free(jobs);
+}
+
+/***********************************************************
+ * Compare the paths of two jobs of one field (for qsort)
+ * @param a pointer to the first job
+ * @param b pointer to the second job
+ * @return the order of the paths (see strcmp)
+ ***********************************************************/
+static int compare_jobs(const void *a, const void *b){
+	return strcmp((*(char ***)a)[0], (*(char ***)b)[0]);
+}
+
+/***********************************************************
+ * List a set of images: the PPM and PNG files of a
+ * directory (from their extension), sorted by name, or the
+ * paths of a list file, one per line, in their order (see
+ * read_manifest)
+ * @param path path of the directory or of the list file
+ * @param nb_images receives the number of images
+ * @return the images as jobs of one path (see
+ *         free_manifest)
+ ***********************************************************/
+char ***list_images(char *path, int *nb_images){
+	DIR *dir = opendir(path);
+	if(!dir)
+		return read_manifest(path, 1, nb_images);
+
+	char ***images = NULL;
+	struct dirent *e;
+	int capacity = 0;
+	*nb_images = 0;
+	while((e = readdir(dir))){
+		size_t len = strlen(e->d_name);
+		if(e->d_name[0] == '.' || len < 5 ||
+		   (strcasecmp(e->d_name + len - 4, ".ppm") && strcasecmp(e->d_name + len - 4, ".png")))
+			continue;
+		if(*nb_images == capacity){
+			capacity = capacity ? capacity * 2 : 16;
+			images = realloc(images, capacity * sizeof(char **));
+			if(!images){
+				fprintf(stderr, "TOO MANY IMAGES IN %s\nExiting now...\n", path);
+				exit(EXIT_FAILURE);
+			}
+		}
+		char **image = my_malloc(sizeof(char *));
+		image[0] = my_malloc(strlen(path) + len + 2);
+		sprintf(image[0], "%s/%s", path, e->d_name);
+		images[(*nb_images)++] = image;
+	}
+	closedir(dir);
+	if(*nb_images)
+		qsort(images, *nb_images, sizeof(char **), compare_jobs);
+	return images;
+}
+
+/***********************************************************
+ * Copy a regular file: its blocks are shared with the copy
+ * when the file system allows it (reflink), else the copy
+ * is done by the kernel (copy_file_range) or, as a last
+ * resort, read and written
+ * @param src path of the file to copy
+ * @param dst path of the copy (created or truncated)
+ * @return false if the file cannot be copied
+ ***********************************************************/
+bool clone_file(const char *src, const char *dst){
+	struct stat st;
+	int in = open(src, O_RDONLY);
+	if(in < 0 || fstat(in, &st) != 0 || !S_ISREG(st.st_mode)){
+		if(in >= 0)
+			close(in);
+		return false;
+	}
+	int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(out < 0){
+		close(in);
+		return false;
+	}
+
+	bool ok = true;
+	if(ioctl(out, FICLONE, in) != 0){
+		// Both offsets move on, so the copy goes on from where it stopped
+		off_t done = 0;
+		ssize_t nb = 1;
+		while(done < st.st_size && (nb = copy_file_range(in, NULL, out, NULL, st.st_size - done, 0)) > 0)
+			done += nb;
+
+		if(done < st.st_size){
+			char *buffer = my_malloc(COPY_BUFFER_SIZE);
+			while(ok && (nb = read(in, buffer, COPY_BUFFER_SIZE)) > 0)
+				ok = write(out, buffer, nb) == nb;
+			ok &= nb == 0;
+			free(buffer);
+		}
+	}
+	ok &= close(out) == 0;
+	close(in);
+	return ok;
+}
@@ -1,16 +1,23 @@
-/************************************************************************************
- * @file files.h
- * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
- * @date 1 Nov 2017
- * @brief Routines to treats with text files
- ***********************************************************************************/
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <sys/stat.h>
-#include "alloc.h"
-
-FILE *open_file(char* filename, char *mode);
-off_t fsize(const char *filename);
-void file_to_str(char* filename, int nb_char , char **s);
\ No newline at end of file
+/************************************************************************************
+ * @file files.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 1 Nov 2017
+ * @brief Routines to treats with text files
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "alloc.h"
+
+FILE *open_file(char* filename, char *mode);
+off_t fsize(const char *filename);
+void file_to_str(char* filename, int nb_char , char **s);
+char ***read_manifest(char* filename, int nb_fields, int *nb_jobs);
+void free_manifest(char ***jobs, int nb_jobs, int nb_fields);
+char ***list_images(char *path, int *nb_images);
+bool clone_file(const char *src, const char *dst);
+char *load_file(char *filename, size_t size, bool *mapped);
+void release_file(char *data, size_t size, bool mapped);
\ No newline at end of file
@@ -0,0 +1,270 @@
+/************************************************************************************
+ * @file format.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 8 Dec 2017
+ * @brief Layout of the header and of the payload in the components of an image
+ *
+ * The lowest bit of the 32 first components holds the number of symbols, from
+ * its highest bit to its lowest bit. In the original layout, the symbols are
+ * chars of 7 bits, stored in the lowest bit of the components from the 12th
+ * pixel.
+ *
+ * Any other layout sets the bit 31 of the number of symbols (extended header):
+ * the lowest bit of the next 16 components then holds a format word, and the
+ * symbols start at the 17th pixel. The bits 0 and 1 of the format word are the
+ * number of lowest bits used per component minus one, the bit 2 is set for
+ * symbols of 8 bits, the bits 3 and 4 are the codec compressing the payload,
+ * the bit 5 is set if the payload is scattered with a key (see scatter.h), the
+ * bit 6 if the header holds a checksum, the bit 7 if the payload is a container
+ * of files (symbols of 8 bits only, see container.h), the bit 8 if the payload is
+ * a shard of a payload cut over several images; the other bits must be 0.
+ * If the payload is compressed (symbols of 8 bits only), the lowest bit of the
+ * next 32 components holds the length of the payload once decompressed, and the
+ * symbols (the compressed payload, see lz.h) start at the next pixel.
+ * If the bit 6 of the format word is set, the lowest bit of the next 32
+ * components holds the CRC-32C (see crc32c.h) of the symbols of the payload (one
+ * byte per symbol, the compressed payload if it is compressed), and the symbols
+ * start at the next pixel.
+ * If the bit 8 of the format word is set, the lowest bit of the next 96 components
+ * holds the identifier of the set of images (32 bits), the index of the shard and
+ * the number of shards (16 bits each) and the position of the shard in the whole
+ * payload (32 bits); the symbols start at the next pixel. A shard is not
+ * compressed, nor a container.
+ * The bits of the symbols (from the highest) form a stream, cut into fields of
+ * nb_lsb bits, each field going into the lowest bits of a component (the first
+ * bit of the field into the highest of these bits).
+ ***********************************************************************************/
+#include "format.h"
+
+#define FORMAT_LSB_MASK 0x3
+#define FORMAT_8_BITS 0x4
+#define FORMAT_CODEC_SHIFT 3
+#define FORMAT_CODEC_MASK 0x18
+#define FORMAT_KEYED 0x20
+#define FORMAT_CHECKSUM 0x40
+#define FORMAT_CONTAINER 0x80
+#define FORMAT_SHARD 0x100
+#define MAX_FIELDS 8
+
+/***********************************************************
+ * Check if a format is the original one (1 bit, 7 bits
+ * chars), which does not need an extended header
+ * @param fmt the format
+ * @return true if fmt is the original format
+ ***********************************************************/
+bool is_default_format(format_t fmt){
+	return fmt.nb_lsb == 1 && fmt.sym_bits == BITS_PER_CHAR && fmt.codec == CODEC_NONE && !fmt.keyed &&
+	       !fmt.checked && !fmt.container && !fmt.sharded;
+}
+
+/***********************************************************
+ * Check the fields of a format
+ * @param fmt the format
+ * @return true if the format is supported
+ ***********************************************************/
+bool is_valid_format(format_t fmt){
+	return fmt.nb_lsb >= 1 && fmt.nb_lsb <= MAX_LSB &&
+	       (fmt.sym_bits == 7 || fmt.sym_bits == 8) &&
+	       (fmt.codec == CODEC_NONE || (fmt.codec == CODEC_LZ && fmt.sym_bits == 8)) &&
+	       (!fmt.container || (fmt.codec == CODEC_NONE && fmt.sym_bits == 8)) &&
+	       (!fmt.sharded || (fmt.codec == CODEC_NONE && !fmt.container && fmt.nb_shards >= 1 &&
+	                         fmt.nb_shards <= MAX_SHARDS && fmt.seq >= 0 && fmt.seq < fmt.nb_shards));
+}
+
+/***********************************************************
+ * First component of the payload, at the pixel following
+ * the header
+ * @param fmt the format
+ * @return the index of the component
+ ***********************************************************/
+size_t payload_offset(format_t fmt){
+	return (header_size(fmt) + 2) / 3 * 3;
+}
+
+/***********************************************************
+ * Number of components holding the header
+ * @param fmt the format
+ * @return the number of components
+ ***********************************************************/
+size_t header_size(format_t fmt){
+	if(is_default_format(fmt))
+		return BYTES_HEADER_CHAR;
+	return BYTES_HEADER_CHAR + FORMAT_WORD_BITS + (fmt.codec != CODEC_NONE ? RAW_LEN_BITS : 0) +
+	       (fmt.checked ? CHECKSUM_BITS : 0) + (fmt.sharded ? SHARD_BITS : 0);
+}
+
+/***********************************************************
+ * Number of symbols of a group, the smallest number of
+ * symbols filling whole components (the threads get whole
+ * groups, so that they never share a component)
+ * @param fmt the format
+ * @return the number of symbols
+ ***********************************************************/
+int group_symbols(format_t fmt){
+	int a = fmt.nb_lsb, b = fmt.sym_bits;
+	while(b){
+		int r = a % b;
+		a = b;
+		b = r;
+	}
+	return fmt.nb_lsb / a;
+}
+
+/***********************************************************
+ * Number of bits of a group (see group_symbols)
+ * @param fmt the format
+ * @return the number of bits
+ ***********************************************************/
+size_t group_bits(format_t fmt){
+	return (size_t)group_symbols(fmt) * fmt.sym_bits;
+}
+
+/***********************************************************
+ * Number of components holding a payload
+ * @param nb_sym number of symbols of the payload
+ * @param fmt the format
+ * @return the number of components
+ ***********************************************************/
+size_t payload_comps(size_t nb_sym, format_t fmt){
+	return (nb_sym * fmt.sym_bits + fmt.nb_lsb - 1) / fmt.nb_lsb;
+}
+
+/***********************************************************
+ * The maximum of symbols that can fit in an image
+ * @param nb_comp number of components of the image
+ * @param fmt the format
+ * @return the maximum of symbols
+ ***********************************************************/
+size_t max_symbols(size_t nb_comp, format_t fmt){
+	if(nb_comp <= payload_offset(fmt))
+		return 0;
+	size_t nb_sym = (nb_comp - payload_offset(fmt)) * fmt.nb_lsb / fmt.sym_bits;
+	return nb_sym < EXTENDED_FLAG ? nb_sym : EXTENDED_FLAG - 1;
+}
+
+/***********************************************************
+ * Write the part of the header that is in a range of
+ * components
+ * @param comp pointer to the component number first
+ * @param first index of the first component of the range
+ * @param last index of the component after the range
+ * @param nb_sym number of symbols of the payload
+ * @param fmt the format
+ ***********************************************************/
+void write_header(uint8_t *comp, size_t first, size_t last, uint32_t nb_sym, format_t fmt){
+	uint32_t fields[MAX_FIELDS] = { nb_sym };
+	int widths[MAX_FIELDS] = { BYTES_HEADER_CHAR };
+	size_t nb_bits = header_size(fmt);
+
+    // The optional fields follow the format word, in this order
+	if(!is_default_format(fmt)){
+		int n = 1;
+		fields[0] |= EXTENDED_FLAG;
+		fields[n] = (fmt.nb_lsb - 1) | (fmt.sym_bits == 8 ? FORMAT_8_BITS : 0) |
+		            fmt.codec << FORMAT_CODEC_SHIFT | (fmt.keyed ? FORMAT_KEYED : 0) |
+		            (fmt.checked ? FORMAT_CHECKSUM : 0) | (fmt.container ? FORMAT_CONTAINER : 0) |
+		            (fmt.sharded ? FORMAT_SHARD : 0);
+		widths[n++] = FORMAT_WORD_BITS;
+		if(fmt.codec != CODEC_NONE){
+			fields[n] = fmt.raw_len;
+			widths[n++] = RAW_LEN_BITS;
+		}
+		if(fmt.checked){
+			fields[n] = fmt.checksum;
+			widths[n++] = CHECKSUM_BITS;
+		}
+		if(fmt.sharded){
+			uint32_t shard[4] = { fmt.set_id, fmt.seq, fmt.nb_shards, fmt.shard_offset };
+			int shard_widths[4] = { SET_ID_BITS, SEQUENCE_BITS, SEQUENCE_BITS, SHARD_OFFSET_BITS };
+			for (int i = 0; i < 4; i++){
+				fields[n] = shard[i];
+				widths[n++] = shard_widths[i];
+			}
+		}
+	}
+	for (size_t i = first, start = 0, f = 0; i < last && i < nb_bits; i++){
+		while(i >= start + widths[f])
+			start += widths[f++];
+		int bit = (fields[f] >> (widths[f] - 1 - (i - start))) & 1;
+		comp[i - first] = (comp[i - first] & 0xFE) | bit;
+	}
+}
+
+/***********************************************************
+ * Read a field of the header
+ * @param comp pointer to the first component of the field
+ * @param nb_bits number of bits of the field
+ * @return the value of the field
+ ***********************************************************/
+static uint32_t read_field(const uint8_t *comp, int nb_bits){
+	uint32_t value = 0;
+	for (int i = 0; i < nb_bits; i++)
+		value = (value << 1) | (comp[i] & 1);
+	return value;
+}
+
+/***********************************************************
+ * Read the header from the first components of an image
+ * @param comp pointer to the first component
+ * @param nb_comp number of components available
+ * @param nb_sym receives the number of symbols
+ * @param fmt receives the format (the key of a keyed format
+ *            being unknown, 0)
+ * @return 1 if the header is read, 0 if more components are
+ *         needed, -1 if the format is not supported
+ ***********************************************************/
+int read_header(const uint8_t *comp, size_t nb_comp, uint32_t *nb_sym, format_t *fmt){
+	if(nb_comp < BYTES_HEADER_CHAR)
+		return 0;
+	uint32_t value = read_field(comp, BYTES_HEADER_CHAR);
+	if(!(value & EXTENDED_FLAG)){
+		*nb_sym = value;
+		*fmt = DEFAULT_FORMAT;
+		return 1;
+	}
+
+	if(nb_comp < BYTES_HEADER_CHAR + FORMAT_WORD_BITS)
+		return 0;
+	uint32_t word = read_field(comp + BYTES_HEADER_CHAR, FORMAT_WORD_BITS);
+	if(word & ~(FORMAT_LSB_MASK | FORMAT_8_BITS | FORMAT_CODEC_MASK | FORMAT_KEYED | FORMAT_CHECKSUM |
+	            FORMAT_CONTAINER | FORMAT_SHARD))
+		return -1;
+	format_t found = {
+		.nb_lsb = (word & FORMAT_LSB_MASK) + 1,
+		.sym_bits = word & FORMAT_8_BITS ? 8 : BITS_PER_CHAR,
+		.codec = (word & FORMAT_CODEC_MASK) >> FORMAT_CODEC_SHIFT,
+		.raw_len = 0,
+		.keyed = word & FORMAT_KEYED,
+		.key = 0,
+		.checked = word & FORMAT_CHECKSUM,
+		.checksum = 0,
+		.container = word & FORMAT_CONTAINER,
+		.sharded = word & FORMAT_SHARD,
+		.nb_shards = 1
+	};
+	if(is_default_format(found) || !is_valid_format(found))
+		return -1;
+
+	size_t next = BYTES_HEADER_CHAR + FORMAT_WORD_BITS;
+	if(nb_comp < header_size(found))
+		return 0;
+	if(found.codec != CODEC_NONE){
+		found.raw_len = read_field(comp + next, RAW_LEN_BITS);
+		next += RAW_LEN_BITS;
+	}
+	if(found.checked){
+		found.checksum = read_field(comp + next, CHECKSUM_BITS);
+		next += CHECKSUM_BITS;
+	}
+	if(found.sharded){
+		found.set_id = read_field(comp + next, SET_ID_BITS);
+		found.seq = read_field(comp + next + SET_ID_BITS, SEQUENCE_BITS);
+		found.nb_shards = read_field(comp + next + SET_ID_BITS + SEQUENCE_BITS, SEQUENCE_BITS);
+		found.shard_offset = read_field(comp + next + SET_ID_BITS + 2 * SEQUENCE_BITS, SHARD_OFFSET_BITS);
+		if(!is_valid_format(found))
+			return -1;
+	}
+	*nb_sym = value & ~EXTENDED_FLAG;
+	*fmt = found;
+	return 1;
+}
@@ -0,0 +1,100 @@
+/************************************************************************************
+ * @file format.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 8 Dec 2017
+ * @brief Layout of the header and of the payload in the components of an image
+ ***********************************************************************************/
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BITS_PER_CHAR 7
+#define BYTES_HEADER_CHAR 32
+#define FIRST_PIXEL 11
+
+// Extended header: bit 31 of the number of chars, then a format word
+#define EXTENDED_FLAG 0x80000000u
+#define FORMAT_WORD_BITS 16
+#define FIRST_PIXEL_EXT 16
+#define MAX_LSB 4
+
+// Compression of the payload, recorded in the format word
+#define CODEC_NONE 0
+#define CODEC_LZ 1
+#define RAW_LEN_BITS 32
+
+// Checksum of the payload (see crc32c.h), recorded after the format word
+#define CHECKSUM_BITS 32
+
+// Shard of a payload cut over several images, recorded after the checksum
+#define SET_ID_BITS 32
+#define SEQUENCE_BITS 16
+#define SHARD_OFFSET_BITS 32
+#define SHARD_BITS (SET_ID_BITS + 2 * SEQUENCE_BITS + SHARD_OFFSET_BITS)
+#define MAX_SHARDS ((1 << SEQUENCE_BITS) - 1)
+#define MAX_HEADER_SIZE (BYTES_HEADER_CHAR + FORMAT_WORD_BITS + RAW_LEN_BITS + CHECKSUM_BITS + SHARD_BITS)
+
+/***********************************************************
+ * How the payload is stored in the components
+ * @param nb_lsb number of lowest bits used in a component
+ *               (1 to 4)
+ * @param sym_bits number of bits of a symbol (7 for text,
+ *                 8 for any byte)
+ * @param codec compression of the payload (CODEC_NONE or
+ *              CODEC_LZ, which needs symbols of 8 bits)
+ * @param raw_len length of the payload once decompressed
+ *                (if codec is not CODEC_NONE)
+ * @param keyed true if the payload is scattered over the
+ *              components (see scatter.h)
+ * @param key key of the scattering (not stored in the
+ *            header)
+ * @param checked true if the header holds a checksum of
+ *                the payload
+ * @param checksum CRC-32C of the symbols of the payload
+ *                 (if checked)
+ * @param container true if the payload starts with a
+ *                  directory of files (see container.h)
+ * @param sharded true if the payload is a shard of a
+ *                payload cut over several images
+ * @param set_id identifier of the images of the payload
+ *               (if sharded)
+ * @param seq index of the shard, from 0 (if sharded)
+ * @param nb_shards number of shards (if sharded)
+ * @param shard_offset position of the first symbol of the
+ *                     shard in the whole payload (if
+ *                     sharded)
+ ***********************************************************/
+typedef struct format_st {
+	int nb_lsb;
+	int sym_bits;
+	int codec;
+	uint32_t raw_len;
+	bool keyed;
+	uint64_t key;
+	bool checked;
+	uint32_t checksum;
+	bool container;
+	bool sharded;
+	uint32_t set_id;
+	int seq;
+	int nb_shards;
+	uint32_t shard_offset;
+} format_t;
+
+#define DEFAULT_FORMAT ((format_t){ 1, BITS_PER_CHAR, CODEC_NONE, 0, false, 0, false, 0, false, false, 0, 0, 0, 0 })
+
+bool is_default_format(format_t fmt);
+bool is_valid_format(format_t fmt);
+size_t payload_offset(format_t fmt);
+size_t header_size(format_t fmt);
+int group_symbols(format_t fmt);
+size_t group_bits(format_t fmt);
+size_t payload_comps(size_t nb_sym, format_t fmt);
+size_t max_symbols(size_t nb_comp, format_t fmt);
+void write_header(uint8_t *comp, size_t first, size_t last, uint32_t nb_sym, format_t fmt);
+int read_header(const uint8_t *comp, size_t nb_comp, uint32_t *nb_sym, format_t *fmt);
+
+#endif
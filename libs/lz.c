@@ -0,0 +1,445 @@
+/************************************************************************************
+ * @file lz.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 11 Dec 2017
+ * @brief Fast LZ compression of the payload, by independent blocks
+ *
+ * The payload is cut into blocks of LZ_BLOCK_SIZE bytes (the last one being
+ * shorter), compressed independently, so that the threads compress and
+ * decompress different blocks in parallel, and so that a block can be
+ * decompressed as soon as it is extracted.
+ *
+ * Each block is stored as a 4 bytes header (little endian: the size of the
+ * stored data, the bit 31 being set if the data is not compressed) followed by
+ * the data. A compressed block is a list of sequences, as in LZ4: a token (number
+ * of literals on the 4 high bits, length of the match minus 4 on the 4 low bits,
+ * 15 meaning that bytes follow, added up until one is not 255), the literals,
+ * the offset of the match (2 bytes, little endian) and the extra bytes of its
+ * length. The last sequence has literals only. Blocks that would not shrink are
+ * stored as they are.
+ ***********************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "lz.h"
+
+#define MAX_JOBS 64
+#define RAW_BLOCK 0x80000000u
+#define HASH_BITS 12
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+
+/***********************************************************
+ * Blocks compressed or decompressed by a thread
+ * @param src the source (whole payload or stream)
+ * @param dst the destination (whole stream or payload)
+ * @param len length of the payload
+ * @param first first block of the thread
+ * @param last block after the last block of the thread
+ * @param offset position of the first block in the stream
+ *               (decompression only)
+ * @param ok false if a block is corrupted (decompression)
+ ***********************************************************/
+typedef struct lz_job_st {
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t len;
+	size_t first;
+	size_t last;
+	size_t offset;
+	bool ok;
+} lz_job_t;
+
+/***********************************************************
+ * Read 4 bytes (unaligned)
+ * @param p the bytes
+ * @return the value
+ ***********************************************************/
+static uint32_t read32(const uint8_t *p){
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/***********************************************************
+ * Write the extra bytes of a length (the part above 15)
+ * @param op where to write
+ * @param len the extra length
+ * @return the position after the bytes
+ ***********************************************************/
+static uint8_t *put_length(uint8_t *op, size_t len){
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/***********************************************************
+ * Read the extra bytes of a length
+ * @param ip pointer to the position of the bytes, moved on
+ * @param iend end of the input
+ * @param len pointer to the length, increased
+ * @return false if the input ends before the length
+ ***********************************************************/
+static bool get_length(const uint8_t **ip, const uint8_t *iend, size_t *len){
+	unsigned byte;
+	do{
+		if(*ip >= iend)
+			return false;
+		byte = *(*ip)++;
+		*len += byte;
+	}while(byte == 255);
+	return true;
+}
+
+/***********************************************************
+ * Write a sequence (literals then a match, if any)
+ * @param op where to write
+ * @param literals the literals
+ * @param nb_lit number of literals
+ * @param offset offset of the match (0 if none)
+ * @param match_len length of the match minus MIN_MATCH
+ * @return the position after the sequence
+ ***********************************************************/
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals, size_t nb_lit, size_t offset, size_t match_len){
+	uint8_t *token = op++;
+	*token = (uint8_t)((nb_lit >= 15 ? 15 : nb_lit) << 4);
+	if(nb_lit >= 15)
+		op = put_length(op, nb_lit - 15);
+	memcpy(op, literals, nb_lit);
+	op += nb_lit;
+	if(!offset)
+		return op;
+
+	*op++ = offset & 0xFF;
+	*op++ = offset >> 8;
+	*token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+	if(match_len >= 15)
+		op = put_length(op, match_len - 15);
+	return op;
+}
+
+/***********************************************************
+ * Compress a block
+ * @param src the block
+ * @param n size of the block (at most LZ_BLOCK_SIZE)
+ * @param dst receives the compressed block (n - 1 bytes
+ *            available)
+ * @return the size of the compressed block, 0 if it would
+ *         not be smaller than the block
+ ***********************************************************/
+static size_t compress_block(const uint8_t *src, size_t n, uint8_t *dst){
+	uint16_t table[1 << HASH_BITS] = { 0 };
+	const uint8_t *ip = src + 1, *anchor = src, *end = src + n;
+	uint8_t *op = dst, *op_limit = dst + n - 1;
+
+	// A match starts MF_LIMIT bytes before the end at the latest and
+	// ends LAST_LITERALS bytes before the end at the latest
+	while(n > MF_LIMIT && ip < end - MF_LIMIT){
+		uint32_t seq = read32(ip);
+		uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		const uint8_t *ref = src + table[h];
+		table[h] = (uint16_t)(ip - src);
+		if(read32(ref) != seq || ref >= ip){
+			ip++;
+			continue;
+		}
+
+		while(ip > anchor && ref > src && ip[-1] == ref[-1]){
+			ip--;
+			ref--;
+		}
+		const uint8_t *mp = ip + MIN_MATCH, *rp = ref + MIN_MATCH;
+		while(mp < end - LAST_LITERALS && *mp == *rp){
+			mp++;
+			rp++;
+		}
+
+		size_t nb_lit = ip - anchor, match_len = mp - ip - MIN_MATCH;
+		if(op + 1 + nb_lit + nb_lit / 255 + 1 + 2 + match_len / 255 + 1 > op_limit)
+			return 0;
+		op = put_sequence(op, anchor, nb_lit, ip - ref, match_len);
+		ip = anchor = mp;
+	}
+
+	size_t nb_lit = end - anchor;
+	if(op + 1 + nb_lit + nb_lit / 255 + 1 > op_limit)
+		return 0;
+	op = put_sequence(op, anchor, nb_lit, 0, 0);
+	return op - dst;
+}
+
+/***********************************************************
+ * Decompress a block, checking every length and offset
+ * @param src the compressed block
+ * @param len size of the compressed block
+ * @param dst receives the block
+ * @param n size of the block
+ * @return false if the block is corrupted
+ ***********************************************************/
+static bool decompress_data(const uint8_t *src, size_t len, uint8_t *dst, size_t n){
+	const uint8_t *ip = src, *iend = src + len;
+	uint8_t *op = dst, *oend = dst + n;
+
+	for(;;){
+		if(ip >= iend)
+			return false;
+		unsigned token = *ip++;
+		size_t nb_lit = token >> 4;
+		if(nb_lit == 15 && !get_length(&ip, iend, &nb_lit))
+			return false;
+		if(nb_lit > (size_t)(iend - ip) || nb_lit > (size_t)(oend - op))
+			return false;
+		memcpy(op, ip, nb_lit);
+		op += nb_lit;
+		ip += nb_lit;
+		if(ip == iend)
+			return op == oend;
+
+		if(iend - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t match_len = token & 15;
+		if(match_len == 15 && !get_length(&ip, iend, &match_len))
+			return false;
+		match_len += MIN_MATCH;
+		if(offset == 0 || offset > (size_t)(op - dst) || match_len > (size_t)(oend - op))
+			return false;
+
+		// The match may overlap the bytes it produces
+		const uint8_t *ref = op - offset;
+		if(offset >= match_len)
+			memcpy(op, ref, match_len);
+		else
+			for (size_t i = 0; i < match_len; i++)
+				op[i] = ref[i];
+		op += match_len;
+	}
+}
+
+/***********************************************************
+ * Decompress a stored block (header and data)
+ * @param block the stored block
+ * @param avail number of bytes available from block
+ * @param dst receives the block
+ * @param n size of the block
+ * @return the size of the stored block, 0 if more bytes are
+ *         needed, -1 if the block is corrupted
+ ***********************************************************/
+static long decompress_stored(const uint8_t *block, size_t avail, uint8_t *dst, size_t n){
+	if(avail < LZ_BLOCK_HEADER)
+		return 0;
+	uint32_t header = block[0] | block[1] << 8 | block[2] << 16 | (uint32_t)block[3] << 24;
+	size_t stored = header & ~RAW_BLOCK;
+	if(avail < LZ_BLOCK_HEADER + stored)
+		return 0;
+
+	const uint8_t *data = block + LZ_BLOCK_HEADER;
+	if(header & RAW_BLOCK){
+		if(stored != n)
+			return -1;
+		memcpy(dst, data, n);
+	}else if(!decompress_data(data, stored, dst, n)){
+		return -1;
+	}
+	return LZ_BLOCK_HEADER + stored;
+}
+
+/***********************************************************
+ * Threads compressing blocks, each one into its own slot
+ * of the stream (see lz_bound)
+ * @param param see the struct lz_job_t
+ * @return NULL
+ ***********************************************************/
+static void *compress_thread(void *param){
+	lz_job_t *job = (lz_job_t *)param;
+
+	for (size_t b = job->first; b < job->last; b++){
+		const uint8_t *in = job->src + b * LZ_BLOCK_SIZE;
+		size_t n = job->len - b * LZ_BLOCK_SIZE < LZ_BLOCK_SIZE ? job->len - b * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+		uint8_t *slot = job->dst + b * (LZ_BLOCK_SIZE + LZ_BLOCK_HEADER);
+
+		uint32_t header = compress_block(in, n, slot + LZ_BLOCK_HEADER);
+		if(!header){
+			memcpy(slot + LZ_BLOCK_HEADER, in, n);
+			header = n | RAW_BLOCK;
+		}
+		for (int i = 0; i < LZ_BLOCK_HEADER; i++)
+			slot[i] = header >> (8 * i);
+	}
+	return NULL;
+}
+
+/***********************************************************
+ * Threads decompressing blocks
+ * @param param see the struct lz_job_t
+ * @return NULL
+ ***********************************************************/
+static void *decompress_thread(void *param){
+	lz_job_t *job = (lz_job_t *)param;
+
+	// The blocks have been found by lz_decompress: each one is complete
+	const uint8_t *block = job->src + job->offset;
+	job->ok = true;
+	for (size_t b = job->first; b < job->last && job->ok; b++){
+		size_t n = job->len - b * LZ_BLOCK_SIZE < LZ_BLOCK_SIZE ? job->len - b * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+		long size = decompress_stored(block, SIZE_MAX, job->dst + b * LZ_BLOCK_SIZE, n);
+		job->ok = size > 0;
+		block += size;
+	}
+	return NULL;
+}
+
+/***********************************************************
+ * Run the jobs, the first one in the calling thread and
+ * each other one in its own thread (or in the calling
+ * thread if it cannot be created)
+ * @param routine the threads routine
+ * @param jobs the jobs
+ * @param nb_jobs number of jobs
+ ***********************************************************/
+static void run_jobs(void *(*routine)(void *), lz_job_t *jobs, int nb_jobs){
+	pthread_t threads[MAX_JOBS];
+	bool started[MAX_JOBS] = { false };
+
+	for (int i = 1; i < nb_jobs; i++)
+		started[i] = pthread_create(&threads[i], NULL, routine, &jobs[i]) == 0;
+	routine(&jobs[0]);
+	for (int i = 1; i < nb_jobs; i++){
+		if(started[i])
+			pthread_join(threads[i], NULL);
+		else
+			routine(&jobs[i]);
+	}
+}
+
+/***********************************************************
+ * Cut the blocks between the jobs
+ * @param jobs receives the jobs (MAX_JOBS at most)
+ * @param nb_blocks number of blocks
+ * @param nb_threads number of threads wanted
+ * @return the number of jobs
+ ***********************************************************/
+static int split_blocks(lz_job_t *jobs, size_t nb_blocks, int nb_threads){
+	if(nb_threads < 1)
+		nb_threads = 1;
+	if(nb_threads > MAX_JOBS)
+		nb_threads = MAX_JOBS;
+	if((size_t)nb_threads > nb_blocks)
+		nb_threads = nb_blocks;
+	for (int i = 0; i < nb_threads; i++){
+		jobs[i].first = nb_blocks * i / nb_threads;
+		jobs[i].last = nb_blocks * (i + 1) / nb_threads;
+	}
+	return nb_threads;
+}
+
+/***********************************************************
+ * Largest size of the compressed stream of a payload
+ * @param len length of the payload
+ * @return the size in bytes
+ ***********************************************************/
+size_t lz_bound(size_t len){
+	return len + (len + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE * LZ_BLOCK_HEADER;
+}
+
+/***********************************************************
+ * Compress a payload, the blocks being shared between
+ * threads
+ * @param src the payload
+ * @param len length of the payload
+ * @param dst receives the stream (lz_bound(len) bytes)
+ * @param nb_threads number of threads to use
+ * @return the size of the stream
+ ***********************************************************/
+size_t lz_compress(const char *src, size_t len, char *dst, int nb_threads){
+	size_t nb_blocks = (len + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+	if(!nb_blocks)
+		return 0;
+	lz_job_t jobs[MAX_JOBS];
+
+	int nb_jobs = split_blocks(jobs, nb_blocks, nb_threads);
+	for (int i = 0; i < nb_jobs; i++){
+		jobs[i].src = (const uint8_t *)src;
+		jobs[i].dst = (uint8_t *)dst;
+		jobs[i].len = len;
+	}
+	run_jobs(compress_thread, jobs, nb_jobs);
+
+	// Pack the slots, in order (a block never moves forward)
+	size_t size = 0;
+	for (size_t b = 0; b < nb_blocks; b++){
+		char *slot = dst + b * (LZ_BLOCK_SIZE + LZ_BLOCK_HEADER);
+		size_t stored = LZ_BLOCK_HEADER + (read32((uint8_t *)slot) & ~RAW_BLOCK);
+		memmove(dst + size, slot, stored);
+		size += stored;
+	}
+	return size;
+}
+
+/***********************************************************
+ * Decompress a whole stream, the blocks being shared
+ * between threads
+ * @param src the stream
+ * @param len size of the stream
+ * @param dst receives the payload
+ * @param raw_len length of the payload
+ * @param nb_threads number of threads to use
+ * @return false if the stream is corrupted
+ ***********************************************************/
+bool lz_decompress(const char *src, size_t len, char *dst, size_t raw_len, int nb_threads){
+	size_t nb_blocks = (raw_len + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+	if(!nb_blocks)
+		return len == 0;
+
+	lz_job_t jobs[MAX_JOBS];
+	const uint8_t *in = (const uint8_t *)src;
+	int nb_jobs = split_blocks(jobs, nb_blocks, nb_threads);
+
+    // Follow the headers of the blocks to check that they fill the stream
+    // and to find the first block of each job
+	size_t pos = 0;
+	for (size_t b = 0, j = 0; b < nb_blocks; b++){
+		if(j < (size_t)nb_jobs && jobs[j].first == b)
+			jobs[j++].offset = pos;
+		if(len - pos < LZ_BLOCK_HEADER)
+			return false;
+		pos += LZ_BLOCK_HEADER + (read32(in + pos) & ~RAW_BLOCK);
+		if(pos > len)
+			return false;
+	}
+	if(pos != len)
+		return false;
+
+	for (int i = 0; i < nb_jobs; i++){
+		jobs[i].src = in;
+		jobs[i].dst = (uint8_t *)dst;
+		jobs[i].len = raw_len;
+	}
+	run_jobs(decompress_thread, jobs, nb_jobs);
+
+	bool ok = true;
+	for (int i = 0; i < nb_jobs; i++)
+		ok &= jobs[i].ok;
+	return ok;
+}
+
+/***********************************************************
+ * Decompress the next block of a stream being extracted
+ * @param src the start of the block
+ * @param avail number of bytes of the stream available
+ *              from src
+ * @param dst receives the block (LZ_BLOCK_SIZE bytes at most)
+ * @param raw_left number of bytes of the payload not yet
+ *                 decompressed
+ * @return the number of bytes of the stream used, 0 if the
+ *         block is not complete yet, -1 if it is corrupted
+ ***********************************************************/
+long lz_decompress_block(const char *src, size_t avail, char *dst, size_t raw_left){
+	if(!raw_left)
+		return -1;
+	size_t n = raw_left < LZ_BLOCK_SIZE ? raw_left : LZ_BLOCK_SIZE;
+	return decompress_stored((const uint8_t *)src, avail, (uint8_t *)dst, n);
+}
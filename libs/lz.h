@@ -0,0 +1,21 @@
+/************************************************************************************
+ * @file lz.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 11 Dec 2017
+ * @brief Fast LZ compression of the payload, by independent blocks
+ ***********************************************************************************/
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LZ_BLOCK_SIZE 65536
+#define LZ_BLOCK_HEADER 4
+
+size_t lz_bound(size_t len);
+size_t lz_compress(const char *src, size_t len, char *dst, int nb_threads);
+bool lz_decompress(const char *src, size_t len, char *dst, size_t raw_len, int nb_threads);
+long lz_decompress_block(const char *src, size_t avail, char *dst, size_t raw_left);
+
+#endif
@@ -0,0 +1,146 @@
+/************************************************************************************
+ * @file pack.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Packing of files into the payload of a container
+ *
+ * The payload of a container (see container.h) is its directory followed by the
+ * files. The files are read in parallel by threads drawing whole files from a
+ * work queue (see scheduler.h), straight at their place in the payload; the
+ * directory is written last, once the checksums of the files are known.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pack.h"
+#include "container.h"
+#include "files.h"
+#include "format.h"
+#include "crc32c.h"
+#include "scheduler.h"
+
+/***********************************************************
+ * Store the arguments for the threads packing the files of
+ * a container, which draw the files from a work queue
+ * @param files the paths of the files
+ * @param entries the entries of the files (see container.h)
+ * @param data where the data of the files go, after the
+ *             directory
+ * @param queue the queue drawing the files
+ * @param index index of the thread
+ ***********************************************************/
+typedef struct pack_param_st{
+	char **files;
+	entry_t *entries;
+	char *data;
+	work_queue_t *queue;
+	int index;
+} pack_param_t;
+
+/***********************************************************
+ * Threads reading the files of a container at their place
+ * in the payload
+ * @param param see the struct pack_param_t
+ * @return return NULL if no problem encountered, the path of
+ *         the file that cannot be read otherwise
+ ***********************************************************/
+static void *pack_thread(void *param){
+	pack_param_t *p = (pack_param_t *)param;
+	size_t f;
+
+	while(next_chunk(p->queue, p->index, &f)){
+		entry_t *e = &p->entries[f];
+		char *dst = p->data + e->offset;
+		int fd = open(p->files[f], O_RDONLY);
+		size_t done = 0;
+		ssize_t nb = 1;
+		while(fd >= 0 && done < e->length && (nb = pread(fd, dst + done, e->length - done, done)) > 0)
+			done += nb;
+		if(fd >= 0)
+			close(fd);
+		if(done < e->length)
+			return p->files[f];
+		if(e->flags & ENTRY_CHECKED)
+			e->checksum = crc32c(0, dst, e->length);
+	}
+	return NULL;
+}
+
+/***********************************************************
+ * Pack files into the payload of a container: a directory
+ * (see container.h), then the files, each thread reading
+ * whole files
+ * @param files the paths of the files, their names without
+ *              the directories going into the directory
+ * @param nb_files number of files
+ * @param nb_threads maximum number of threads to use
+ * @param checked true to record the checksum of each file
+ * @param stats statistics of the run, or NULL
+ * @param nb_char receives the number of bytes of the payload
+ * @return the payload (to free)
+ ***********************************************************/
+char *pack_files(char **files, int nb_files, int nb_threads, bool checked, stats_t *stats, uint *nb_char){
+	entry_t *entries = my_calloc(nb_files, sizeof(entry_t));
+	size_t offset = 0;
+
+	begin_phase(stats, "pack");
+	for (int f = 0; f < nb_files; f++){
+		const char *name = strrchr(files[f], '/') ? strrchr(files[f], '/') + 1 : files[f];
+		off_t size = fsize(files[f]);
+		if(!*name || strlen(name) > MAX_NAME || find_entry(entries, f, name)){
+			fprintf(stderr, "INVALID OR DUPLICATE FILE NAME %s\nExiting now...\n", files[f]);
+			exit(EXIT_FAILURE);
+		}
+		strcpy(entries[f].name, name);
+		entries[f].offset = offset;
+		entries[f].length = size;
+		entries[f].flags = checked ? ENTRY_CHECKED : 0;
+		offset += size;
+		if(offset + directory_size(entries, f + 1) >= EXTENDED_FLAG){
+			fprintf(stderr,"TEXT TOO LONG FOR THIS IMAGE\nExiting now...\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	size_t dir_size = directory_size(entries, nb_files);
+	char *payload = my_malloc(dir_size + offset + 1);
+
+	// The files are read in parallel, straight at their place in the payload
+	if(nb_threads > nb_files)
+		nb_threads = nb_files;
+	if(nb_threads < 1)
+		nb_threads = 1;
+	work_queue_t queue;
+	init_work_queue(&queue, nb_files, nb_threads);
+	pack_param_t *param = my_malloc(nb_threads * sizeof(pack_param_t));
+	pthread_t *threads = my_malloc(nb_threads * sizeof(pthread_t));
+	for (int i = 0; i < nb_threads; i++){
+		param[i] = (pack_param_t){ files, entries, payload + dir_size, &queue, i };
+		if (i > 0 && pthread_create(&threads[i], NULL, pack_thread, &param[i]) != 0){
+			fprintf(stderr, "pthread_create failed!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	char *failed = pack_thread(&param[0]);
+	for (int i = 1; i < nb_threads; i++){
+		void *ret;
+		pthread_join(threads[i], &ret);
+		if(ret)
+			failed = ret;
+	}
+	free_work_queue(&queue);
+	free(param);
+	if(failed){
+		fprintf(stderr, "CANNOT READ THE FILE %s\nExiting now...\n", failed);
+		exit(EXIT_FAILURE);
+	}
+
+	// The directory is written once the checksums are known
+	write_directory(payload, entries, nb_files);
+	*nb_char = dir_size + offset;
+	end_phase(stats, *nb_char);
+	free(threads);
+	free(entries);
+	return payload;
+}
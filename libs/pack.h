@@ -0,0 +1,16 @@
+/************************************************************************************
+ * @file pack.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Packing of files into the payload of a container
+ ***********************************************************************************/
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "stats.h"
+
+char *pack_files(char **files, int nb_files, int nb_threads, bool checked, stats_t *stats, uint *nb_char);
+
+#endif
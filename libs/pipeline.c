@@ -0,0 +1,212 @@
+/************************************************************************************
+ * @file pipeline.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 4 Dec 2017
+ * @brief Three stages pipeline (load, process, store) with bounded queues
+ *
+ * While the item N is processed, the item N+1 is loaded and the item N-1 is
+ * stored. The stages are linked by queues holding at most depth items, so no
+ * more than 2 * depth + 3 items are in memory at the same time.
+ ***********************************************************************************/
+#include <stdlib.h>
+#include "pipeline.h"
+#include "alloc.h"
+
+/***********************************************************
+ * An item going through the pipeline
+ * @param data the item given by the load stage
+ * @param ok false once a stage failed on the item
+ * @param last true for the end marker of the queue
+ ***********************************************************/
+typedef struct slot_st {
+	void *data;
+	bool ok;
+	bool last;
+} slot_t;
+
+/***********************************************************
+ * Bounded queue between two stages
+ * @param lock protects the queue
+ * @param not_empty signaled when a slot is put in the queue
+ * @param not_full signaled when a slot leaves the queue
+ * @param slots circular buffer of depth slots
+ * @param depth maximum number of slots in the queue
+ * @param first index of the first slot
+ * @param count number of slots in the queue
+ ***********************************************************/
+typedef struct queue_st {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	slot_t *slots;
+	int depth;
+	int first;
+	int count;
+} queue_t;
+
+/***********************************************************
+ * Arguments of the threads of the stages
+ * @param stages the stages of the pipeline
+ * @param ctx the context given to the stages
+ * @param nb_items number of items to load
+ * @param in queue the stage takes its items from
+ * @param out queue the stage puts its items in
+ * @param nb_failed number of items the store stage got
+ *                  failed
+ ***********************************************************/
+typedef struct stage_param_st {
+	stages_t *stages;
+	void *ctx;
+	int nb_items;
+	queue_t *in;
+	queue_t *out;
+	int nb_failed;
+} stage_param_t;
+
+/***********************************************************
+ * Initialise an empty queue
+ * @param q the queue
+ * @param depth maximum number of slots in the queue
+ ***********************************************************/
+static void init_queue(queue_t *q, int depth){
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	q->slots = my_malloc(depth * sizeof(slot_t));
+	q->depth = depth;
+	q->first = 0;
+	q->count = 0;
+}
+
+/***********************************************************
+ * Free the memory of a queue
+ * @param q the queue
+ ***********************************************************/
+static void free_queue(queue_t *q){
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	free(q->slots);
+}
+
+/***********************************************************
+ * Put a slot at the end of a queue, waiting if it is full
+ * @param q the queue
+ * @param slot the slot
+ ***********************************************************/
+static void push(queue_t *q, slot_t slot){
+	pthread_mutex_lock(&q->lock);
+	while(q->count == q->depth)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	q->slots[(q->first + q->count) % q->depth] = slot;
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/***********************************************************
+ * Take the first slot of a queue, waiting if it is empty
+ * @param q the queue
+ * @return the slot
+ ***********************************************************/
+static slot_t pop(queue_t *q){
+	pthread_mutex_lock(&q->lock);
+	while(q->count == 0)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	slot_t slot = q->slots[q->first];
+	q->first = (q->first + 1) % q->depth;
+	q->count--;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+	return slot;
+}
+
+/***********************************************************
+ * Thread of the load stage
+ * @param param see the struct stage_param_t
+ * @return NULL
+ ***********************************************************/
+static void *load_thread(void *param){
+	stage_param_t *p = (stage_param_t *)param;
+
+	for (int i = 0; i < p->nb_items; i++){
+		slot_t slot = { .data = p->stages->load(p->ctx, i) };
+		slot.ok = slot.data != NULL;
+		push(p->out, slot);
+	}
+	push(p->out, (slot_t){ .last = true });
+	return NULL;
+}
+
+/***********************************************************
+ * Thread of the process stage
+ * @param param see the struct stage_param_t
+ * @return NULL
+ ***********************************************************/
+static void *process_thread(void *param){
+	stage_param_t *p = (stage_param_t *)param;
+
+	for(;;){
+		slot_t slot = pop(p->in);
+		if(!slot.last && slot.ok)
+			slot.ok = p->stages->process(p->ctx, slot.data);
+		push(p->out, slot);
+		if(slot.last)
+			break;
+	}
+	return NULL;
+}
+
+/***********************************************************
+ * Thread of the store stage
+ * @param param see the struct stage_param_t
+ * @return NULL
+ ***********************************************************/
+static void *store_thread(void *param){
+	stage_param_t *p = (stage_param_t *)param;
+
+	for(;;){
+		slot_t slot = pop(p->in);
+		if(slot.last)
+			break;
+		if(!p->stages->store(p->ctx, slot.data, slot.ok) || !slot.ok)
+			p->nb_failed++;
+	}
+	return NULL;
+}
+
+/***********************************************************
+ * Run the items through the stages of a pipeline
+ * @param stages the stages (see the struct stages_t)
+ * @param ctx the context given to the stages
+ * @param nb_items number of items
+ * @param depth maximum number of items waiting between two
+ *              stages
+ * @return the number of items that failed
+ ***********************************************************/
+int run_pipeline(stages_t *stages, void *ctx, int nb_items, int depth){
+	queue_t loaded, processed;
+	pthread_t threads[3];
+	void *(*routines[3])(void *) = { load_thread, process_thread, store_thread };
+
+	init_queue(&loaded, depth);
+	init_queue(&processed, depth);
+	stage_param_t params[3] = {
+		{ stages, ctx, nb_items, NULL, &loaded, 0 },
+		{ stages, ctx, nb_items, &loaded, &processed, 0 },
+		{ stages, ctx, nb_items, &processed, NULL, 0 }
+	};
+
+	for (int i = 0; i < 3; i++){
+		if (pthread_create(&threads[i], NULL, routines[i], &params[i]) != 0){
+			fprintf(stderr, "pthread_create failed!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < 3; i++)
+		pthread_join(threads[i], NULL);
+
+	free_queue(&loaded);
+	free_queue(&processed);
+	return params[2].nb_failed;
+}
@@ -0,0 +1,30 @@
+/************************************************************************************
+ * @file pipeline.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 4 Dec 2017
+ * @brief Three stages pipeline (load, process, store) with bounded queues
+ ***********************************************************************************/
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/***********************************************************
+ * Stages of a pipeline, each one running in its own thread.
+ * The item given by load goes through process, then store.
+ * process is not called if load or process failed (ok set
+ * to false), store is always called so it can free the item.
+ * @param load creates the item number index, NULL if failed
+ * @param process works on an item, false if failed
+ * @param store writes and frees an item, false if failed
+ ***********************************************************/
+typedef struct stages_st {
+	void *(*load)(void *ctx, int index);
+	bool (*process)(void *ctx, void *item);
+	bool (*store)(void *ctx, void *item, bool ok);
+} stages_t;
+
+int run_pipeline(stages_t *stages, void *ctx, int nb_items, int depth);
+
+#endif
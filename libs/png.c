@@ -0,0 +1,710 @@
+/************************************************************************************
+ * @file png.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 17 Dec 2017
+ * @brief Read and write 8-bit RGB PNG images, and images of either format
+ *
+ * A PNG image is loaded into the same img_t as a PPM image, so the components
+ * (and their lowest bits) are the same in both formats. Only 8-bit RGB images
+ * without interlacing are supported, the others being rejected (a palette or an
+ * alpha channel would not keep the hidden bits).
+ *
+ * The image is written in bands of PNG_BAND_ROWS rows, compressed by several
+ * threads with the system zlib, looking for run-length matches only (on filtered
+ * rows, they compress about as well as a full search, and faster). Each band
+ * ends with a full flush, so that the bands are independent parts of a single
+ * zlib stream, and the first row of a band only uses the filters that do not
+ * need the row above (None and Sub). A private chunk (bnDS, before the image
+ * data) records the first row of each band and its offset in the zlib stream.
+ *
+ * When loading an image holding this chunk, the bands are decompressed and
+ * unfiltered by several threads; any other image (or if the chunk does not match
+ * the data) is decompressed as a single stream, a few rows at a time.
+ *
+ * load_image, load_image_head and write_image choose the format: the PNG
+ * signature when reading, the .png extension when writing (binary PPM
+ * otherwise).
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "png.h"
+#include "scheduler.h"
+
+#define PNG_BAND_ROWS 256
+#define PNG_INFLATE_ROWS 32
+#define PNG_LEVEL 1
+#define PNG_STRATEGY Z_RLE
+#define PNG_BPP 3
+#define PNG_MAX_THREADS 64
+#define NB_FILTERS 5
+
+static const uint8_t png_signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+// Zlib header of the stream: deflate with a 32 KiB window, fast compression
+static const uint8_t zlib_header[2] = { 0x78, 0x5E };
+
+/***********************************************************
+ * A band of rows of an image, compressed or decompressed by
+ * a thread
+ * @param img the image
+ * @param first_row index of the first row of the band
+ * @param nb_rows number of rows of the band
+ * @param last true for the last band of the image
+ * @param data the compressed band (allocated when writing,
+ *             inside the image data when loading)
+ * @param size size of data in bytes
+ * @param adler Adler-32 of the filtered rows (writing)
+ * @param crc CRC-32 of the IDAT chunk holding data (writing)
+ * @param ok false if the band could not be done
+ ***********************************************************/
+typedef struct band_st {
+	img_t *img;
+	int first_row;
+	int nb_rows;
+	bool last;
+	uint8_t *data;
+	size_t size;
+	uLong adler;
+	uLong crc;
+	bool ok;
+} band_t;
+
+/***********************************************************
+ * Bands shared by the threads, drawn from a work queue
+ * (see scheduler.h)
+ * @param bands the bands
+ * @param queue the queue drawing the bands
+ * @param routine the routine doing a band
+ ***********************************************************/
+typedef struct band_job_st {
+	band_t *bands;
+	work_queue_t queue;
+	void (*routine)(band_t *);
+} band_job_t;
+
+/***********************************************************
+ * Read a 32-bit big endian number
+ * @param p pointer to the first byte
+ * @return the number
+ ***********************************************************/
+static uint32_t get32(const uint8_t *p){
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/***********************************************************
+ * Write a 32-bit big endian number
+ * @param p pointer to the first byte
+ * @param v the number
+ ***********************************************************/
+static void put32(uint8_t *p, uint32_t v){
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/***********************************************************
+ * A thread of a job
+ * @param job the job
+ * @param index index of the thread
+ ***********************************************************/
+typedef struct band_param_st {
+	band_job_t *job;
+	int index;
+} band_param_t;
+
+/***********************************************************
+ * Thread doing the bands of a job until none is left
+ * @param param see the struct band_param_t
+ * @return NULL
+ ***********************************************************/
+static void *band_thread(void *param){
+	band_param_t *p = param;
+	size_t b;
+	while(next_chunk(&p->job->queue, p->index, &b))
+		p->job->routine(&p->job->bands[b]);
+	return NULL;
+}
+
+/***********************************************************
+ * Do the bands of an image with a thread per processor (at
+ * most), the calling thread being one of them
+ * @param routine the routine doing a band
+ * @param bands the bands
+ * @param nb_bands number of bands
+ ***********************************************************/
+static void run_bands(void (*routine)(band_t *), band_t *bands, int nb_bands){
+	pthread_t threads[PNG_MAX_THREADS];
+	band_param_t param[PNG_MAX_THREADS];
+	band_job_t job = { bands, { 0 }, routine };
+	long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int nb_threads = nb_cpu < nb_bands ? nb_cpu : nb_bands, started = 0;
+
+	if(nb_threads > PNG_MAX_THREADS)
+		nb_threads = PNG_MAX_THREADS;
+	init_work_queue(&job.queue, nb_bands, nb_threads);
+	for (int i = 0; i < nb_threads; i++)
+		param[i] = (band_param_t){ &job, i };
+	while(started + 1 < nb_threads &&
+	      pthread_create(&threads[started], NULL, band_thread, &param[started + 1]) == 0)
+		started++;
+	band_thread(&param[0]);
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free_work_queue(&job.queue);
+}
+
+/***********************************************************
+ * Paeth predictor of the PNG filters
+ * @param a the byte on the left
+ * @param b the byte above
+ * @param c the byte above on the left
+ * @return the one of a, b and c closest to a + b - c
+ ***********************************************************/
+static inline int paeth(int a, int b, int c){
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if(pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+/***********************************************************
+ * Filter a row with a filter type, the bytes on the left
+ * of the first pixel and the row above the first row being
+ * zeros
+ * @param type the filter type (0 to 4)
+ * @param row the row
+ * @param prev the row above, or NULL for a row of zeros
+ *             (only for the types 0 and 1)
+ * @param stride number of bytes of a row
+ * @param f receives the filtered row
+ ***********************************************************/
+static void filter_type(int type, const uint8_t *row, const uint8_t *prev, size_t stride, uint8_t *f){
+	size_t i = 0;
+
+	switch(type){
+		case 0:
+			memcpy(f, row, stride);
+			break;
+		case 1:
+			for (; i < PNG_BPP; i++)
+				f[i] = row[i];
+			for (; i < stride; i++)
+				f[i] = row[i] - row[i - PNG_BPP];
+			break;
+		case 2:
+			for (; i < stride; i++)
+				f[i] = row[i] - prev[i];
+			break;
+		case 3:
+			for (; i < PNG_BPP; i++)
+				f[i] = row[i] - (prev[i] >> 1);
+			for (; i < stride; i++)
+				f[i] = row[i] - ((row[i - PNG_BPP] + prev[i]) >> 1);
+			break;
+		default:
+			for (; i < PNG_BPP; i++)
+				f[i] = row[i] - prev[i];
+			for (; i < stride; i++)
+				f[i] = row[i] - paeth(row[i - PNG_BPP], prev[i], prev[i - PNG_BPP]);
+	}
+}
+
+/***********************************************************
+ * Filter a row with the filter type giving the smallest sum
+ * of the filtered bytes (as signed values), the usual guess
+ * of the one compressing best
+ * @param row the row
+ * @param prev the row above, or NULL to use only the filter
+ *             types that do not need it (None and Sub)
+ * @param stride number of bytes of a row
+ * @param out receives the filter type and the filtered row
+ * @param scratch room for NB_FILTERS filtered rows
+ ***********************************************************/
+static void filter_row(const uint8_t *row, const uint8_t *prev, size_t stride, uint8_t *out, uint8_t *scratch){
+	int best = 0;
+	unsigned long best_sum = 0;
+
+	for (int type = 0; type < (prev ? NB_FILTERS : 2); type++){
+		uint8_t *f = scratch + type * stride;
+		unsigned long sum = 0;
+		filter_type(type, row, prev, stride, f);
+		for (size_t i = 0; i < stride; i++)
+			sum += abs((int8_t)f[i]);
+		if(type == 0 || sum < best_sum){
+			best = type;
+			best_sum = sum;
+		}
+	}
+	out[0] = best;
+	memcpy(out + 1, scratch + best * stride, stride);
+}
+
+/***********************************************************
+ * Unfilter a row
+ * @param f the filter type and the filtered row
+ * @param out receives the row
+ * @param prev the row above, or NULL for a row of zeros
+ * @param stride number of bytes of a row
+ * @return false if the filter type is not valid
+ ***********************************************************/
+static bool unfilter_row(const uint8_t *f, uint8_t *out, const uint8_t *prev, size_t stride){
+	int type = f[0];
+	size_t i = 0;
+
+	f++;
+    // Without the row above, Up is None, Average and Paeth are Sub (Average halved)
+	if(!prev && type == 2)
+		type = 0;
+	switch(type){
+		case 0:
+			memcpy(out, f, stride);
+			break;
+		case 1:
+			for (; i < PNG_BPP; i++)
+				out[i] = f[i];
+			for (; i < stride; i++)
+				out[i] = f[i] + out[i - PNG_BPP];
+			break;
+		case 2:
+			for (; i < stride; i++)
+				out[i] = f[i] + prev[i];
+			break;
+		case 3:
+			for (; i < PNG_BPP; i++)
+				out[i] = f[i] + (prev ? prev[i] >> 1 : 0);
+			for (; i < stride; i++)
+				out[i] = f[i] + ((out[i - PNG_BPP] + (prev ? prev[i] : 0)) >> 1);
+			break;
+		case 4:
+			for (; i < PNG_BPP; i++)
+				out[i] = f[i] + (prev ? prev[i] : 0);
+			for (; i < stride; i++)
+				out[i] = f[i] + (prev ? paeth(out[i - PNG_BPP], prev[i], prev[i - PNG_BPP]) : out[i - PNG_BPP]);
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+/***********************************************************
+ * Filter and compress a band (run by the threads)
+ * @param b the band
+ ***********************************************************/
+static void compress_band(band_t *b){
+	size_t stride = (size_t)b->img->width * PNG_BPP;
+	size_t raw_size = (size_t)b->nb_rows * (stride + 1);
+	uint8_t *raw = malloc(raw_size);
+	uint8_t *scratch = malloc(NB_FILTERS * stride);
+	z_stream z;
+
+	b->ok = false;
+	memset(&z, 0, sizeof(z));
+	if(!raw || !scratch || deflateInit2(&z, PNG_LEVEL, Z_DEFLATED, -15, 8, PNG_STRATEGY) != Z_OK){
+		free(raw);
+		free(scratch);
+		return;
+	}
+
+    // The first row of the band does not use the row above (see the file doc)
+	for (int r = 0; r < b->nb_rows; r++){
+		const uint8_t *row = &b->img->pix[b->first_row + r][0].r;
+		filter_row(row, r > 0 ? row - stride : NULL, stride, raw + r * (stride + 1), scratch);
+	}
+	b->adler = adler32_z(adler32(0, Z_NULL, 0), raw, raw_size);
+
+    // A full flush ends the band at a byte boundary, without reference to it
+	b->size = deflateBound(&z, raw_size) + 64;
+	b->data = malloc(b->size);
+	if(b->data){
+		z.next_in = raw;
+		z.avail_in = raw_size;
+		z.next_out = b->data;
+		z.avail_out = b->size;
+		int ret = deflate(&z, b->last ? Z_FINISH : Z_FULL_FLUSH);
+		b->ok = b->last ? ret == Z_STREAM_END : ret == Z_OK && z.avail_in == 0 && z.avail_out > 0;
+		b->size = z.total_out;
+		b->crc = crc32_z(crc32(0, (const Bytef *)"IDAT", 4), b->data, b->size);
+	}
+	deflateEnd(&z);
+	free(scratch);
+	free(raw);
+}
+
+/***********************************************************
+ * Decompress and unfilter rows of an image
+ * @param z the zlib stream, positioned on the first row
+ * @param img the image receiving the rows
+ * @param first_row index of the first row
+ * @param nb_rows number of rows
+ * @param independent true if the first row must not use
+ *                    the row above (a band of the bnDS
+ *                    chunk, done by a thread)
+ * @return false if the data is not valid
+ ***********************************************************/
+static bool inflate_rows(z_stream *z, img_t *img, int first_row, int nb_rows, bool independent){
+	size_t stride = (size_t)img->width * PNG_BPP;
+	uint8_t *buf = malloc(PNG_INFLATE_ROWS * (stride + 1));
+	bool ok = buf != NULL;
+
+	for (int r = 0; ok && r < nb_rows; r += PNG_INFLATE_ROWS){
+		int k = nb_rows - r < PNG_INFLATE_ROWS ? nb_rows - r : PNG_INFLATE_ROWS;
+		z->next_out = buf;
+		z->avail_out = k * (stride + 1);
+		while(ok && z->avail_out > 0){
+			int ret = inflate(z, Z_NO_FLUSH);
+			if(ret == Z_STREAM_END)
+				break;
+			ok = ret == Z_OK;
+		}
+		ok = ok && z->avail_out == 0;
+
+		for (int j = 0; ok && j < k; j++){
+			int row = first_row + r + j;
+			const uint8_t *f = buf + j * (stride + 1);
+			bool first = r + j == 0 && independent;
+			if(first && f[0] > 1)
+				ok = false;
+			else
+				ok = unfilter_row(f, &img->pix[row][0].r, row > 0 && !first ? &img->pix[row - 1][0].r : NULL,
+				                  stride);
+		}
+	}
+	free(buf);
+	return ok;
+}
+
+/***********************************************************
+ * Decompress and unfilter a band (run by the threads)
+ * @param b the band
+ ***********************************************************/
+static void inflate_band(band_t *b){
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+	b->ok = inflateInit2(&z, -15) == Z_OK;
+	if(!b->ok)
+		return;
+	z.next_in = b->data;
+	z.avail_in = b->size;
+	b->ok = inflate_rows(&z, b->img, b->first_row, b->nb_rows, true);
+	inflateEnd(&z);
+}
+
+/***********************************************************
+ * Check if a file is a PNG image, from its signature
+ * @param filename the path of the file
+ * @return true if the file starts with the PNG signature
+ ***********************************************************/
+bool is_png(const char *filename){
+	uint8_t sig[sizeof(png_signature)];
+	FILE *f = fopen(filename, "r");
+	if(!f)
+		return false;
+	bool ok = fread(sig, 1, sizeof(sig), f) == sizeof(sig) && memcmp(sig, png_signature, sizeof(sig)) == 0;
+	fclose(f);
+	return ok;
+}
+
+/***********************************************************
+ * Cut the image data in the bands recorded by the bnDS
+ * chunk
+ * @param chunk the content of the chunk
+ * @param len size of the chunk
+ * @param img the image
+ * @param idat the image data (zlib stream)
+ * @param idat_size size of the image data
+ * @param nb_bands receives the number of bands
+ * @return the bands (to free), NULL if the chunk does not
+ *         match the image
+ ***********************************************************/
+static band_t *read_bands(const uint8_t *chunk, size_t len, img_t *img, uint8_t *idat, size_t idat_size,
+                          int *nb_bands){
+	if(len < 4 || idat_size < sizeof(zlib_header) + 4)
+		return NULL;
+	uint32_t n = get32(chunk);
+	if(n == 0 || n > (uint32_t)img->height || len != 4 + 8 * (size_t)n)
+		return NULL;
+	band_t *bands = calloc(n, sizeof(band_t));
+	if(!bands)
+		return NULL;
+
+	size_t end = idat_size - 4;
+	for (uint32_t i = 0; i < n; i++){
+		uint32_t row = get32(chunk + 4 + 8 * i), offset = get32(chunk + 8 + 8 * i);
+		uint32_t next_row = i + 1 < n ? get32(chunk + 12 + 8 * i) : (uint32_t)img->height;
+		size_t next_offset = i + 1 < n ? get32(chunk + 16 + 8 * i) : end;
+		if((i == 0 && (row != 0 || offset != sizeof(zlib_header))) || next_row <= row ||
+		   next_row > (uint32_t)img->height || next_offset < offset || next_offset > end){
+			free(bands);
+			return NULL;
+		}
+		bands[i] = (band_t){ img, row, next_row - row, i + 1 == n, idat + offset, next_offset - offset, 0, 0, false };
+	}
+	*nb_bands = n;
+	return bands;
+}
+
+/***********************************************************
+ * Load an 8-bit RGB PNG image
+ * @param filename the path of the image
+ * @return the image, or NULL if it cannot be read or is
+ *         not supported
+ ***********************************************************/
+img_t *load_png(const char *filename){
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(png_signature)){
+		if(fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	size_t size = st.st_size;
+	uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(file == MAP_FAILED)
+		return NULL;
+
+    // Check the chunks, and gather the size of the image data
+	img_t *img = NULL;
+	const uint8_t *bands_chunk = NULL;
+	size_t bands_len = 0, idat_size = 0;
+	bool ok = memcmp(file, png_signature, sizeof(png_signature)) == 0, end = false;
+	for (size_t pos = sizeof(png_signature); ok && !end; ){
+		ok = size - pos >= 12 && get32(file + pos) <= size - pos - 12;
+		if(!ok)
+			break;
+		size_t len = get32(file + pos);
+		const uint8_t *type = file + pos + 4, *body = file + pos + 8;
+		ok = crc32_z(0, type, len + 4) == get32(body + len);
+		if(ok && memcmp(type, "IHDR", 4) == 0){
+			ok = !img && len == 13 && body[8] == 8 && body[9] == 2 && body[10] == 0 && body[11] == 0 &&
+			     body[12] == 0 && get32(body) > 0 && get32(body) <= INT32_MAX / PNG_BPP &&
+			     get32(body + 4) > 0 && get32(body + 4) <= INT32_MAX;
+			if(!ok)
+				fprintf(stderr, "PNG reader: only 8-bit RGB images without interlacing are supported!\n");
+			else
+				img = alloc_img(get32(body), get32(body + 4));
+			ok = ok && img;
+		}else if(ok && memcmp(type, "IDAT", 4) == 0)
+			idat_size += len;
+		else if(ok && memcmp(type, "bnDS", 4) == 0){
+			bands_chunk = body;
+			bands_len = len;
+		}else if(ok && memcmp(type, "IEND", 4) == 0)
+			end = true;
+		else if(ok && memcmp(type, "PLTE", 4) != 0)
+			ok = (type[0] & 0x20) != 0;
+		ok = ok && (img || memcmp(type, "IHDR", 4) == 0);
+		pos += len + 12;
+	}
+	ok = ok && end && idat_size > 0;
+
+    // Gather the image data (it may be cut in several chunks)
+	uint8_t *idat = ok ? malloc(idat_size) : NULL;
+	ok = idat != NULL;
+	for (size_t pos = sizeof(png_signature), done = 0; ok && done < idat_size; pos += get32(file + pos) + 12){
+		if(memcmp(file + pos + 4, "IDAT", 4) == 0){
+			memcpy(idat + done, file + pos + 8, get32(file + pos));
+			done += get32(file + pos);
+		}
+	}
+
+    // The bands are done by the threads, or the data is one stream
+	int nb_bands = 0;
+	bool decoded = false;
+	band_t *bands = ok && bands_chunk ? read_bands(bands_chunk, bands_len, img, idat, idat_size, &nb_bands) : NULL;
+	if(bands){
+		run_bands(inflate_band, bands, nb_bands);
+		decoded = true;
+		for (int i = 0; i < nb_bands; i++)
+			decoded = decoded && bands[i].ok;
+		free(bands);
+	}
+	if(ok && !decoded){
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		ok = inflateInit(&z) == Z_OK;
+		if(ok){
+			z.next_in = idat;
+			z.avail_in = idat_size;
+			ok = inflate_rows(&z, img, 0, img->height, false);
+			inflateEnd(&z);
+		}
+	}
+
+	free(idat);
+	munmap(file, size);
+	if(!ok && img){
+		fprintf(stderr, "PNG reader: invalid image data!\n");
+		free_img(img);
+		return NULL;
+	}
+	return ok ? img : NULL;
+}
+
+/***********************************************************
+ * Write a chunk of a PNG image
+ * @param f the image file
+ * @param type the type of the chunk (4 chars)
+ * @param data the content of the chunk
+ * @param len size of the content
+ * @param crc CRC-32 of the type and the content, or 0 to
+ *            compute it
+ * @return false if the chunk cannot be written
+ ***********************************************************/
+static bool write_chunk(FILE *f, const char *type, const uint8_t *data, size_t len, uLong crc){
+	uint8_t head[8], tail[4];
+
+    // zlib gives 0 as the CRC of a NULL buffer, whatever the CRC before it
+	if(!crc)
+		crc = len ? crc32_z(crc32(0, (const Bytef *)type, 4), data, len) : crc32(0, (const Bytef *)type, 4);
+	put32(head, len);
+	memcpy(head + 4, type, 4);
+	put32(tail, crc);
+	return fwrite(head, 1, 8, f) == 8 && fwrite(data, 1, len, f) == len && fwrite(tail, 1, 4, f) == 4;
+}
+
+/***********************************************************
+ * Write an image as an 8-bit RGB PNG image, its bands being
+ * compressed by several threads
+ * @param filename the path of the image
+ * @param img the image
+ * @return false if the image cannot be written
+ ***********************************************************/
+bool write_png(const char *filename, img_t *img){
+	int nb_bands = (img->height + PNG_BAND_ROWS - 1) / PNG_BAND_ROWS;
+	band_t *bands = calloc(nb_bands, sizeof(band_t));
+	uint8_t *table = malloc(4 + 8 * (size_t)nb_bands);
+	if(!bands || !table){
+		free(bands);
+		free(table);
+		return false;
+	}
+	for (int i = 0; i < nb_bands; i++){
+		bands[i].img = img;
+		bands[i].first_row = i * PNG_BAND_ROWS;
+		bands[i].nb_rows = img->height - i * PNG_BAND_ROWS < PNG_BAND_ROWS ? img->height - i * PNG_BAND_ROWS :
+		                   PNG_BAND_ROWS;
+		bands[i].last = i == nb_bands - 1;
+	}
+	run_bands(compress_band, bands, nb_bands);
+
+    // The Adler-32 of the bands combined give the one of the stream, and their
+    // offsets in the stream go into the bnDS chunk
+	size_t stride = (size_t)img->width * PNG_BPP;
+	uLong adler = adler32(0, Z_NULL, 0);
+	size_t offset = sizeof(zlib_header);
+	bool ok = true;
+	put32(table, nb_bands);
+	for (int i = 0; i < nb_bands; i++){
+		ok = ok && bands[i].ok && offset <= UINT32_MAX;
+		adler = adler32_combine(adler, bands[i].adler, (size_t)bands[i].nb_rows * (stride + 1));
+		put32(table + 4 + 8 * i, bands[i].first_row);
+		put32(table + 8 + 8 * i, offset);
+		offset += bands[i].size;
+	}
+
+	uint8_t ihdr[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 8, 2, 0, 0, 0 }, trailer[4];
+	put32(ihdr, img->width);
+	put32(ihdr + 4, img->height);
+	put32(trailer, adler);
+	FILE *f = ok ? fopen(filename, "w") : NULL;
+	ok = f && fwrite(png_signature, 1, sizeof(png_signature), f) == sizeof(png_signature) &&
+	     write_chunk(f, "IHDR", ihdr, sizeof(ihdr), 0) &&
+	     write_chunk(f, "bnDS", table, 4 + 8 * (size_t)nb_bands, 0) &&
+	     write_chunk(f, "IDAT", zlib_header, sizeof(zlib_header), 0);
+	for (int i = 0; ok && i < nb_bands; i++)
+		ok = write_chunk(f, "IDAT", bands[i].data, bands[i].size, bands[i].crc);
+	ok = ok && write_chunk(f, "IDAT", trailer, sizeof(trailer), 0) && write_chunk(f, "IEND", NULL, 0, 0);
+	if(f)
+		ok = fclose(f) == 0 && ok;
+
+	for (int i = 0; i < nb_bands; i++)
+		free(bands[i].data);
+	free(bands);
+	free(table);
+	return ok;
+}
+
+/***********************************************************
+ * Load an image, PNG or PPM (from its signature)
+ * @param filename the path of the image
+ * @return the image, or NULL if it cannot be read
+ ***********************************************************/
+img_t *load_image(char *filename){
+	return is_png(filename) ? load_png(filename) : load_ppm(filename);
+}
+
+/***********************************************************
+ * Load the first components of an image (see
+ * load_ppm_head), a PNG image being loaded whole
+ * @param filename the path of the image
+ * @param nb_comp number of components needed
+ * @param height receives the height of the whole image
+ * @return the image, or NULL if it cannot be read
+ ***********************************************************/
+img_t *load_image_head(char *filename, size_t nb_comp, int *height){
+	if(!is_png(filename))
+		return load_ppm_head(filename, nb_comp, height);
+	img_t *img = load_png(filename);
+	if(img)
+		*height = img->height;
+	return img;
+}
+
+/***********************************************************
+ * Get the size of an image without loading its pixels
+ * (from the IHDR chunk of a PNG image, the first row of a
+ * PPM image)
+ * @param filename the path of the image
+ * @param width receives the width of the image
+ * @param height receives the height of the image
+ * @return false if the image cannot be read
+ ***********************************************************/
+bool image_size(char *filename, int *width, int *height){
+	if(!is_png(filename)){
+		img_t *img = load_ppm_head(filename, 1, height);
+		if(!img)
+			return false;
+		*width = img->width;
+		free_img(img);
+		return true;
+	}
+	uint8_t head[sizeof(png_signature) + 16];
+	FILE *f = fopen(filename, "r");
+	bool ok = f && fread(head, 1, sizeof(head), f) == sizeof(head) &&
+	          memcmp(head + sizeof(png_signature) + 4, "IHDR", 4) == 0;
+	if(f)
+		fclose(f);
+	if(ok){
+		*width = get32(head + sizeof(png_signature) + 8);
+		*height = get32(head + sizeof(png_signature) + 12);
+	}
+	return ok && *width > 0 && *height > 0;
+}
+
+/***********************************************************
+ * Write an image, as PNG if its name ends with .png, as
+ * binary PPM otherwise
+ * @param filename the path of the image
+ * @param img the image
+ * @return false if the image cannot be written
+ ***********************************************************/
+bool write_image(char *filename, img_t *img){
+	size_t len = strlen(filename);
+	if(len >= 4 && strcasecmp(filename + len - 4, ".png") == 0)
+		return write_png(filename, img);
+	return write_ppm(filename, img, PPM_BINARY);
+}
@@ -0,0 +1,22 @@
+/************************************************************************************
+ * @file png.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 17 Dec 2017
+ * @brief Read and write 8-bit RGB PNG images, and images of either format
+ ***********************************************************************************/
+#ifndef PNG_H
+#define PNG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ppm.h"
+
+bool is_png(const char *filename);
+img_t *load_png(const char *filename);
+bool write_png(const char *filename, img_t *img);
+img_t *load_image(char *filename);
+img_t *load_image_head(char *filename, size_t nb_comp, int *height);
+bool image_size(char *filename, int *width, int *height);
+bool write_image(char *filename, img_t *img);
+
+#endif
@@ -10,84 +10,471 @@
  * convert image.jpg output.ppm
  * To convert a JPG image into a plain ASCII PPM file (P3) with ImageMagick:
  * convert -compress none image.jpg output.ppm
+ *
+ * Binary (P6) files are memory-mapped whenever possible: the pixel data of a loaded
+ * image points directly into a private mapping of the file, and written images are
+ * sized with ftruncate and filled through a shared mapping. When the file cannot be
+ * mapped (pipes, special files, ...), a single bulk read or write is used instead.
+ *
+ * The body of plain ASCII (P3) files is read at once (mapped or read in large
+ * blocks) and parsed by several threads, each one parsing a chunk of the body cut
+ * at whitespace boundaries: a first pass counts the values of each chunk, so that
+ * every thread knows the index of its first component, then a second pass parses
+ * the values straight into the image.
+ *
+ * ASCII images are written by slabs of pixels (whole lines of 5 pixels), each
+ * thread formatting a slab into its own buffer with a table of the 256 values;
+ * the buffers are then written in order, a large write per slab.
+ *
+ * An allocated image is a single block holding the img_t, the row accessor and
+ * the 64-byte aligned pixel data; the blocks of 2 MiB or more are mapped and
+ * backed by transparent huge pages when possible. The blocks are sized by
+ * classes (powers of two) and a freed block is kept in a small pool (at most
+ * POOL_PER_CLASS blocks per class, POOL_MAX_BYTES in total) to be reused by
+ * the next image of the same class, whose pages are then already in memory.
+ *
+ * load_ppm_head reads only the first rows of a binary image, for the readers that
+ * need a known number of components (such as the header and the hidden text).
+ *
+ * The bands of a streamed image are read and written either in turn (read_ppm_band,
+ * write_ppm_band) or through an asynchronous queue (submit_ppm_band, see aio.h), at
+ * their offset in the file, so that several bands are transferred while the caller
+ * works on another one.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "ppm.h"
+#include "aio.h"
+
+#define P3_MIN_CHUNK (1 << 20)
+#define P3_MAX_THREADS 64
+#define P3_READ_BLOCK (1 << 20)
+#define P3_PIXELS_PER_LINE 5
+#define P3_SLAB_PIXELS (10000 * P3_PIXELS_PER_LINE)
+#define P3_MAX_PIXEL_CHARS 12
+#define IMG_ALIGN 64
+#define HUGE_PAGE_SIZE (2 << 20)
+#define MIN_CLASS 12
+#define POOL_CLASSES 48
+#define POOL_PER_CLASS 2
+#define POOL_MAX_BYTES ((size_t)1 << 30)
+
+/**
+ * Pool of the freed image blocks, by size class.
+ * @param lock protects the pool (images are allocated and freed by several threads)
+ * @param blocks the blocks of each class
+ * @param count number of blocks of each class
+ * @param bytes total size in bytes of the blocks
+ */
+static struct {
+	pthread_mutex_t lock;
+	void *blocks[POOL_CLASSES][POOL_PER_CLASS];
+	int count[POOL_CLASSES];
+	size_t bytes;
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * Chunk of the body of an ASCII (P3) image parsed by a thread.
+ * @param begin first character of the chunk
+ * @param end character after the chunk
+ * @param comp the components of the image
+ * @param nb_comp number of components of the image
+ * @param first index of the first value of the chunk
+ * @param count number of values of the chunk
+ * @param maxval the maximum value per component
+ * @param ok false if an invalid value was found
+ */
+typedef struct p3_chunk_st {
+	const char *begin, *end;
+	uint8_t *comp;
+	size_t nb_comp;
+	size_t first;
+	size_t count;
+	unsigned int maxval;
+	bool ok;
+} p3_chunk_t;
+
+/**
+ * Slab of pixels of an ASCII (P3) image formatted by a thread.
+ * @param pix the first pixel of the slab (the index of which is a multiple
+ *            of P3_PIXELS_PER_LINE)
+ * @param nb_pix number of pixels of the slab
+ * @param buf receives the formatted pixels
+ * @param len number of characters formatted
+ */
+typedef struct p3_slab_st {
+	const pixel_t *pix;
+	size_t nb_pix;
+	char *buf;
+	size_t len;
+} p3_slab_t;
+
+// Each value formatted as in "%d " (at most 4 characters), and its number of characters
+static char p3_values[256][5];
+static uint8_t p3_values_len[256];
+
+/**
+ * Fill the table of the formatted values (run once at startup).
+ */
+__attribute__((constructor))
+static void init_p3_values(void) {
+	for (int v = 0; v < 256; v++)
+		p3_values_len[v] = snprintf(p3_values[v], sizeof(p3_values[v]), "%d ", v);
+}
+
+/**
+ * Internal routine to run a routine on items, a thread per item. The first
+ * item, and the ones whose thread could not be created, are done by the caller.
+ * @param routine the routine
+ * @param items the items
+ * @param item_size size in bytes of an item
+ * @param nb_items number of items (at most P3_MAX_THREADS)
+ */
+static void run_p3_threads(void *(*routine)(void *), void *items, size_t item_size, int nb_items) {
+	pthread_t threads[P3_MAX_THREADS];
+	char *item = items;
+	int started = 0;
+	for (int i = 1; i < nb_items; i++) {
+		if (pthread_create(&threads[i], NULL, routine, item + i * item_size) != 0) break;
+		started++;
+	}
+	routine(item);
+	for (int i = started + 1; i < nb_items; i++)
+		routine(item + i * item_size);
+	for (int i = 1; i <= started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/**
+ * Internal routine giving the number of threads to use for a job.
+ * @param nb_parts number of parts of the job
+ * @return the number of threads, between 1 and P3_MAX_THREADS
+ */
+static int p3_threads(size_t nb_parts) {
+	long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nb = nb_cpu > 0 ? (size_t)nb_cpu : 1;
+	if (nb > nb_parts) nb = nb_parts > 0 ? nb_parts : 1;
+	return nb > P3_MAX_THREADS ? P3_MAX_THREADS : nb;
+}
 
 /**
- * Allocate the memory for an image of size width*height
+ * Thread formatting a slab of pixels of an ASCII (P3) image.
+ * @param arg the slab (see the struct p3_slab_t)
+ * @return NULL
+ */
+static void *format_p3_slab(void *arg) {
+	p3_slab_t *s = (p3_slab_t *)arg;
+	char *out = s->buf;
+	for (size_t i = 0; i < s->nb_pix; i++) {
+		const uint8_t *comp = &s->pix[i].r;
+		// The 4 characters are copied, only the characters of the value are kept
+		for (int c = 0; c < 3; c++) {
+			memcpy(out, p3_values[comp[c]], 4);
+			out += p3_values_len[comp[c]];
+		}
+		if ((i + 1) % P3_PIXELS_PER_LINE == 0)  // New line every 5 pixels (max 70 characters/line)
+			*out++ = '\n';
+	}
+	s->len = out - s->buf;
+	return NULL;
+}
+
+/**
+ * Internal routine to write the pixel data of a plain ASCII (P3) image, formatted
+ * in parallel by slabs (see p3_slab_t).
+ * @param f the file to write, positioned right after the header
+ * @param img a pointer to the image to write
+ * @return boolean value indicating whether the write succeeded or not
+ */
+static bool write_p3(FILE *f, img_t *img) {
+	size_t nb_pix = (size_t)img->width * img->height;
+	int nb_slabs = p3_threads((nb_pix + P3_SLAB_PIXELS - 1) / P3_SLAB_PIXELS);
+	size_t buf_size = P3_SLAB_PIXELS * P3_MAX_PIXEL_CHARS + P3_SLAB_PIXELS / P3_PIXELS_PER_LINE + 4;
+	p3_slab_t slabs[P3_MAX_THREADS];
+	bool ok = true;
+
+	char *bufs = malloc(buf_size * nb_slabs);
+	if (!bufs) return false;
+	for (int i = 0; i < nb_slabs; i++)
+		slabs[i].buf = bufs + i * buf_size;
+
+	for (size_t done = 0; ok && done < nb_pix; ) {
+		// A slab per thread..
+		int nb = 0;
+		for (; nb < nb_slabs && done < nb_pix; nb++) {
+			slabs[nb].pix = img->raw + done;
+			slabs[nb].nb_pix = nb_pix - done < P3_SLAB_PIXELS ? nb_pix - done : P3_SLAB_PIXELS;
+			done += slabs[nb].nb_pix;
+		}
+		run_p3_threads(format_p3_slab, slabs, sizeof(p3_slab_t), nb);
+
+		//.. written in order
+		for (int i = 0; ok && i < nb; i++)
+			ok = fwrite(slabs[i].buf, 1, slabs[i].len, f) == slabs[i].len;
+	}
+	free(bufs);
+	return ok;
+}
+
+/**
+ * Internal routine giving the size class of a block.
+ * @param size size in bytes of the block
+ * @return the class: the blocks of class c are 2^c bytes long
+ */
+static int size_class(size_t size) {
+	int c = MIN_CLASS;
+	while (((size_t)1 << c) < size)
+		c++;
+	return c;
+}
+
+/**
+ * Internal routine to allocate a block of a size class: aligned on IMG_ALIGN bytes,
+ * or mapped on a huge page boundary (and backed by huge pages if possible) for the
+ * large classes.
+ * @param size size in bytes of the block (a power of two)
+ * @return the block or NULL if the allocation failed
+ */
+static void *new_block(size_t size) {
+	if (size < HUGE_PAGE_SIZE) {
+		void *block;
+		return posix_memalign(&block, IMG_ALIGN, size) == 0 ? block : NULL;
+	}
+
+	// Map a huge page more than needed, then unmap what is before and after the boundary
+	uint8_t *map = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) return NULL;
+	uint8_t *block = (uint8_t *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	if (block > map) munmap(map, block - map);
+	munmap(block + size, map + HUGE_PAGE_SIZE - block);
+	madvise(block, size, MADV_HUGEPAGE);
+	return block;
+}
+
+/**
+ * Allocate the memory for an image of size width*height, reusing a block of the
+ * pool when one of the right class is available
  * @param width the width of the image to allocate
  * @param height the height of the image to allocate
  * @return a pointer to the allocated image or NULL if the allocation failed
  */
 img_t *alloc_img(int width, int height) {
-	img_t *img = malloc(sizeof(img_t));
-	if (!img) return NULL;
+	// The img_t, the row accessor then the pixel data, aligned
+	size_t pix_offset = (sizeof(img_t) + sizeof(pixel_t *) * height + IMG_ALIGN - 1) & ~(size_t)(IMG_ALIGN - 1);
+	int c = size_class(pix_offset + sizeof(pixel_t) * width * height);
+	if (c >= POOL_CLASSES) return NULL;
+
+	void *block = NULL;
+	pthread_mutex_lock(&pool.lock);
+	if (pool.count[c] > 0) {
+		block = pool.blocks[c][--pool.count[c]];
+		pool.bytes -= (size_t)1 << c;
+	}
+	pthread_mutex_unlock(&pool.lock);
+	if (!block) block = new_block((size_t)1 << c);
+	if (!block) return NULL;
+
+	img_t *img = block;
 	img->width = width;
 	img->height = height;
-	img->raw = malloc(sizeof(pixel_t) * width * height);
-	if (!img->raw) {
+	img->map = NULL;
+	img->map_size = 0;
+	img->block_size = (size_t)1 << c;
+	img->pix = (pixel_t **)(img + 1);
+	img->raw = (pixel_t *)((uint8_t *)block + pix_offset);
+	for (int i = 0; i < height; i++)
+		img->pix[i] = img->raw + width*i;
+	return img;
+}
+
+/**
+ * Free an allocated image (its block may be kept in the pool for the next image).
+ * @param img a pointer to the image to free
+ */
+void free_img(img_t *img) {
+	if (img->map) {
+		munmap(img->map, img->map_size);
 		free(img);
-		return NULL;
+		return;
 	}
-	img->pix = malloc(sizeof(pixel_t*) * height);
-	if (!img->pix) {
-		free(img);
-		free(img->raw);
-		return NULL;
+
+	// Kept in the pool if there is room for it
+	size_t size = img->block_size;
+	int c = size_class(size);
+	pthread_mutex_lock(&pool.lock);
+	if (pool.count[c] < POOL_PER_CLASS && pool.bytes + size <= POOL_MAX_BYTES) {
+		pool.blocks[c][pool.count[c]++] = img;
+		pool.bytes += size;
+		img = NULL;
 	}
+	pthread_mutex_unlock(&pool.lock);
+	if (!img) return;
+	if (size < HUGE_PAGE_SIZE)
+		free(img);
+	else
+		munmap(img, size);
+}
+
+/**
+ * Internal routine to build the row accessor of an image whose pixel data is
+ * backed by a file mapping.
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param map base of the file mapping
+ * @param map_size size in bytes of the file mapping
+ * @param offset offset in bytes of the first pixel inside the mapping
+ * @return a pointer to the image or NULL if the allocation failed
+ */
+static img_t *mapped_img(int width, int height, void *map, size_t map_size, size_t offset) {
+	// The img_t and the row accessor in a single block
+	img_t *img = malloc(sizeof(img_t) + sizeof(pixel_t *) * height);
+	if (!img) return NULL;
+	img->width = width;
+	img->height = height;
+	img->map = map;
+	img->map_size = map_size;
+	img->block_size = 0;
+	img->raw = (pixel_t *)((uint8_t *)map + offset);
+	img->pix = (pixel_t **)(img + 1);
 	for (int i = 0; i < height; i++)
 		img->pix[i] = img->raw + width*i;
 	return img;
 }
 
 /**
- * Free an allocated image.
- * @param img a pointer to the image to free
+ * Internal routine to write the pixel data of a binary (P6) image.
+ * The file is sized with ftruncate and filled through a shared mapping; if it
+ * cannot be mapped, the pixel data is written with a single fwrite.
+ * @param f the file to write, positioned at the beginning
+ * @param img a pointer to the image to write
+ * @return boolean value indicating whether the write succeeded or not
  */
-void free_img(img_t *img) {
-	free(img->pix);
-	free(img->raw);
-	free(img);
+static bool write_p6(FILE *f, img_t *img) {
+	char header[64];
+	size_t header_size = snprintf(header, sizeof(header), "%s\n%d %d\n255\n", "P6", img->width, img->height);
+	size_t data_size = sizeof(pixel_t) * img->width * img->height;
+	int fd = fileno(f);
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && ftruncate(fd, header_size + data_size) == 0) {
+		void *map = mmap(NULL, header_size + data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			memcpy(map, header, header_size);
+			memcpy((uint8_t *)map + header_size, img->raw, data_size);
+			return munmap(map, header_size + data_size) == 0;
+		}
+	}
+
+	// Fallback: one bulk write of the whole pixel data
+	if (fwrite(header, 1, header_size, f) != header_size) return false;
+	return fwrite(img->raw, 1, data_size, f) == data_size;
+}
+
+/**
+ * Read now the whole pixel data of an image backed by a file mapping, instead of
+ * on the first access to each page. Does nothing for images allocated on the heap.
+ * @param img a pointer to the image
+ */
+void populate_img(img_t *img) {
+	if (!img->map) return;
+	madvise(img->map, img->map_size, MADV_WILLNEED);
+	long page = sysconf(_SC_PAGESIZE);
+	volatile uint8_t *ptr = img->map;
+	for (size_t i = 0; i < img->map_size; i += page)
+		(void)ptr[i];
+}
+
+/**
+ * Create an empty temporary file next to a file, with the same permissions, to be
+ * written instead of it and then to replace it (see finish_output).
+ * @param filename (absolute or relative path) of the file to replace
+ * @return the path of the temporary file (to free) or NULL if an error occured
+ */
+char *temp_output(const char *filename) {
+	struct stat st;
+	char *temp = malloc(strlen(filename) + 8);
+	if (!temp) return NULL;
+	sprintf(temp, "%s.XXXXXX", filename);
+	int fd = mkstemp(temp);
+	if (fd < 0) {
+		free(temp);
+		return NULL;
+	}
+	if (stat(filename, &st) == 0) fchmod(fd, st.st_mode & 07777);
+	close(fd);
+	return temp;
+}
+
+/**
+ * Replace a file by its temporary file once written (see temp_output), or remove
+ * the temporary file if the write failed.
+ * @param temp the path of the temporary file, or NULL if the file itself was written
+ * @param filename (absolute or relative path) of the file to replace
+ * @param ok boolean value indicating whether the write succeeded or not
+ * @return boolean value indicating whether the file is replaced (ok if temp is NULL)
+ */
+bool finish_output(char *temp, const char *filename, bool ok) {
+	if (!temp) return ok;
+	if (ok) ok = rename(temp, filename) == 0;
+	if (!ok) unlink(temp);
+	free(temp);
+	return ok;
+}
+
+/**
+ * Give the temporary file to write instead of the file backing the mapping of an
+ * image: truncating it would destroy the pixels of the image (such as when the
+ * output image is the input image).
+ * @param img a pointer to the image to write
+ * @param filename (absolute or relative path) of the image to write
+ * @param temp receives the temporary file (see temp_output) or NULL if filename
+ *             does not back the image
+ * @return false if the temporary file cannot be created
+ */
+bool img_output(img_t *img, const char *filename, char **temp) {
+	struct stat st;
+	*temp = NULL;
+	if (!img->map || stat(filename, &st) != 0 || st.st_dev != img->dev || st.st_ino != img->ino)
+		return true;
+	*temp = temp_output(filename);
+	return *temp != NULL;
 }
 
 /**
  * Write a 24-bit RGB PPM file (either ASCII P3 type or binary P6 type).
+ * An image mapped from the file it is written to is written into a temporary
+ * file first, which then replaces it.
  * @param filename (absolute or relative path) of the image to write
  * @param img a pointer to the image to write
  * @param PPM_TYPE the type of the image to write (binary or ASCII)
  * @return boolean value indicating whether the write succeeded or not
  */
 bool write_ppm(char *filename, img_t *img, enum PPM_TYPE type) {
-	FILE *f = fopen(filename, "w");
-	if (!f) return false;
+	char *temp;
+	if (!img_output(img, filename, &temp)) return false;
 
-	if (type == PPM_BINARY) {
-		fprintf(f, "%s\n%d %d\n255\n", "P6", img->width, img->height);
-		// Write image content
-		for (int i = 0; i < img->width * img->height; i++) {
-			pixel_t *p = &img->raw[i];
-			fwrite(&p->r, sizeof(p->r), 1, f);
-			fwrite(&p->g, sizeof(p->g), 1, f);
-			fwrite(&p->b, sizeof(p->b), 1, f);
-		}
-	} else {
+	// Opened for reading too, so that the file can be mapped
+	FILE *f = fopen(temp ? temp : filename, "w+");
+	bool ok = f != NULL;
+
+	if (ok && type == PPM_BINARY) {
+		ok = write_p6(f, img);
+	} else if (ok) {
 		fprintf(f, "%s\n%d %d\n255\n", "P3", img->width, img->height);
 		// Write image content
-		int count = 0;
-		for (int i = 0; i < img->width * img->height; i++) {
-			pixel_t *p = &img->raw[i];
-			fprintf(f, "%d %d %d ", p->r, p->g, p->b);
-			if (++count % 5 == 0)  // New line every 5 pixels (max 70 characters/line)
-				fprintf(f, "\n");
-		}
+		ok = write_p3(f, img);
 	}
 
-	fclose(f);
-	return true;
+	if (f && fclose(f) != 0) ok = false;
+	return finish_output(temp, filename, ok);
 }
 
 /**
@@ -113,9 +500,10 @@ static FILE* load_header(char *filename, char *type, unsigned int *width, unsign
 	// Image width and height
 	matches = fscanf(f, "%u %u", width, height);
 	if (matches != 2) goto error;
-	// Maximum value per component
-	matches = fscanf(f, "%u ", maxval);
-	if (matches != 1) goto error;
+	// Maximum value per component, followed by a single whitespace: the binary
+	// data may start with bytes that look like whitespace
+	matches = fscanf(f, "%u", maxval);
+	if (matches != 1 || !isspace(fgetc(f))) goto error;
 	if (*maxval > 255) {
 		fprintf(stderr, "PPM reader: doesn't support more than 1 byte per component!\n");
 		goto error;
@@ -127,6 +515,212 @@ error:
 	return NULL;
 }
 
+/**
+ * Internal routine telling if a character separates the values of an ASCII
+ * image (same characters as isspace in the C locale).
+ * @param c the character
+ * @return true if c is a whitespace
+ */
+static inline bool is_p3_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * Thread counting the values of a chunk of an ASCII (P3) image body.
+ * @param arg the chunk (see the struct p3_chunk_t)
+ * @return NULL
+ */
+static void *count_p3_chunk(void *arg) {
+	p3_chunk_t *c = (p3_chunk_t *)arg;
+	size_t count = 0;
+	bool in_value = false;
+	for (const char *p = c->begin; p < c->end; p++) {
+		bool space = is_p3_space(*p);
+		count += !space && !in_value;
+		in_value = !space;
+	}
+	c->count = count;
+	return NULL;
+}
+
+/**
+ * Thread parsing the values of a chunk of an ASCII (P3) image body into the
+ * components of the image. Values after the last component are ignored.
+ * @param arg the chunk (see the struct p3_chunk_t)
+ * @return NULL
+ */
+static void *parse_p3_chunk(void *arg) {
+	p3_chunk_t *c = (p3_chunk_t *)arg;
+	const char *p = c->begin;
+	for (size_t i = c->first; i < c->nb_comp && i < c->first + c->count; i++) {
+		while (is_p3_space(*p)) p++;
+		// Decimal value, saturated above 255 (so above any maxval)
+		const char *start = p;
+		unsigned int v = 0;
+		for (; p < c->end && *p >= '0' && *p <= '9'; p++) {
+			v = v * 10 + (*p - '0');
+			if (v > 255) v = 256;
+		}
+		if (p == start || (p < c->end && !is_p3_space(*p)) || v > c->maxval) {
+			c->ok = false;
+			return NULL;
+		}
+		c->comp[i] = v;
+	}
+	return NULL;
+}
+
+/**
+ * Internal routine to read the rest of a file that cannot be mapped, by large
+ * blocks.
+ * @param f the file
+ * @param size receives the number of bytes read
+ * @return the bytes read (to free) or NULL if the allocation failed
+ */
+static char *read_rest(FILE *f, size_t *size) {
+	size_t capacity = P3_READ_BLOCK;
+	char *data = malloc(capacity);
+	*size = 0;
+	while (data) {
+		size_t nb = fread(data + *size, 1, capacity - *size, f);
+		*size += nb;
+		if (*size < capacity) break;
+		capacity *= 2;
+		char *bigger = realloc(data, capacity);
+		if (!bigger) free(data);
+		data = bigger;
+	}
+	return data;
+}
+
+/**
+ * Internal routine to load the pixel data of a plain ASCII (P3) image, parsed
+ * in parallel by chunks (see p3_chunk_t).
+ * @param f the image file, positioned right after the header
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param maxval the maximum value per component
+ * @return a pointer to the loaded image or NULL if an error occured
+ */
+static img_t *load_p3(FILE *f, unsigned int width, unsigned int height, unsigned int maxval) {
+	size_t offset = ftell(f);
+	const char *body = NULL;
+	char *data = NULL;
+	void *map = NULL;
+	size_t size = 0, map_size = 0;
+
+	// The body is mapped, or read in large blocks if the file cannot be mapped
+	struct stat st;
+	int fd = fileno(f);
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size > offset) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			map_size = st.st_size;
+			body = (const char *)map + offset;
+			size = map_size - offset;
+			madvise(map, map_size, MADV_SEQUENTIAL);
+		} else {
+			map = NULL;
+		}
+	}
+	if (!map) {
+		data = read_rest(f, &size);
+		if (!data) return NULL;
+		body = data;
+	}
+
+	img_t *img = alloc_img(width, height);
+	if (!img) goto end;
+
+	// Chunks of at least P3_MIN_CHUNK bytes, a thread per online CPU at most
+	int nb_chunks = p3_threads(size / P3_MIN_CHUNK + 1);
+
+	// Cut the body in chunks, moving each cut to the end of the value it falls in
+	p3_chunk_t chunks[P3_MAX_THREADS];
+	const char *cut = body;
+	for (int i = 0; i < nb_chunks; i++) {
+		chunks[i].begin = cut;
+		cut = i == nb_chunks - 1 ? body + size : body + size * (i + 1) / nb_chunks;
+		if (cut < chunks[i].begin) cut = chunks[i].begin;
+		while (cut < body + size && !is_p3_space(*cut)) cut++;
+		chunks[i].end = cut;
+		chunks[i].comp = &img->raw[0].r;
+		chunks[i].nb_comp = sizeof(pixel_t) * width * height;
+		chunks[i].maxval = maxval;
+		chunks[i].ok = true;
+	}
+
+	// Count the values of each chunk to know where its first component goes..
+	run_p3_threads(count_p3_chunk, chunks, sizeof(p3_chunk_t), nb_chunks);
+	size_t total = 0;
+	for (int i = 0; i < nb_chunks; i++) {
+		chunks[i].first = total;
+		total += chunks[i].count;
+	}
+	bool ok = total >= chunks[0].nb_comp;
+
+	//.. then parse them
+	if (ok) {
+		run_p3_threads(parse_p3_chunk, chunks, sizeof(p3_chunk_t), nb_chunks);
+		for (int i = 0; i < nb_chunks; i++)
+			ok &= chunks[i].ok;
+	}
+	if (!ok) {
+		free_img(img);
+		img = NULL;
+	}
+
+end:
+	if (map) munmap(map, map_size);
+	free(data);
+	return img;
+}
+
+/**
+ * Internal routine to load the pixel data of a binary (P6) image.
+ * The file is mapped privately and the image pixel data points directly into the
+ * mapping, so pixels modified in memory are never written back to the file. If the
+ * file cannot be mapped, the pixel data is read with a single fread.
+ * @param f the image file, positioned right after the header
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return a pointer to the loaded image or NULL if an error occured
+ */
+static img_t *load_p6(FILE *f, unsigned int width, unsigned int height) {
+	size_t offset = ftell(f);
+	size_t data_size = sizeof(pixel_t) * width * height;
+	int fd = fileno(f);
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if ((size_t)st.st_size < offset + data_size) {
+			fprintf(stderr, "PPM reader: truncated image data!\n");
+			return NULL;
+		}
+		void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			img_t *img = mapped_img(width, height, map, st.st_size, offset);
+			if (!img) {
+				munmap(map, st.st_size);
+				return NULL;
+			}
+			img->dev = st.st_dev;
+			img->ino = st.st_ino;
+			return img;
+		}
+	}
+
+	// Fallback: one bulk read of the whole pixel data
+	img_t *img = alloc_img(width, height);
+	if (!img) return NULL;
+	if (fread(img->raw, 1, data_size, f) != data_size) {
+		fprintf(stderr, "PPM reader: truncated image data!\n");
+		free_img(img);
+		return NULL;
+	}
+	return img;
+}
+
 /**
  * Load a 24-bit RGB PPM file (either ASCII P3 type or binary P6 type).
  * The routine takes care of allocating the memory for the image.
@@ -139,38 +733,188 @@ img_t *load_ppm(char *filename) {
 	FILE *f = load_header(filename, type, &width, &height, &maxval);
 	if (!f) return NULL;
 
-	// Allocate memory for image structure and image data
-	img_t *img = alloc_img(width, height);
-	if (!img) return NULL;
+	// Binary images are mapped directly, without going through alloc_img
+	if (strcmp("P6", type) == 0) {
+		img_t *img = load_p6(f, width, height);
+		fclose(f);
+		return img;
+	}
 
 	// File type (format) must be P3 or P6
 	if (strcmp("P3", type) == 0) {
 		// Image data in RGB order, ASCII encoded 
-		for (unsigned int i = 0; i < width * height; i++) {
-			unsigned int r, g, b;
-			int matches = fscanf(f, "%u %u %u", &r, &g, &b);
-			if (matches != 3) goto error;
-			if (r > maxval || g > maxval || b > maxval) goto error;
-			pixel_t p = { r, g, b };
-			img->raw[i] = p;
-		}
+		img_t *img = load_p3(f, width, height, maxval);
+		fclose(f);
+		return img;
 	}
-	else if (strcmp("P6", type) == 0) {
-		// Image data in RGB order, binary encoded 
-		for (unsigned int i = 0; i < width * height; i++) {
-			fread(&img->raw[i].r, 1, 1, f);
-			fread(&img->raw[i].g, 1, 1, f);
-			fread(&img->raw[i].b, 1, 1, f);
-		}
-	} else {
-		fprintf(stderr, "PPM reader: unsupported format!\n");
-		goto error;
+
+	fprintf(stderr, "PPM reader: unsupported format!\n");
+	fclose(f);
+	return NULL;
+}
+
+/**
+ * Load the first rows of a PPM image, enough to hold a number of components.
+ * Only these rows of a binary (P6) image are read; an ASCII (P3) image cannot be
+ * read partially and is loaded whole.
+ * @param filename the image to load
+ * @param nb_comp number of components wanted (R, G and B of a pixel are 3 components)
+ * @param height receives the height of the whole image
+ * @return a pointer to the image holding the rows read (at least the ones needed
+ *         for nb_comp, unless the image is smaller) or NULL if the loading failed
+ */
+img_t *load_ppm_head(char *filename, size_t nb_comp, int *height) {
+	unsigned int width, h, maxval;
+	char type[3];
+	FILE *f = load_header(filename, type, &width, &h, &maxval);
+	if (!f) return NULL;
+	*height = h;
+
+	if (strcmp("P6", type) != 0) {
+		fclose(f);
+		return load_ppm(filename);
 	}
 
+	size_t row_size = sizeof(pixel_t) * width;
+	size_t rows = row_size ? (nb_comp + row_size - 1) / row_size : 0;
+	if (rows > h) rows = h;
+	if (rows == 0) rows = h ? 1 : 0;
+
+	// A single read of the rows, right after the header
+	img_t *img = alloc_img(width, rows);
+	if (img && fread(img->raw, 1, row_size * rows, f) != row_size * rows) {
+		fprintf(stderr, "PPM reader: truncated image data!\n");
+		free_img(img);
+		img = NULL;
+	}
 	fclose(f);
 	return img;
+}
 
-error:
-	fclose(f);
-	return NULL;
+/**
+ * Open a binary (P6) PPM file to read it band by band.
+ * Only the header is read; the pixel data is read with read_ppm_band.
+ * @param filename (absolute or relative path) of the image to read
+ * @return a pointer to the stream or NULL if an error occured
+ */
+ppm_stream_t *open_ppm_stream(char *filename) {
+	unsigned int width, height, maxval;
+	char type[3];
+	FILE *f = load_header(filename, type, &width, &height, &maxval);
+	if (!f) return NULL;
+
+	if (strcmp("P6", type) != 0) {
+		fprintf(stderr, "PPM reader: only binary (P6) images can be streamed!\n");
+		fclose(f);
+		return NULL;
+	}
+	ppm_stream_t *s = malloc(sizeof(ppm_stream_t));
+	if (!s) {
+		fclose(f);
+		return NULL;
+	}
+	s->f = f;
+	s->width = width;
+	s->height = height;
+	s->path = NULL;
+	s->temp = NULL;
+	return s;
+}
+
+/**
+ * Create a binary (P6) PPM file to write it band by band.
+ * The header written is the same as the one written by write_ppm. If the file is
+ * the one read by the input stream, a temporary file is written instead, which
+ * replaces it when the stream is closed (see close_ppm_stream).
+ * @param filename (absolute or relative path) of the image to write
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param in the stream of the input image, or NULL
+ * @return a pointer to the stream or NULL if an error occured
+ */
+ppm_stream_t *create_ppm_stream(char *filename, int width, int height, ppm_stream_t *in) {
+	struct stat st, in_st;
+	char *temp = NULL;
+	if (in && stat(filename, &st) == 0 && fstat(fileno(in->f), &in_st) == 0 &&
+	    st.st_dev == in_st.st_dev && st.st_ino == in_st.st_ino && !(temp = temp_output(filename)))
+		return NULL;
+
+	FILE *f = fopen(temp ? temp : filename, "w");
+	ppm_stream_t *s = f ? malloc(sizeof(ppm_stream_t)) : NULL;
+	if (!s || fprintf(f, "%s\n%d %d\n255\n", "P6", width, height) < 0) {
+		free(s);
+		if (f) fclose(f);
+		finish_output(temp, filename, false);
+		return NULL;
+	}
+	s->f = f;
+	s->width = width;
+	s->height = height;
+	s->path = filename;
+	s->temp = temp;
+	return s;
+}
+
+/**
+ * Read the next band of rows of a streamed image.
+ * @param s a pointer to the stream
+ * @param band buffer receiving the pixels, large enough for rows rows
+ * @param rows number of rows to read
+ * @return boolean value indicating whether the read succeeded or not
+ */
+bool read_ppm_band(ppm_stream_t *s, pixel_t *band, int rows) {
+	size_t count = (size_t)s->width * rows;
+	if (fread(band, sizeof(pixel_t), count, s->f) != count) {
+		fprintf(stderr, "PPM reader: truncated image data!\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Write the next band of rows of a streamed image.
+ * @param s a pointer to the stream
+ * @param band buffer holding the pixels of rows rows
+ * @param rows number of rows to write
+ * @return boolean value indicating whether the write succeeded or not
+ */
+bool write_ppm_band(ppm_stream_t *s, pixel_t *band, int rows) {
+	size_t count = (size_t)s->width * rows;
+	return fwrite(band, sizeof(pixel_t), count, s->f) == count;
+}
+
+/**
+ * Submit the read or the write of a band of rows of a streamed image to an
+ * asynchronous queue (see aio.h), at its offset in the file. The rows before the
+ * band are not read nor written, so the bands may be given in any order, but the
+ * stream must not be used with read_ppm_band or write_ppm_band as well.
+ * @param q the queue
+ * @param s a pointer to the stream
+ * @param write true to write the band, false to read it
+ * @param band buffer of the pixels of rows rows, which must stay until the request
+ *             is completed
+ * @param row index of the first row of the band
+ * @param rows number of rows of the band
+ * @param tag given back by aio_complete with the request
+ * @return boolean value indicating whether the request was submitted or not
+ */
+bool submit_ppm_band(aio_t *q, ppm_stream_t *s, bool write, pixel_t *band, int row, int rows, void *tag) {
+	size_t row_size = (size_t)s->width * sizeof(pixel_t);
+	if (write && fflush(s->f) != 0) return false;
+	off_t data = ftell(s->f);
+	if (data < 0) return false;
+	return aio_submit(q, write, fileno(s->f), band, row_size * rows, data + row_size * row, tag);
+}
+
+/**
+ * Close a streamed image and free the stream. The temporary file written instead
+ * of the image (see create_ppm_stream) then replaces it.
+ * @param s a pointer to the stream
+ * @return boolean value indicating whether all the data was flushed or not
+ */
+bool close_ppm_stream(ppm_stream_t *s) {
+	bool ok = fclose(s->f) == 0;
+	ok = finish_output(s->temp, s->path, ok);
+	free(s);
+	return ok;
 }
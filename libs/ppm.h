@@ -5,8 +5,15 @@
  * @brief Routines to read and write PPM files.
  */
 
+#ifndef PPM_H
+#define PPM_H
+
+#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
+#include "aio.h"
 
 /**
  * Store a 24-bit pixel (8-bit per component).
@@ -24,12 +31,23 @@ typedef struct pixel_st {
  * @param height the height of the image
  * @param raw accessor to the image pixel data as a 1D array
  * @param pix accessor to the image pixel data as a 2D array [height][width]
+ * @param map base of the file mapping backing raw, or NULL if raw was allocated on the heap
+ * @param map_size size in bytes of the file mapping
+ * @param block_size size in bytes of the block holding the image (see alloc_img),
+ *                   0 if raw is backed by a file mapping
+ * @param dev device of the mapped file (if map is not NULL)
+ * @param ino inode of the mapped file (if map is not NULL)
  */
 typedef struct img_st {
 	int width;
 	int height;
 	pixel_t *raw;
 	pixel_t **pix;
+	void *map;
+	size_t map_size;
+	size_t block_size;
+	dev_t dev;
+	ino_t ino;
 } img_t;
 
 /**
@@ -40,8 +58,37 @@ enum PPM_TYPE {
 	PPM_ASCII
 };
 
+/**
+ * Binary (P6) PPM file read or written sequentially, one band of rows at a time.
+ * @param f the image file, positioned on the first row not yet read or written
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param path the path of the image written, replaced by temp when closed
+ * @param temp the temporary file written instead of the image, or NULL
+ */
+typedef struct ppm_stream_st {
+	FILE *f;
+	int width;
+	int height;
+	char *path;
+	char *temp;
+} ppm_stream_t;
+
 extern img_t *alloc_img(int width, int height);
 extern void free_img(img_t *img);
+extern void populate_img(img_t *img);
 extern img_t *load_ppm(char *filename);
+extern img_t *load_ppm_head(char *filename, size_t nb_comp, int *height);
 extern bool write_ppm(char *filename, img_t *img, enum PPM_TYPE);
+extern char *temp_output(const char *filename);
+extern bool finish_output(char *temp, const char *filename, bool ok);
+extern bool img_output(img_t *img, const char *filename, char **temp);
+extern ppm_stream_t *open_ppm_stream(char *filename);
+extern ppm_stream_t *create_ppm_stream(char *filename, int width, int height, ppm_stream_t *in);
+extern bool read_ppm_band(ppm_stream_t *s, pixel_t *band, int rows);
+extern bool write_ppm_band(ppm_stream_t *s, pixel_t *band, int rows);
+extern bool submit_ppm_band(aio_t *q, ppm_stream_t *s, bool write, pixel_t *band, int row, int rows, void *tag);
+extern bool close_ppm_stream(ppm_stream_t *s);
+
+#endif
 
@@ -0,0 +1,206 @@
+/************************************************************************************
+ * @file scatter.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 13 Dec 2017
+ * @brief Keyed permutation scattering the payload over the components
+ *
+ * In the keyed layout (see format.h), the field number i of the payload (the
+ * nb_lsb bits that the sequential layout stores in the component i after the
+ * header) goes into the component scatter_position(i) after the header instead,
+ * the positions covering all the components of the image after the header.
+ *
+ * The permutation is an unbalanced Feistel network of 4 rounds over the smallest
+ * power of 2 holding the indexes: each round adds (xor) to the high part of the
+ * index a keyed hash of its low part, then swaps the two parts. An index falling
+ * out of the domain is permuted again (cycle walking) until it is in, which takes
+ * less than 2 steps on average.
+ * A position only depends on the key and on its index, so that each thread
+ * computes the positions of its own fields, without sharing any state.
+ *
+ * The fields are spread into (or gathered from) a chunk of consecutive bytes by
+ * the kernels of bitplane.h, then moved to (or from) their positions.
+ ***********************************************************************************/
+#include "scatter.h"
+#include "bitplane.h"
+
+// Multiple of the number of fields of a group in any layout (7 or 8 symbols
+// bits for 1 to 4 lowest bits), so that every chunk starts on a symbol
+#define CHUNK_FIELDS 3584
+
+/***********************************************************
+ * Mix the bits of a value (splitmix64 finalizer), to derive
+ * the keys of the rounds
+ * @param x the value
+ * @return the mixed value
+ ***********************************************************/
+static uint64_t mix64(uint64_t x){
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/***********************************************************
+ * Key of the keyed layout given on the command line
+ * @param str the key, any string
+ * @return the key as a number (FNV-1a hash of the string)
+ ***********************************************************/
+uint64_t parse_key(const char *str){
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (; *str; str++)
+		hash = (hash ^ (uint8_t)*str) * 0x100000001B3ULL;
+	return hash;
+}
+
+/***********************************************************
+ * Prepare the permutation of a domain
+ * @param s receives the permutation
+ * @param key the key of the layout
+ * @param domain number of indexes (components after the
+ *               header)
+ ***********************************************************/
+void init_scatter(scatter_t *s, uint64_t key, size_t domain){
+	s->domain = domain;
+	s->nb_bits = 2;
+	while(s->nb_bits < 64 && ((size_t)1 << s->nb_bits) < domain)
+		s->nb_bits++;
+	for (int r = 0; r < SCATTER_ROUNDS; r++)
+		s->keys[r] = mix64(key + (r + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+/***********************************************************
+ * A round of the permutation
+ * @param value an index lower than 2^(low_bits + high_bits)
+ * @param key the key of the round
+ * @param low_bits number of bits of the low part
+ * @param high_bits number of bits of the high part
+ * @return the index, its high part being added a hash of
+ *         the low part, then the parts being swapped
+ ***********************************************************/
+static inline uint64_t feistel_round(uint64_t value, uint64_t key, int low_bits, int high_bits){
+	uint64_t low = value & (((uint64_t)1 << low_bits) - 1);
+	uint64_t hash = (low ^ key) * 0xFF51AFD7ED558CCDULL;
+	hash = (hash ^ (hash >> 32)) * 0xC4CEB9FE1A85EC53ULL;
+	uint64_t high = (value >> low_bits) ^ (hash >> (64 - high_bits));
+	return (low << high_bits) | high;
+}
+
+/***********************************************************
+ * Position of a field
+ * @param s the permutation
+ * @param index index of the field (lower than the domain)
+ * @return the index of its component after the header
+ ***********************************************************/
+size_t scatter_position(const scatter_t *s, size_t index){
+	uint64_t value = index;
+	do{
+		int low_bits = s->nb_bits / 2;
+		for (int r = 0; r < SCATTER_ROUNDS; r++){
+			value = feistel_round(value, s->keys[r], low_bits, s->nb_bits - low_bits);
+			low_bits = s->nb_bits - low_bits;
+		}
+	}while(value >= s->domain);
+	return value;
+}
+
+/***********************************************************
+ * Positions of consecutive fields (see scatter_position):
+ * each round is applied to all the fields before the next
+ * one, so that the fields are permuted in parallel by the
+ * processor, then the fields out of the domain are permuted
+ * again (without a branch per field)
+ * @param s the permutation
+ * @param first index of the first field
+ * @param nb number of fields (CHUNK_FIELDS at most)
+ * @param pos receives the positions
+ ***********************************************************/
+static void scatter_positions(const scatter_t *s, size_t first, size_t nb, size_t *pos){
+	uint16_t out[CHUNK_FIELDS];
+	size_t nb_out = nb;
+
+	for (size_t i = 0; i < nb; i++){
+		pos[i] = first + i;
+		out[i] = i;
+	}
+	while(nb_out){
+		int low_bits = s->nb_bits / 2;
+		for (int r = 0; r < SCATTER_ROUNDS; r++){
+			int high_bits = s->nb_bits - low_bits;
+			for (size_t j = 0; j < nb_out; j++)
+				pos[out[j]] = feistel_round(pos[out[j]], s->keys[r], low_bits, high_bits);
+			low_bits = high_bits;
+		}
+		size_t n = 0;
+		for (size_t j = 0; j < nb_out; j++){
+			out[n] = out[j];
+			n += pos[out[j]] >= s->domain;
+		}
+		nb_out = n;
+	}
+}
+
+/***********************************************************
+ * Store a range of bits of symbols in the keyed layout
+ * @param comp pointer to the first component after the
+ *             header
+ * @param s the permutation
+ * @param first_field index of the field receiving the first
+ *                    bit, at the beginning of a group (see
+ *                    group_symbols)
+ * @param text the symbols (text[0] holds the first bit)
+ * @param nb_bits number of bits to store
+ * @param nb_lsb number of lowest bits used per component
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ ***********************************************************/
+void scatter_spread(uint8_t *comp, const scatter_t *s, size_t first_field, const char *text,
+                    size_t nb_bits, int nb_lsb, int sym_bits){
+	uint8_t chunk[CHUNK_FIELDS] = { 0 };
+	size_t pos[CHUNK_FIELDS];
+	uint8_t full = (1 << nb_lsb) - 1;
+	size_t chunk_bits = (size_t)CHUNK_FIELDS * nb_lsb;
+
+	for (size_t done = 0; done < nb_bits; done += chunk_bits){
+		size_t nb = nb_bits - done < chunk_bits ? nb_bits - done : chunk_bits;
+		size_t nb_fields = (nb + nb_lsb - 1) / nb_lsb;
+		spread_bits(chunk, text, done, nb, nb_lsb, sym_bits);
+		scatter_positions(s, first_field + done / nb_lsb, nb_fields, pos);
+
+		for (size_t i = 0; i < nb_fields; i++){
+			uint8_t mask = full;
+			// The last field may be partial: its lowest bits are kept
+			if(i == nb_fields - 1 && nb % nb_lsb)
+				mask &= ~((1 << (nb_lsb - nb % nb_lsb)) - 1);
+			comp[pos[i]] = (comp[pos[i]] & ~mask) | (chunk[i] & mask);
+		}
+	}
+}
+
+/***********************************************************
+ * Read a range of bits of symbols in the keyed layout
+ * @param comp pointer to the first component after the
+ *             header
+ * @param s the permutation
+ * @param first_field index of the field holding the first
+ *                    bit, at the beginning of a group (see
+ *                    group_symbols)
+ * @param text receives the symbols
+ * @param nb_bits number of bits to read
+ * @param nb_lsb number of lowest bits used per component
+ * @param sym_bits number of bits of a symbol (7 or 8)
+ ***********************************************************/
+void scatter_gather(const uint8_t *comp, const scatter_t *s, size_t first_field, char *text,
+                    size_t nb_bits, int nb_lsb, int sym_bits){
+	uint8_t chunk[CHUNK_FIELDS];
+	size_t pos[CHUNK_FIELDS];
+	size_t chunk_bits = (size_t)CHUNK_FIELDS * nb_lsb;
+
+	for (size_t done = 0; done < nb_bits; done += chunk_bits){
+		size_t nb = nb_bits - done < chunk_bits ? nb_bits - done : chunk_bits;
+		size_t nb_fields = (nb + nb_lsb - 1) / nb_lsb;
+		scatter_positions(s, first_field + done / nb_lsb, nb_fields, pos);
+		for (size_t i = 0; i < nb_fields; i++)
+			chunk[i] = comp[pos[i]];
+		gather_bits(chunk, text, done, nb, nb_lsb, sym_bits);
+	}
+}
@@ -0,0 +1,35 @@
+/************************************************************************************
+ * @file scatter.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 13 Dec 2017
+ * @brief Keyed permutation scattering the payload over the components
+ ***********************************************************************************/
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCATTER_ROUNDS 4
+
+/***********************************************************
+ * Permutation of the indexes 0 to domain - 1
+ * @param keys the keys of the rounds
+ * @param domain number of indexes
+ * @param nb_bits number of bits of an index
+ ***********************************************************/
+typedef struct scatter_st {
+	uint64_t keys[SCATTER_ROUNDS];
+	size_t domain;
+	int nb_bits;
+} scatter_t;
+
+uint64_t parse_key(const char *str);
+void init_scatter(scatter_t *s, uint64_t key, size_t domain);
+size_t scatter_position(const scatter_t *s, size_t index);
+void scatter_spread(uint8_t *comp, const scatter_t *s, size_t first_field, const char *text,
+                    size_t nb_bits, int nb_lsb, int sym_bits);
+void scatter_gather(const uint8_t *comp, const scatter_t *s, size_t first_field, char *text,
+                    size_t nb_bits, int nb_lsb, int sym_bits);
+
+#endif
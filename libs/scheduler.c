@@ -0,0 +1,310 @@
+/************************************************************************************
+ * @file scheduler.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 15 Dec 2017
+ * @brief Number of threads and chunks of a payload, from a calibrated cost model
+ *
+ * Encoding (or decoding) n chars with t threads takes about
+ *   n * char_cost / t + t * thread_cost
+ * where char_cost is the time of the kernels of bitplane.h for a char and
+ * thread_cost the time to create and join a thread. The best number of threads
+ * is then sqrt(n * char_cost / thread_cost), bounded by the number of processors:
+ * a short payload is done by the calling thread alone, without any thread. The
+ * model is only used for the "auto" thread count; a number of threads given on
+ * the command line is used as it is.
+ *
+ * The two costs are measured once (a few milliseconds) and kept in a file, with
+ * the kernel of bitplane.h and the number of processors they were measured with:
+ * the file given by the STEG_COSTS variable, or steg_costs in the cache directory
+ * of the user. STEG_COSTS set to "off" (or empty) measures them in each run
+ * without keeping them. A payload too short for two chunks is done by the calling
+ * thread without the costs, which are then not even measured.
+ *
+ * The payload is cut in more chunks than threads (CHUNKS_PER_THREAD each, of at
+ * least MIN_CHUNK_CHARS chars), dealt in contiguous ranges to a deque per thread.
+ * A thread draws the chunks of its deque in order, then steals half of those
+ * left to another thread: a thread slowed down (by another process, a page
+ * fault, ...) does fewer chunks while the others do more, instead of delaying
+ * the whole payload.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "scheduler.h"
+#include "bitplane.h"
+#include "format.h"
+#include "alloc.h"
+
+#define CALIB_CHARS 65536
+#define CALIB_THREADS 8
+#define CALIB_RUNS 5
+#define CHUNKS_PER_THREAD 8
+#define MIN_CHUNK_CHARS 4096
+#define COSTS_PATH_SIZE 4096
+#define RANGE(head, end) ((uint64_t)(head) << 32 | (uint32_t)(end))
+#define RANGE_HEAD(range) ((range) >> 32)
+#define RANGE_END(range) ((range) & 0xffffffffu)
+
+/***********************************************************
+ * Costs of the cost model
+ * @param char_ns time to encode a char (nanoseconds)
+ * @param thread_ns time to create and join a thread
+ *                  (nanoseconds)
+ ***********************************************************/
+typedef struct costs_st {
+	double char_ns;
+	double thread_ns;
+} costs_t;
+
+static costs_t costs;
+static pthread_once_t costs_once = PTHREAD_ONCE_INIT;
+static bool auto_threads = false;
+
+/***********************************************************
+ * Current time of the monotonic clock
+ * @return the time in nanoseconds
+ ***********************************************************/
+static double now_ns(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/***********************************************************
+ * Thread doing nothing, to measure the cost of a thread
+ * @param param unused
+ * @return NULL
+ ***********************************************************/
+static void *idle_thread(void *param){
+	return param;
+}
+
+/***********************************************************
+ * Measure the costs of the model
+ * @param c receives the costs
+ * @return false if they cannot be measured
+ ***********************************************************/
+static bool measure_costs(costs_t *c){
+	char *text = calloc(CALIB_CHARS, 1);
+	uint8_t *comp = calloc((size_t)CALIB_CHARS * BITS_PER_CHAR, 1);
+	bool ok = text && comp;
+
+	c->char_ns = c->thread_ns = 0;
+	for (int r = 0; ok && r < CALIB_RUNS; r++){
+		double start = now_ns();
+		spread_bits(comp, text, 0, (size_t)CALIB_CHARS * BITS_PER_CHAR, 1, BITS_PER_CHAR);
+		double t = (now_ns() - start) / CALIB_CHARS;
+		c->char_ns = r == 0 || t < c->char_ns ? t : c->char_ns;
+
+		pthread_t threads[CALIB_THREADS];
+		int nb = 0;
+		start = now_ns();
+		while(nb < CALIB_THREADS && pthread_create(&threads[nb], NULL, idle_thread, NULL) == 0)
+			nb++;
+		for (int i = 0; i < nb; i++)
+			pthread_join(threads[i], NULL);
+		ok = nb > 0;
+		t = (now_ns() - start) / (nb ? nb : 1);
+		c->thread_ns = r == 0 || t < c->thread_ns ? t : c->thread_ns;
+	}
+	free(text);
+	free(comp);
+	return ok && c->char_ns > 0 && c->thread_ns > 0;
+}
+
+/***********************************************************
+ * Path of the file keeping the costs: the one given by the
+ * STEG_COSTS variable, or steg_costs in the cache directory
+ * of the user ($XDG_CACHE_HOME, or ~/.cache), created if
+ * needed
+ * @param path receives the path
+ * @return false if there is no such file (STEG_COSTS empty
+ *         or "off", no HOME variable): the costs are then
+ *         measured by each run
+ ***********************************************************/
+static bool costs_path(char path[COSTS_PATH_SIZE]){
+	const char *forced = getenv("STEG_COSTS");
+	const char *cache = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if(forced)
+		return *forced && strcmp(forced, "off") != 0 &&
+		       snprintf(path, COSTS_PATH_SIZE, "%s", forced) < COSTS_PATH_SIZE;
+	if(cache && *cache){
+		if(snprintf(path, COSTS_PATH_SIZE, "%s", cache) >= COSTS_PATH_SIZE)
+			return false;
+	}else if(!home || !*home || snprintf(path, COSTS_PATH_SIZE, "%s/.cache", home) >= COSTS_PATH_SIZE)
+		return false;
+
+    // A cache directory that cannot be created only makes the file fail to open
+	mkdir(path, 0700);
+	size_t len = strlen(path);
+	return snprintf(path + len, COSTS_PATH_SIZE - len, "/steg_costs") < (int)(COSTS_PATH_SIZE - len);
+}
+
+/***********************************************************
+ * Read the costs from their file, or measure and write them
+ * (run once per process)
+ ***********************************************************/
+static void load_costs(void){
+	char path[COSTS_PATH_SIZE], kernel[32];
+	long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN), cpus;
+	bool has_path = costs_path(path);
+
+    // The costs only hold for the same kernel and number of processors
+	FILE *f = has_path ? fopen(path, "r") : NULL;
+	if(f){
+		bool ok = fscanf(f, "%31s %ld %lf %lf", kernel, &cpus, &costs.char_ns, &costs.thread_ns) == 4 &&
+		          strcmp(kernel, bitplane_kernel_name()) == 0 && cpus == nb_cpus &&
+		          costs.char_ns > 0 && costs.thread_ns > 0;
+		fclose(f);
+		if(ok)
+			return;
+	}
+
+	if(!measure_costs(&costs)){
+		costs.char_ns = 0;
+		return;
+	}
+	f = has_path ? fopen(path, "w") : NULL;
+	if(f){
+		fprintf(f, "%s %ld %.6f %.1f\n", bitplane_kernel_name(), nb_cpus, costs.char_ns, costs.thread_ns);
+		fclose(f);
+	}
+}
+
+/***********************************************************
+ * Number of threads given on a command line: auto lets the
+ * cost model choose the threads of each payload (see
+ * plan_work)
+ * @param arg the argument, a number or auto
+ * @return the number, the number of processors for auto
+ *         (0 or less if the argument is not valid)
+ ***********************************************************/
+int parse_threads(const char *arg){
+	if(strcmp(arg, "auto") == 0){
+		auto_threads = true;
+		return sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	return atoi(arg);
+}
+
+/***********************************************************
+ * Number of threads and of chunks for a payload
+ * @param nb_char number of chars of the payload
+ * @param max_threads number of threads asked for, the
+ *                    maximum used with the auto count, the
+ *                    number used otherwise
+ * @param nb_chunks receives the number of chunks (if not
+ *                  NULL), at least the number of threads
+ * @return the number of threads, 1 to do the payload in the
+ *         calling thread
+ ***********************************************************/
+int plan_work(size_t nb_char, int max_threads, size_t *nb_chunks){
+	size_t max_chunks = nb_char / MIN_CHUNK_CHARS;
+	int nb_threads = max_threads;
+
+	if(!auto_threads){
+		if(nb_chunks){
+			*nb_chunks = (size_t)nb_threads * CHUNKS_PER_THREAD;
+			if(*nb_chunks > max_chunks)
+				*nb_chunks = max_chunks > (size_t)nb_threads ? max_chunks : (size_t)nb_threads;
+		}
+		return nb_threads;
+	}
+    // Too short for two chunks: a single thread whatever the costs
+	if(max_chunks < 2 || max_threads <= 1){
+		if(nb_chunks)
+			*nb_chunks = 1;
+		return 1;
+	}
+	pthread_once(&costs_once, load_costs);
+
+    // Without costs (the threads cannot be created), the threads asked for are used
+	if(costs.char_ns > 0){
+		double best = sqrt(nb_char * costs.char_ns / costs.thread_ns);
+		if(best < nb_threads)
+			nb_threads = best < 1 ? 1 : (int)best;
+	}
+	if(max_chunks < (size_t)nb_threads)
+		nb_threads = max_chunks ? max_chunks : 1;
+	if(nb_chunks){
+		*nb_chunks = (size_t)nb_threads * CHUNKS_PER_THREAD;
+		if(nb_threads == 1 || *nb_chunks > max_chunks)
+			*nb_chunks = nb_threads == 1 ? 1 : max_chunks;
+	}
+	return nb_threads;
+}
+
+/***********************************************************
+ * Prepare a work queue, dealing the chunks in contiguous
+ * ranges to the deques of the threads
+ * @param queue the queue (to free with free_work_queue)
+ * @param nb_chunks number of chunks of the payload (less
+ *                  than 2^32)
+ * @param nb_threads number of threads drawing the chunks
+ ***********************************************************/
+void init_work_queue(work_queue_t *queue, size_t nb_chunks, int nb_threads){
+	queue->nb_deques = nb_threads > 0 ? nb_threads : 1;
+	queue->deques = my_malloc(queue->nb_deques * sizeof(*queue->deques));
+	for (int i = 0; i < queue->nb_deques; i++)
+		atomic_init(&queue->deques[i], RANGE(nb_chunks * i / queue->nb_deques,
+		                                     nb_chunks * (i + 1) / queue->nb_deques));
+}
+
+/***********************************************************
+ * Draw the next chunk of a thread: the head of its deque,
+ * or, once it is empty, the first of the last half of the
+ * chunks left in the deque of another thread, the rest of
+ * this half going to its deque
+ * @param queue the queue
+ * @param owner index of the thread (from 0 to the number of
+ *              threads of init_work_queue)
+ * @param chunk receives the index of the chunk
+ * @return false if all the chunks are drawn
+ ***********************************************************/
+bool next_chunk(work_queue_t *queue, int owner, size_t *chunk){
+	_Atomic uint64_t *own = &queue->deques[owner];
+	uint64_t range = atomic_load_explicit(own, memory_order_relaxed);
+
+	// The thieves only move the end of the deque: the head is taken as long as
+	// the range is not empty
+	while(RANGE_HEAD(range) < RANGE_END(range)){
+		if(atomic_compare_exchange_weak_explicit(own, &range, RANGE(RANGE_HEAD(range) + 1, RANGE_END(range)),
+		                                         memory_order_relaxed, memory_order_relaxed)){
+			*chunk = RANGE_HEAD(range);
+			return true;
+		}
+	}
+
+	// Steal from the next threads, those of the end of the payload first. No other
+	// thread writes an empty deque: the stolen chunks can be stored in it
+	for (int i = 1; i < queue->nb_deques; i++){
+		_Atomic uint64_t *victim = &queue->deques[(owner + i) % queue->nb_deques];
+		range = atomic_load_explicit(victim, memory_order_relaxed);
+		while(RANGE_HEAD(range) < RANGE_END(range)){
+			uint64_t end = RANGE_END(range), first = end - (end - RANGE_HEAD(range) + 1) / 2;
+			if(atomic_compare_exchange_weak_explicit(victim, &range, RANGE(RANGE_HEAD(range), first),
+			                                         memory_order_relaxed, memory_order_relaxed)){
+				atomic_store_explicit(own, RANGE(first + 1, end), memory_order_relaxed);
+				*chunk = first;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/***********************************************************
+ * Free the deques of a work queue
+ * @param queue the queue
+ ***********************************************************/
+void free_work_queue(work_queue_t *queue){
+	free(queue->deques);
+	queue->deques = NULL;
+}
@@ -0,0 +1,36 @@
+/************************************************************************************
+ * @file scheduler.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 15 Dec 2017
+ * @brief Number of threads and chunks of a payload, from a calibrated cost model
+ ***********************************************************************************/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/***********************************************************
+ * Chunks of a payload drawn by the threads of a pool: each
+ * thread owns a deque of contiguous chunks, drawn from its
+ * head, and steals from the end of the deque of another
+ * thread once its own is empty
+ * @param deques the deques, one per thread, each the range
+ *               of the chunks left packed in a word (index
+ *               of its head << 32 | index of its end)
+ * @param nb_deques number of deques
+ ***********************************************************/
+typedef struct work_queue_st {
+	_Atomic uint64_t *deques;
+	int nb_deques;
+} work_queue_t;
+
+int parse_threads(const char *arg);
+int plan_work(size_t nb_char, int max_threads, size_t *nb_chunks);
+void init_work_queue(work_queue_t *queue, size_t nb_chunks, int nb_threads);
+bool next_chunk(work_queue_t *queue, int owner, size_t *chunk);
+void free_work_queue(work_queue_t *queue);
+
+#endif
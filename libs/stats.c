@@ -0,0 +1,161 @@
+/************************************************************************************
+ * @file stats.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 6 Dec 2017
+ * @brief Timing of the phases and the threads of a run, written as JSON
+ *
+ * The times come from the monotonic clock and are given in microseconds since
+ * the start of the run. The JSON object holds, for each phase and each thread,
+ * its start, its duration, the bytes processed and the throughput, then the
+ * skew between the ends of the threads (time lost waiting for the slowest one)
+ * and the peak resident memory of the process.
+ ***********************************************************************************/
+#include <time.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "alloc.h"
+
+/***********************************************************
+ * Current time of the monotonic clock
+ * @return the time in ns
+ ***********************************************************/
+static uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/***********************************************************
+ * Create the statistics of a run, starting now
+ * @param program name of the program
+ * @return the statistics
+ ***********************************************************/
+stats_t *create_stats(const char *program) {
+	stats_t *s = my_calloc(1, sizeof(stats_t));
+	s->program = program;
+	s->origin = now_ns();
+	return s;
+}
+
+/***********************************************************
+ * Start a phase (ignored past MAX_PHASES phases)
+ * @param s the statistics, or NULL
+ * @param name name of the phase
+ ***********************************************************/
+void begin_phase(stats_t *s, const char *name) {
+	if (!s || s->nb_phases == MAX_PHASES)
+		return;
+	span_t *p = &s->phases[s->nb_phases++];
+	p->name = name;
+	p->start = now_ns() - s->origin;
+	p->end = p->start;
+	p->bytes = 0;
+}
+
+/***********************************************************
+ * End the last phase started
+ * @param s the statistics, or NULL
+ * @param bytes number of bytes processed by the phase
+ ***********************************************************/
+void end_phase(stats_t *s, size_t bytes) {
+	if (!s || s->nb_phases == 0)
+		return;
+	span_t *p = &s->phases[s->nb_phases - 1];
+	p->end = now_ns() - s->origin;
+	p->bytes = bytes;
+}
+
+/***********************************************************
+ * Make room for the threads of a threaded phase
+ * @param s the statistics, or NULL
+ * @param nb_threads number of threads
+ ***********************************************************/
+void set_stats_threads(stats_t *s, int nb_threads) {
+	if (!s)
+		return;
+	free(s->threads);
+	s->threads = my_calloc(nb_threads, sizeof(span_t));
+	s->nb_threads = nb_threads;
+}
+
+/***********************************************************
+ * Start of a thread, called by the thread itself
+ * @param s the statistics, or NULL
+ * @param index index of the thread
+ ***********************************************************/
+void begin_thread(stats_t *s, int index) {
+	if (s)
+		s->threads[index].start = now_ns() - s->origin;
+}
+
+/***********************************************************
+ * End of a thread, called by the thread itself
+ * @param s the statistics, or NULL
+ * @param index index of the thread
+ * @param bytes number of bytes processed by the thread
+ ***********************************************************/
+void end_thread(stats_t *s, int index, size_t bytes) {
+	if (!s)
+		return;
+	s->threads[index].end = now_ns() - s->origin;
+	s->threads[index].bytes = bytes;
+}
+
+/***********************************************************
+ * Write a span as a JSON object
+ * @param f the file
+ * @param span the span
+ ***********************************************************/
+static void write_span(FILE *f, span_t *span) {
+	uint64_t duration = span->end - span->start;
+	if (span->name)
+		fprintf(f, "{\"name\": \"%s\", ", span->name);
+	else
+		fprintf(f, "{");
+	fprintf(f, "\"start_us\": %.1f, \"duration_us\": %.1f, \"bytes\": %zu, \"mb_per_s\": %.2f}",
+	        span->start / 1e3, duration / 1e3, span->bytes,
+	        duration ? span->bytes * 1e3 / duration : 0.0);
+}
+
+/***********************************************************
+ * Write the statistics as a single JSON object
+ * @param s the statistics, or NULL
+ * @param f the file
+ ***********************************************************/
+void write_stats(stats_t *s, FILE *f) {
+	if (!s)
+		return;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(f, "{\"program\": \"%s\", \"total_us\": %.1f, \"phases\": [", s->program,
+	        (now_ns() - s->origin) / 1e3);
+	for (int i = 0; i < s->nb_phases; i++) {
+		if (i) fputs(", ", f);
+		write_span(f, &s->phases[i]);
+	}
+
+	uint64_t first_end = 0, last_end = 0;
+	fprintf(f, "], \"threads\": [");
+	for (int i = 0; i < s->nb_threads; i++) {
+		if (i) fputs(", ", f);
+		write_span(f, &s->threads[i]);
+		if (i == 0 || s->threads[i].end < first_end) first_end = s->threads[i].end;
+		if (s->threads[i].end > last_end) last_end = s->threads[i].end;
+	}
+	fprintf(f, "], \"join_skew_us\": %.1f, \"peak_rss_kb\": %ld}\n",
+	        (last_end - first_end) / 1e3, usage.ru_maxrss);
+	fflush(f);
+}
+
+/***********************************************************
+ * Free the statistics
+ * @param s the statistics, or NULL
+ ***********************************************************/
+void free_stats(stats_t *s) {
+	if (!s)
+		return;
+	free(s->threads);
+	free(s);
+}
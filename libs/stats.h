@@ -0,0 +1,60 @@
+/************************************************************************************
+ * @file stats.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 6 Dec 2017
+ * @brief Timing of the phases and the threads of a run, written as JSON
+ ***********************************************************************************/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_PHASES 16
+
+/***********************************************************
+ * A phase of the run (load, write, ...) or a thread
+ * @param name name of the phase (NULL for a thread)
+ * @param start start time in ns since the start of the run
+ * @param end end time in ns since the start of the run
+ * @param bytes number of bytes processed
+ ***********************************************************/
+typedef struct span_st {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	size_t bytes;
+} span_t;
+
+/***********************************************************
+ * Statistics of a run. The functions do nothing when given
+ * a NULL pointer, so they cost nothing when the statistics
+ * are not wanted.
+ * @param program name of the program
+ * @param origin start time of the run (monotonic clock, ns)
+ * @param phases the phases, in order
+ * @param nb_phases number of phases
+ * @param threads the threads of the last threaded phase,
+ *                each thread filling its own span
+ * @param nb_threads number of threads
+ ***********************************************************/
+typedef struct stats_st {
+	const char *program;
+	uint64_t origin;
+	span_t phases[MAX_PHASES];
+	int nb_phases;
+	span_t *threads;
+	int nb_threads;
+} stats_t;
+
+stats_t *create_stats(const char *program);
+void begin_phase(stats_t *s, const char *name);
+void end_phase(stats_t *s, size_t bytes);
+void set_stats_threads(stats_t *s, int nb_threads);
+void begin_thread(stats_t *s, int index);
+void end_thread(stats_t *s, int index, size_t bytes);
+void write_stats(stats_t *s, FILE *f);
+void free_stats(stats_t *s);
+
+#endif
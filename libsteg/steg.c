@@ -0,0 +1,388 @@
+/************************************************************************************
+ * @file steg.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 6 Dec 2017
+ * @brief Embeddable steganography library (libsteg)
+ *
+ * The same encoding as the encode and decode programs (header and layouts of
+ * format.h, 7 bits per char in the lowest bit of the components by default,
+ * see steg_set_format for the other ones), but done on
+ * buffers given by the caller: the pixels (RGB, 3 bytes per pixel, as in a
+ * binary PPM) are modified in place and the payload is read or written without
+ * any copy. No function of the library exits or prints: the errors are returned
+ * as a steg_status_t, with a message kept in the context (see steg_last_error).
+ *
+ * A context holds the number of threads and the layout used for a job. The
+ * layout of an image to decode is read from its header, and the payload is
+ * checked if the header holds its checksum (see crc32c.h). The contexts do not
+ * share anything, so different threads can use different contexts at once.
+ ***********************************************************************************/
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "steg.h"
+#include "../libs/bitplane.h"
+#include "../libs/format.h"
+#include "../libs/lz.h"
+#include "../libs/crc32c.h"
+
+#define COMP_PER_PIXEL 3
+#define ERROR_SIZE 256
+
+/***********************************************************
+ * Context of the library
+ * @param nb_threads number of threads used for a job
+ * @param fmt layout used to encode (see format.h)
+ * @param error message of the last error
+ ***********************************************************/
+struct steg_ctx_st {
+	int nb_threads;
+	format_t fmt;
+	char error[ERROR_SIZE];
+};
+
+/***********************************************************
+ * Part of a payload done by a thread
+ * @param comp pointer to the component of the first char
+ * @param payload pointer to the first char
+ * @param nb_char number of chars of the part
+ * @param fmt layout of the payload
+ * @param encode true to spread the chars, false to gather
+ * @param crc receives the checksum of the chars gathered
+ *            (if the layout has one)
+ ***********************************************************/
+typedef struct part_st {
+	uint8_t *comp;
+	char *payload;
+	size_t nb_char;
+	format_t fmt;
+	bool encode;
+	uint32_t crc;
+} part_t;
+
+/***********************************************************
+ * Keep the message of an error in the context
+ * @param ctx the context
+ * @param status the error
+ * @param format printf format of the message
+ * @return status
+ ***********************************************************/
+static int fail(steg_ctx_t *ctx, int status, const char *format, ...){
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(ctx->error, ERROR_SIZE, format, args);
+	va_end(args);
+	return status;
+}
+
+/***********************************************************
+ * Check the size of an image
+ * @param ctx the context
+ * @param pixels the components of the image
+ * @param width width of the image
+ * @param height height of the image
+ * @return STEG_OK or STEG_EINVAL
+ ***********************************************************/
+static int check_image(steg_ctx_t *ctx, const uint8_t *pixels, int width, int height){
+	if(!pixels || width <= 0 || height <= 0)
+		return fail(ctx, STEG_EINVAL, "INVALID IMAGE");
+	if((size_t)width * height < FIRST_PIXEL_EXT)
+		return fail(ctx, STEG_ETOOLONG, "IMAGE TOO SMALL, AT LEAST %d PIXELS", FIRST_PIXEL_EXT);
+	return STEG_OK;
+}
+
+/***********************************************************
+ * Threads spreading (or gathering) a part of the payload
+ * @param param see the struct part_t
+ * @return NULL
+ ***********************************************************/
+static void *part_thread(void *param){
+	part_t *p = (part_t *)param;
+
+	size_t nb_bits = p->nb_char * p->fmt.sym_bits;
+
+	if(p->encode)
+		spread_bits(p->comp, p->payload, 0, nb_bits, p->fmt.nb_lsb, p->fmt.sym_bits);
+	else
+		gather_bits(p->comp, p->payload, 0, nb_bits, p->fmt.nb_lsb, p->fmt.sym_bits);
+	if(!p->encode && p->fmt.checked)
+		p->crc = crc32c(0, p->payload, p->nb_char);
+	return NULL;
+}
+
+/***********************************************************
+ * Spread (or gather) the chars of a payload with the
+ * threads of the context, each one doing a part made of
+ * whole groups of chars (see group_symbols)
+ * @param ctx the context
+ * @param comp pointer to the component of the first char
+ * @param payload the chars
+ * @param nb_char number of chars
+ * @param fmt layout of the payload
+ * @param encode true to spread the chars, false to gather
+ * @return STEG_OK, STEG_ENOMEM or STEG_ENOTEXT if the
+ *         chars gathered do not match the checksum of the
+ *         layout
+ ***********************************************************/
+static int run_parts(steg_ctx_t *ctx, uint8_t *comp, char *payload, size_t nb_char, format_t fmt,
+                     bool encode){
+	int status = STEG_OK;
+	int nb_threads = ctx->nb_threads;
+	size_t group = group_symbols(fmt);
+	size_t nb_groups = (nb_char + group - 1) / group;
+
+	if((size_t)nb_threads > nb_groups)
+		nb_threads = nb_groups ? nb_groups : 1;
+	if(nb_threads == 1){
+		part_t part = { comp, payload, nb_char, fmt, encode, 0 };
+		part_thread(&part);
+		if(!encode && fmt.checked && part.crc != fmt.checksum)
+			return fail(ctx, STEG_ENOTEXT, "THE PAYLOAD DOES NOT MATCH ITS CHECKSUM");
+		return STEG_OK;
+	}
+
+	part_t *parts = malloc(nb_threads * sizeof(part_t));
+	pthread_t *threads = malloc(nb_threads * sizeof(pthread_t));
+	if(!parts || !threads){
+		free(parts);
+		free(threads);
+		return fail(ctx, STEG_ENOMEM, "CANNOT ALLOCATE %d THREADS", nb_threads);
+	}
+
+    // The remaining groups are given to the first threads
+	size_t start = 0;
+	for (int i = 0; i < nb_threads; i++){
+		size_t count = (nb_groups / nb_threads + ((size_t)i < nb_groups % nb_threads)) * group;
+		if(start + count > nb_char)
+			count = nb_char - start;
+		parts[i] = (part_t){ comp + start * fmt.sym_bits / fmt.nb_lsb, payload + start, count, fmt, encode, 0 };
+		start += count;
+	}
+	int nb_started = 0;
+	while(nb_started < nb_threads &&
+	      pthread_create(&threads[nb_started], NULL, part_thread, &parts[nb_started]) == 0)
+		nb_started++;
+
+    // Parts whose thread cannot be created are done by the caller
+	for (int i = nb_started; i < nb_threads; i++)
+		part_thread(&parts[i]);
+	for (int i = 0; i < nb_started; i++)
+		pthread_join(threads[i], NULL);
+
+    // The checksums of the parts are combined in order
+	if(!encode && fmt.checked){
+		uint32_t crc = parts[0].crc;
+		for (int i = 1; i < nb_threads; i++)
+			crc = crc32c_combine(crc, parts[i].crc, parts[i].nb_char);
+		if(crc != fmt.checksum)
+			status = fail(ctx, STEG_ENOTEXT, "THE PAYLOAD DOES NOT MATCH ITS CHECKSUM");
+	}
+
+	free(parts);
+	free(threads);
+	return status;
+}
+
+/***********************************************************
+ * Create a context
+ * @param nb_threads number of threads used for a job
+ * @return the context or NULL if nb_threads is not greater
+ *         than zero or the memory cannot be allocated
+ ***********************************************************/
+steg_ctx_t *steg_create(int nb_threads){
+	if(nb_threads <= 0)
+		return NULL;
+	steg_ctx_t *ctx = calloc(1, sizeof(steg_ctx_t));
+	if(ctx){
+		ctx->nb_threads = nb_threads;
+		ctx->fmt = DEFAULT_FORMAT;
+	}
+	return ctx;
+}
+
+/***********************************************************
+ * Choose the layout used by steg_encode (the decoding
+ * reads it from the header of the image)
+ * @param ctx the context
+ * @param nb_lsb number of lowest bits used per component
+ *               (1 to 4, 1 by default)
+ * @param sym_bits number of bits of a symbol (7 by default,
+ *                 8 to encode any byte)
+ * @return STEG_OK or STEG_EINVAL
+ ***********************************************************/
+int steg_set_format(steg_ctx_t *ctx, int nb_lsb, int sym_bits){
+	format_t fmt = { nb_lsb, sym_bits, CODEC_NONE, 0, false, 0, false, 0, false, false, 0, 0, 0, 0 };
+
+	if(!is_valid_format(fmt))
+		return fail(ctx, STEG_EINVAL, "INVALID FORMAT (%d BITS PER COMPONENT, %d BITS PER SYMBOL)",
+		            nb_lsb, sym_bits);
+	ctx->fmt = fmt;
+	return STEG_OK;
+}
+
+/***********************************************************
+ * Free a context
+ * @param ctx the context (may be NULL)
+ ***********************************************************/
+void steg_destroy(steg_ctx_t *ctx){
+	free(ctx);
+}
+
+/***********************************************************
+ * Message of the last error of a context
+ * @param ctx the context
+ * @return the message, empty if no error happened
+ ***********************************************************/
+const char *steg_last_error(const steg_ctx_t *ctx){
+	return ctx->error;
+}
+
+/***********************************************************
+ * Description of a return code
+ * @param status the return code
+ * @return the description
+ ***********************************************************/
+const char *steg_strerror(int status){
+	switch(status){
+		case STEG_OK:       return "success";
+		case STEG_EINVAL:   return "invalid argument";
+		case STEG_ENOMEM:   return "out of memory";
+		case STEG_ETOOLONG: return "payload too long";
+		case STEG_ENOTEXT:  return "no valid payload in the image";
+		default:            return "unknown error";
+	}
+}
+
+/***********************************************************
+ * The maximum of chars that can fit in an image with the
+ * layout of a context
+ * @param ctx the context
+ * @param width width of the image
+ * @param height height of the image
+ * @return the maximum of chars, 0 if the image is too small
+ ***********************************************************/
+size_t steg_capacity(const steg_ctx_t *ctx, int width, int height){
+	if(width <= 0 || height <= 0)
+		return 0;
+	return max_symbols((size_t)width * height * COMP_PER_PIXEL, ctx->fmt);
+}
+
+/***********************************************************
+ * Encode a payload (number of chars and chars) into an
+ * image, in place
+ * @param ctx the context
+ * @param pixels the components of the image (3 per pixel)
+ * @param width width of the image
+ * @param height height of the image
+ * @param payload the chars to encode (with symbols of 7 bits,
+ *                the negative chars are encoded as 0)
+ * @param length number of chars of the payload
+ * @return STEG_OK or an error (see steg_status_t)
+ ***********************************************************/
+int steg_encode(steg_ctx_t *ctx, uint8_t *pixels, int width, int height,
+                const char *payload, size_t length){
+	int status = check_image(ctx, pixels, width, height);
+	if(status != STEG_OK)
+		return status;
+	if(!payload && length > 0)
+		return fail(ctx, STEG_EINVAL, "INVALID PAYLOAD");
+	if(length > steg_capacity(ctx, width, height))
+		return fail(ctx, STEG_ETOOLONG, "PAYLOAD TOO LONG FOR THIS IMAGE (%zu CHARS MAX)",
+		            steg_capacity(ctx, width, height));
+
+	write_header(pixels, 0, header_size(ctx->fmt), length, ctx->fmt);
+	return run_parts(ctx, pixels + payload_offset(ctx->fmt), (char *)payload, length, ctx->fmt, true);
+}
+
+/***********************************************************
+ * Read the header of an image
+ * @param ctx the context
+ * @param pixels the components of the image (3 per pixel)
+ * @param width width of the image
+ * @param height height of the image
+ * @param length receives the number of chars
+ * @param fmt receives the layout of the payload
+ * @return STEG_OK or an error (see steg_status_t)
+ ***********************************************************/
+static int read_payload_header(steg_ctx_t *ctx, const uint8_t *pixels, int width, int height,
+                               size_t *length, format_t *fmt){
+	int status = check_image(ctx, pixels, width, height);
+	if(status != STEG_OK)
+		return status;
+	if(!length)
+		return fail(ctx, STEG_EINVAL, "INVALID LENGTH POINTER");
+
+	size_t nb_comp = (size_t)width * height * COMP_PER_PIXEL;
+	uint32_t nb_char;
+	if(read_header(pixels, nb_comp, &nb_char, fmt) != 1 || nb_char > max_symbols(nb_comp, *fmt))
+		return fail(ctx, STEG_ENOTEXT, "NO VALID TEXT IN THE IMAGE");
+	if(fmt->keyed)
+		return fail(ctx, STEG_ENOTEXT, "THE TEXT IS SCATTERED WITH A KEY");
+	if(fmt->container)
+		return fail(ctx, STEG_ENOTEXT, "THE IMAGE HOLDS A CONTAINER");
+	if(fmt->sharded && fmt->nb_shards > 1)
+		return fail(ctx, STEG_ENOTEXT, "THE IMAGE HOLDS A PART OF A TEXT CUT OVER SEVERAL IMAGES (SEE decode -M)");
+	*length = nb_char;
+	return STEG_OK;
+}
+
+/***********************************************************
+ * Read the number of chars encoded in an image (once
+ * decompressed, if the image was encoded with compression)
+ * @param ctx the context
+ * @param pixels the components of the image (3 per pixel)
+ * @param width width of the image
+ * @param height height of the image
+ * @param length receives the number of chars
+ * @return STEG_OK or an error (see steg_status_t)
+ ***********************************************************/
+int steg_payload_length(steg_ctx_t *ctx, const uint8_t *pixels, int width, int height,
+                        size_t *length){
+	format_t fmt;
+	int status = read_payload_header(ctx, pixels, width, height, length, &fmt);
+	if(status == STEG_OK && fmt.codec != CODEC_NONE)
+		*length = fmt.raw_len;
+	return status;
+}
+
+/***********************************************************
+ * Decode the payload hidden in an image, decompressing it
+ * if the image was encoded with compression (see lz.h)
+ * @param ctx the context
+ * @param pixels the components of the image (3 per pixel)
+ * @param width width of the image
+ * @param height height of the image
+ * @param payload receives the chars (not terminated by '\0')
+ * @param size size in bytes of the payload buffer
+ * @param length receives the number of chars
+ * @return STEG_OK or an error (see steg_status_t)
+ ***********************************************************/
+int steg_decode(steg_ctx_t *ctx, const uint8_t *pixels, int width, int height,
+                char *payload, size_t size, size_t *length){
+	format_t fmt;
+	int status = read_payload_header(ctx, pixels, width, height, length, &fmt);
+	if(status != STEG_OK)
+		return status;
+	size_t nb_sym = *length;
+	if(fmt.codec != CODEC_NONE)
+		*length = fmt.raw_len;
+	if(!payload && *length > 0)
+		return fail(ctx, STEG_EINVAL, "INVALID PAYLOAD");
+	if(*length > size)
+		return fail(ctx, STEG_ETOOLONG, "BUFFER TOO SMALL, %zu CHARS NEEDED", *length);
+	if(fmt.codec == CODEC_NONE)
+		return run_parts(ctx, (uint8_t *)pixels + payload_offset(fmt), payload, nb_sym, fmt, false);
+
+    // A compressed payload is decoded apart, then decompressed into the buffer
+	char *packed = malloc(nb_sym + 1);
+	if(!packed)
+		return fail(ctx, STEG_ENOMEM, "CANNOT ALLOCATE %zu BYTES", nb_sym + 1);
+	status = run_parts(ctx, (uint8_t *)pixels + payload_offset(fmt), packed, nb_sym, fmt, false);
+	if(status == STEG_OK && !lz_decompress(packed, nb_sym, payload, *length, ctx->nb_threads))
+		status = fail(ctx, STEG_ENOTEXT, "NO VALID TEXT IN THE IMAGE");
+	free(packed);
+	return status;
+}
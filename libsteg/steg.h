@@ -0,0 +1,42 @@
+/************************************************************************************
+ * @file steg.h
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 6 Dec 2017
+ * @brief Embeddable steganography library (libsteg)
+ ***********************************************************************************/
+#ifndef STEG_H
+#define STEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The library is built with hidden symbols: only its API is exported
+#define STEG_API __attribute__((visibility("default")))
+
+/***********************************************************
+ * Return codes of the library functions
+ ***********************************************************/
+typedef enum STEG_STATUS {
+	STEG_OK = 0,
+	STEG_EINVAL,   // invalid argument (NULL pointer, bad size)
+	STEG_ENOMEM,   // memory cannot be allocated
+	STEG_ETOOLONG, // payload too long for the image or the buffer
+	STEG_ENOTEXT   // no valid payload in the image
+} steg_status_t;
+
+typedef struct steg_ctx_st steg_ctx_t;
+
+STEG_API steg_ctx_t *steg_create(int nb_threads);
+STEG_API void steg_destroy(steg_ctx_t *ctx);
+STEG_API const char *steg_last_error(const steg_ctx_t *ctx);
+STEG_API const char *steg_strerror(int status);
+STEG_API int steg_set_format(steg_ctx_t *ctx, int nb_lsb, int sym_bits);
+STEG_API size_t steg_capacity(const steg_ctx_t *ctx, int width, int height);
+STEG_API int steg_encode(steg_ctx_t *ctx, uint8_t *pixels, int width, int height,
+                         const char *payload, size_t length);
+STEG_API int steg_payload_length(steg_ctx_t *ctx, const uint8_t *pixels, int width, int height,
+                                 size_t *length);
+STEG_API int steg_decode(steg_ctx_t *ctx, const uint8_t *pixels, int width, int height,
+                         char *payload, size_t size, size_t *length);
+
+#endif
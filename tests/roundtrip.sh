@@ -0,0 +1,208 @@
+#!/bin/bash
+#
+# Round trips of encode and decode through their options, with the regressions
+# of the daemon and of libsteg. Run by "make check" from this directory, once
+# the programs are built.
+#
+# Each check prints a line in case of failure; the script exits with 1 if any
+# failed.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+ENCODE=$ROOT/encode/encode
+DECODE=$ROOT/decode/decode
+DAEMON=$ROOT/daemon/daemon
+CLIENT=$ROOT/daemon/client
+STEG_CHECK=$ROOT/tests/steg_check
+
+DIR=$(mktemp -d)
+DAEMON_PID=
+trap '[ -n "$DAEMON_PID" ] && kill $DAEMON_PID; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+nb_failed=0
+nb_checks=0
+
+# fail message: record a failed check
+fail(){
+	echo "FAILED: $*"
+	nb_failed=$((nb_failed + 1))
+}
+
+# check message command...: run the command, which must succeed
+check(){
+	local msg=$1
+	shift
+	nb_checks=$((nb_checks + 1))
+	"$@" >/dev/null 2>&1 || fail "$msg"
+}
+
+# refused message command...: run the command, which must fail
+refused(){
+	local msg=$1
+	shift
+	nb_checks=$((nb_checks + 1))
+	"$@" >/dev/null 2>&1 && fail "$msg"
+}
+
+# ppm file width height: a binary PPM image of random pixels
+ppm(){
+	printf 'P6\n%d %d\n255\n' "$2" "$3" > "$1"
+	head -c $(($2 * $3 * 3)) /dev/urandom >> "$1"
+}
+
+# roundtrip name text image threads [encode options...]: encode the text into
+# out_name.ppm, decode it into out_name.txt and compare
+roundtrip(){
+	local name=$1 text=$2 image=$3 threads=$4
+	shift 4
+	check "$name: encode" "$ENCODE" "$@" "$text" "$image" "out_$name.ppm" "$threads"
+	local key=()
+	for ((i = 1; i <= $#; i++)); do
+		[ "${!i}" = -K ] && { j=$((i + 1)); key=(-K "${!j}"); }
+	done
+	check "$name: decode" "$DECODE" "${key[@]}" -o "out_$name.txt" "out_$name.ppm" "$threads"
+	check "$name: same text" cmp "out_$name.txt" "$text"
+}
+
+# flip_bit file offset: flip the lowest bit of a byte of a file
+flip_bit(){
+	local byte
+	byte=$(od -An -tu1 -j "$2" -N1 "$1" | tr -d ' ')
+	printf "\\$(printf '%03o' $((byte ^ 1)))" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# The texts and the carriers
+head -c 100000 "$ROOT/encode/gulliver.txt" > text.txt
+head -c 60000 /dev/urandom > binary.dat
+head -c 3000 /dev/urandom > small.dat
+ppm carrier.ppm 640 480
+mkdir carriers
+for i in 1 2 3; do ppm carriers/c$i.ppm 300 200; done
+
+# Layouts: bits per component (-k) and bits per symbol (-s)
+for k in 1 2 3 4; do
+	for threads in 1 3 auto; do
+		roundtrip "k${k}_s7_$threads" text.txt carrier.ppm $threads -k $k
+		roundtrip "k${k}_s8_$threads" binary.dat carrier.ppm $threads -k $k -s 8
+	done
+done
+
+# Compression (-z), checksum (-c) and key (-K), alone and together
+roundtrip z text.txt carrier.ppm 3 -z
+roundtrip c text.txt carrier.ppm 3 -c
+roundtrip K text.txt carrier.ppm 3 -K 1234
+roundtrip zcK binary.dat carrier.ppm 3 -z -c -K 99 -k 2
+refused "K: decode without the key" "$DECODE" -o out_K_nokey.txt out_K.ppm 3
+
+# Streaming by bands (-m): the same image as the normal mode, decoded by bands
+for opts in "-k 1" "-k 3 -c" "-z -c"; do
+	name=m_${opts// /}
+	check "$name: encode" "$ENCODE" $opts -m 64K text.txt carrier.ppm "out_$name.ppm" 3
+	check "$name: reference" "$ENCODE" $opts text.txt carrier.ppm "ref_$name.ppm" 3
+	check "$name: same image" cmp "out_$name.ppm" "ref_$name.ppm"
+	check "$name: decode" "$DECODE" -m 64K -o "out_$name.txt" "out_$name.ppm" 3
+	check "$name: same text" cmp "out_$name.txt" text.txt
+done
+
+# Patch of a copy (-p) and in place (-i): the same image as the normal mode
+check "p: reference" "$ENCODE" -c -k 2 text.txt carrier.ppm ref_p.ppm 3
+check "p: encode" "$ENCODE" -p -c -k 2 text.txt carrier.ppm out_p.ppm 3
+check "p: same image" cmp out_p.ppm ref_p.ppm
+cp carrier.ppm out_i.ppm
+check "i: encode" "$ENCODE" -i -c -k 2 text.txt out_i.ppm 3
+check "i: same image" cmp out_i.ppm ref_p.ppm
+
+# Container (-a): list the files, then extract each one
+check "a: encode" "$ENCODE" -a -c -k 2 carrier.ppm out_a.ppm 3 text.txt binary.dat small.dat
+check "a: list" "$DECODE" out_a.ppm 3
+for f in text.txt binary.dat small.dat; do
+	check "a: extract $f" "$DECODE" -e $f -o "out_a_$f" out_a.ppm 3
+	check "a: same $f" cmp "out_a_$f" $f
+done
+refused "a: extract a missing file" "$DECODE" -e missing -o out_a_missing out_a.ppm 3
+rm -f out_a_m.txt out_a_b.txt
+refused "a: decode by bands" "$DECODE" -m 64K -o out_a_m.txt out_a.ppm 3
+[ -e out_a_m.txt ] && fail "a: decode by bands left its output file"
+echo "out_a.ppm out_a_b.txt" > manifest_a
+refused "a: batch decode" "$DECODE" -b manifest_a 3
+[ -e out_a_b.txt ] && fail "a: batch decode wrote its output file"
+
+# Set of images (-M): a text too long for one carrier, decoded from the directory
+mkdir out_M
+refused "M: too long for one carrier" "$ENCODE" -s 8 binary.dat carriers/c1.ppm out_M1.ppm 3
+check "M: encode" "$ENCODE" -M -c -s 8 binary.dat carriers out_M 3
+check "M: decode" "$DECODE" -M -o out_M.dat out_M 3
+check "M: same text" cmp out_M.dat binary.dat
+refused "M: decode one shard" "$DECODE" -o out_M1.dat out_M/c1.ppm 3
+rm -f out_M1.dat
+refused "M: decode one shard by bands" "$DECODE" -m 64K -o out_M1.dat out_M/c1.ppm 3
+[ -e out_M1.dat ] && fail "M: decode one shard by bands left its output file"
+echo "out_M/c1.ppm out_M_b.dat" > manifest_M
+refused "M: batch decode one shard" "$DECODE" -b manifest_M 3
+[ -e out_M_b.dat ] && fail "M: batch decode of one shard wrote its output file"
+mkdir out_MK
+check "MK: encode" "$ENCODE" -M -K 7 -k 2 text.txt carriers out_MK 3
+check "MK: decode" "$DECODE" -M -K 7 -o out_MK.txt out_MK 3
+check "MK: same text" cmp out_MK.txt text.txt
+
+# PNG: written when the output ends with .png, and read as a carrier
+check "png: encode" "$ENCODE" -c text.txt carrier.ppm out_png.png 3
+check "png: decode" "$DECODE" -o out_png.txt out_png.png 3
+check "png: same text" cmp out_png.txt text.txt
+check "png carrier: encode" "$ENCODE" -k 2 -s 8 binary.dat out_png.png out_png2.ppm 3
+check "png carrier: decode" "$DECODE" -o out_png2.dat out_png2.ppm 3
+check "png carrier: same text" cmp out_png2.dat binary.dat
+
+# Regression: encoding an image into itself, loaded whole or by bands
+cp carrier.ppm same.ppm
+check "same path: encode" "$ENCODE" -c text.txt same.ppm same.ppm 3
+check "same path: decode" "$DECODE" -o out_same.txt same.ppm 3
+check "same path: same text" cmp out_same.txt text.txt
+cp carrier.ppm same_m.ppm
+check "same path -m: encode" "$ENCODE" -c -m 64K text.txt same_m.ppm same_m.ppm 3
+check "same path -m: decode" "$DECODE" -o out_same_m.txt same_m.ppm 3
+check "same path -m: same text" cmp out_same_m.txt text.txt
+
+# Regression: a missing carrier is refused with a message, in every mode
+for mode in "" "-z" "-c" "-K 3" "-m 64K" "-p"; do
+	nb_checks=$((nb_checks + 1))
+	"$ENCODE" $mode text.txt missing.ppm out_missing.ppm 3 >/dev/null 2>&1
+	[ $? -eq 1 ] || fail "missing carrier ${mode:-whole}: encode did not exit with 1"
+done
+nb_checks=$((nb_checks + 1))
+"$ENCODE" -a missing.ppm out_missing.ppm 3 text.txt >/dev/null 2>&1
+[ $? -eq 1 ] || fail "missing carrier -a: encode did not exit with 1"
+
+# Regression: a text not matching its checksum is refused, without leaving its
+# output file (a bit of the text flipped, after the PPM and payload headers)
+cp ref_m_-k3-c.ppm corrupt.ppm
+flip_bit corrupt.ppm 5000
+for mode in "" "-m 64K"; do
+	rm -f out_corrupt.txt
+	refused "corrupt ${mode:-whole}: decode" "$DECODE" $mode -o out_corrupt.txt corrupt.ppm 3
+	[ -e out_corrupt.txt ] && fail "corrupt ${mode:-whole}: output file left"
+done
+
+# Regression: the daemon and libsteg decode a plain text, but refuse a container
+# and a shard of a set (which need decode -e and decode -M)
+"$DAEMON" "$DIR/daemon.sock" 1 >/dev/null 2>&1 &
+DAEMON_PID=$!
+for i in $(seq 50); do [ -S "$DIR/daemon.sock" ] && break; sleep 0.1; done
+check "daemon: plain text" "$CLIENT" "$DIR/daemon.sock" decode "$DIR/out_c.ppm" "$DIR/out_daemon.txt"
+check "daemon: same text" cmp out_daemon.txt text.txt
+refused "daemon: container" "$CLIENT" "$DIR/daemon.sock" decode "$DIR/out_a.ppm"
+refused "daemon: shard" "$CLIENT" "$DIR/daemon.sock" decode "$DIR/out_M/c1.ppm"
+# A client connected without sending its request does not hold up the others
+perl -MIO::Socket::UNIX -e '$s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or exit 1; sleep 3' \
+	"$DIR/daemon.sock" &
+sleep 0.5
+check "daemon: silent client" timeout 2 "$CLIENT" "$DIR/daemon.sock" stats
+wait $!
+check "libsteg: plain text" "$STEG_CHECK" out_c.ppm
+refused "libsteg: container" "$STEG_CHECK" out_a.ppm
+refused "libsteg: shard" "$STEG_CHECK" out_M/c1.ppm
+
+if [ $nb_failed -ne 0 ]; then
+	echo "$nb_failed of $nb_checks checks failed"
+	exit 1
+fi
+echo "All $nb_checks checks passed"
@@ -0,0 +1,68 @@
+/************************************************************************************
+ * @file steg_check.c
+ * @author Erias Diego, Pisanello Antonio, Rmiza Hassine
+ * @date 20 Dec 2017
+ * @brief Read the length of the payload of a binary PPM image through libsteg
+ *
+ * This program loads a binary PPM image (argument 1) and asks libsteg for the
+ * length of its payload: it prints the length, or the error of libsteg and exits
+ * with its status (see steg.h). The tests use it to check which images libsteg
+ * refuses.
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../libsteg/steg.h"
+
+/***********************************************************
+ * Load the pixels of a binary PPM image (maxval 255)
+ * @param filename the path of the image
+ * @param width receives the width of the image
+ * @param height receives the height of the image
+ * @return the components of the image (to free), or NULL
+ ***********************************************************/
+static uint8_t *load_pixels(const char *filename, int *width, int *height){
+	FILE *f = fopen(filename, "rb");
+	int maxval;
+
+	if(!f)
+		return NULL;
+	if(fscanf(f, "P6 %d %d %d", width, height, &maxval) != 3 || maxval != 255 || fgetc(f) == EOF ||
+	   *width <= 0 || *height <= 0){
+		fclose(f);
+		return NULL;
+	}
+	size_t nb_comp = (size_t)*width * *height * 3;
+	uint8_t *pixels = malloc(nb_comp);
+	if(pixels && fread(pixels, 1, nb_comp, f) != nb_comp){
+		free(pixels);
+		pixels = NULL;
+	}
+	fclose(f);
+	return pixels;
+}
+
+int main(int argc, char **argv){
+	int width, height;
+
+	if(argc != 2){
+		fprintf(stderr, "usage: %s image\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	uint8_t *pixels = load_pixels(argv[1], &width, &height);
+	steg_ctx_t *ctx = steg_create(1);
+	if(!pixels || !ctx){
+		fprintf(stderr, "CANNOT READ THE IMAGE %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	size_t length;
+	int status = steg_payload_length(ctx, pixels, width, height, &length);
+	if(status == STEG_OK)
+		printf("%zu\n", length);
+	else
+		printf("%s\n", steg_last_error(ctx));
+	steg_destroy(ctx);
+	free(pixels);
+	return status;
+}